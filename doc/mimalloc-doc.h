@@ -163,6 +163,14 @@ void* mi_recalloc(void* p, size_t count, size_t size);
 /// new size. If \a newsize is larger than the
 /// original \a size allocated for \a p, the bytes after \a size
 /// are uninitialized.
+///
+/// Huge blocks (larger than the large object size) that were allocated directly from the
+/// OS can also grow in place by remapping their memory (on Linux using `mremap`).
+/// Similarly, mi_realloc() remaps such blocks (possibly to a new address) instead of
+/// copying them. If #mi_option_remap_threshold is set (it is 0 and disabled by default),
+/// huge blocks that are reallocated to at least the threshold are allocated from the OS for
+/// this reason, instead of from an arena (and thus not from reserved huge OS pages or arenas
+/// on a specific NUMA node).
 void* mi_expand(void* p, size_t newsize);
 
 /// Allocate \a count elements of \a size bytes.
@@ -327,6 +335,40 @@ void mi_stats_reset(void);
 /// Merge thread local statistics with the main statistics and reset.
 void mi_stats_merge(void);
 
+/// Get the main statistics (declared in `mimalloc-stats.h`).
+/// @param stats_size Should be `sizeof(mi_stats_t)`; at most this many bytes are written.
+/// @param stats The statistics are copied in here; `stats->version` is set to \a MI_STAT_VERSION.
+///
+/// Merges the statistics of the current thread first. This never allocates.
+/// The per size bins (`normal_bins`) are only maintained when mimalloc is built with `MI_STAT>1`
+/// (as in debug builds).
+void mi_stats_get(size_t stats_size, mi_stats_t* stats);
+
+/// Get the main statistics as a JSON document (declared in `mimalloc-stats.h`).
+/// @param buf_size The size of \a buf in bytes.
+/// @param buf The buffer that receives the zero terminated JSON document (can be \a NULL if \a buf_size is 0).
+/// @returns The length of the full document (excluding the terminating zero).
+///          If this is not less than \a buf_size the output was truncated.
+///
+/// Besides all statistics, the document also contains process information,
+/// information about every arena, and the abandoned segment counts of the
+/// sub-process of the current thread. This never allocates so it can be
+/// polled cheaply, for example from a metrics exporter.
+size_t mi_stats_get_json(size_t buf_size, char* buf);
+
+/// Aggregate the cheap per-thread allocation counters.
+/// @param size  Pass `sizeof(mi_stats_counters_t)`.
+/// @param counters  The aggregated counters of all live and terminated threads.
+/// @returns `true` if the counters are maintained, or `false` (and all zeros)
+/// if mimalloc was not built with `MI_STAT_COUNTERS=ON`.
+///
+/// Each thread counts its allocations, generic (slow path) allocations, local
+/// frees, and cross-thread frees without any atomic read-modify-write
+/// operations, so this can stay enabled in release builds. Once every
+/// `sample_rate` (256) operations the size bin of the block is recorded as well.
+/// The counters are also included in the output of mi_stats_get_json().
+bool mi_stats_get_counters(size_t size, mi_stats_counters_t* counters);
+
 /// Initialize mimalloc on a thread.
 /// Should not be used as on most systems (pthreads, windows) this is done
 /// automatically.
@@ -338,6 +380,36 @@ void mi_thread_init(void);
 /// be freed by other threads in the future) is properly handled.
 void mi_thread_done(void);
 
+/// Opaque handle to the memory of a terminated thread (see mi_thread_done_handoff()).
+typedef struct mi_thread_handoff_s mi_thread_handoff_t;
+
+/// Uninitialize mimalloc on a thread and hand off its memory to a successor thread.
+/// @returns A handle that must be passed exactly once to either mi_thread_adopt() or
+/// mi_thread_handoff_release(), or \a NULL if the thread cannot hand off its memory (like the
+/// main thread) in which case this is equivalent to mi_thread_done().
+///
+/// Instead of abandoning its segments (which other threads then need to discover
+/// and reclaim) the pages and segments of the thread stay together in the handle
+/// until they are adopted. Blocks in them can still be freed by other threads
+/// in the mean time. This is useful for thread pools that replace worker threads
+/// where the successor thread can continue with a warm heap.
+/// Note that no other thread reclaims the memory in the handle: if it is never
+/// adopted or released, its pages and segments are leaked.
+mi_thread_handoff_t* mi_thread_done_handoff(void);
+
+/// Adopt the memory of a terminated thread into the heap of the current thread.
+/// @param handoff The handle returned by mi_thread_done_handoff(), which is invalid afterwards.
+/// @returns \a true if the pages and segments were adopted; if the handed-off memory is of another
+/// sub-process it is abandoned instead (and the handle is released as well).
+bool mi_thread_adopt(mi_thread_handoff_t* handoff);
+
+/// Release the memory of a terminated thread without adopting it.
+/// @param handoff The handle returned by mi_thread_done_handoff(), which is invalid afterwards.
+///
+/// The pages and segments are abandoned as if the thread had called mi_thread_done(),
+/// so other threads can reclaim them. Use this if no successor thread adopts the handle.
+void mi_thread_handoff_release(mi_thread_handoff_t* handoff);
+
 /// Print out heap statistics for this thread.
 /// @param out An output function or \a NULL for the default.
 /// @param arg Optional argument passed to \a out (if not \a NULL)
@@ -551,6 +623,19 @@ mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id);
 /// This is used for example in the CPython integration.
 mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id);
 
+/// @brief Create a new heap that prefers memory from a specific NUMA node.
+/// @param heap_tag       The heap tag associated with this heap; heaps only reclaim memory between heaps with the same tag.
+/// @param allow_destroy  Is \a mi_heap_destroy allowed?  Not allowing this allows the heap to reclaim memory from terminated threads.
+/// @param arena_id       If not 0, the heap will only allocate from the specified arena.
+/// @param numa_node      The preferred NUMA node, or -1 to use the NUMA node of the current thread.
+/// @return A new heap or `NULL` on failure.
+///
+/// Fresh segments are allocated from arenas on \a numa_node first, and
+/// abandoned segments in arenas on that node are reclaimed before those
+/// on other nodes. Reclaims that cross a node are counted in the statistics.
+/// A \a numa_node outside the range of available nodes is treated as -1.
+mi_heap_t* mi_heap_new_numa(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id, int numa_node);
+
 /// A process can associate threads with sub-processes.
 /// A sub-process will not reclaim memory from (abandoned heaps/threads)
 /// other subprocesses.
@@ -572,6 +657,68 @@ void mi_subproc_delete(mi_subproc_id_t subproc);
 /// This should be called right after a thread is created (and no allocation has taken place yet)
 void mi_subproc_add_current_thread(mi_subproc_id_t subproc);
 
+/// Type of a stack unwinder for the heap profiler.
+/// @param frames  Array to store the return addresses in (innermost first).
+/// @param max_frames  The number of entries in \a frames.
+/// @param arg  Argument that was passed to mi_heap_profile_set_unwinder().
+/// @returns The number of frames stored.
+/// The unwinder is called on the thread that allocates a sampled block and may allocate itself.
+typedef size_t (mi_stack_unwind_fun)(void** frames, size_t max_frames, void* arg);
+
+/// Set the stack unwinder for the heap profiler.
+/// @param unwind  The unwinder, or \a NULL to use the default unwinder of the platform
+///                (`backtrace` on glibc and macOS, `CaptureStackBackTrace` on Windows).
+/// @param arg  Argument passed to the unwinder.
+void mi_heap_profile_set_unwinder(mi_stack_unwind_fun* unwind, void* arg);
+
+/// Output a heap profile of the live sampled blocks.
+/// @param out  An output function or \a NULL for the default.
+/// @param arg  Optional argument passed to \a out (if not \a NULL)
+///
+/// The heap profiler is enabled by setting #mi_option_heap_profile_interval
+/// (in KiB) after which about one allocation every `interval` bytes is sampled and its stack
+/// trace is recorded. Sampling only happens in the generic allocation path
+/// so the fast path is not affected. The profile is written in the legacy heap profile
+/// format that `pprof` understands (including the memory mappings on Linux), e.g.
+/// `pprof --text ./myprogram heap.prof`. Blocks that are released with mi_heap_destroy()
+/// stay in the profile until their address is sampled again.
+void mi_heap_profile_dump(mi_output_fun* out, void* arg);
+
+/// Get the utilization of the page that contains a block.
+/// @param p  Pointer to a block.
+/// @param used  If not \a NULL, set to the number of used blocks in the page.
+/// @param total  If not \a NULL, set to the total number of blocks the page can contain.
+/// @returns \a true if \a p points into a heap page, and \a false for \a NULL or pointers outside the mimalloc heap.
+/// The counts are approximate if the page is owned by another thread.
+bool mi_page_utilization(const void* p, size_t* used, size_t* total);
+
+/// Would moving a block help to free up its page?
+/// @param heap  The heap the block belongs to.
+/// @param p  Pointer to a block.
+/// @returns \a true if \a p belongs to \a heap and its page is less utilized than
+/// the pages from which new blocks of that size are allocated.
+///
+/// Together with mi_heap_defrag_realloc() this can be used for active defragmentation
+/// of long lived heaps, where an application (like a cache) incrementally walks its objects
+/// and moves those out of sparsely used pages, so those pages can be freed.
+bool mi_heap_defrag_hint(mi_heap_t* heap, const void* p);
+
+/// Would moving a block help to free up its page?
+/// Same as mi_heap_defrag_hint() for the heap of \a p (and \a false if that heap belongs to another thread).
+bool mi_defrag_hint(const void* p);
+
+/// Reallocate a block into another page.
+/// @param heap  The heap to allocate in.
+/// @param p  Pointer to a block (or \a NULL).
+/// @param newsize  The new size in bytes.
+/// @returns A pointer to a block of \a newsize bytes that is never in the same page as \a p, or
+/// \a NULL if that could not be allocated (in which case \a p is still valid).
+void* mi_heap_defrag_realloc(mi_heap_t* heap, void* p, size_t newsize);
+
+/// Reallocate a block into another page in the default heap.
+/// See mi_heap_defrag_realloc().
+void* mi_defrag_realloc(void* p, size_t newsize);
+
 
 /// \}
 
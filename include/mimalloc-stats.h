@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2018-2024, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MIMALLOC_STATS_H
+#define MIMALLOC_STATS_H
+
+#include <mimalloc.h>
+#include <stdint.h>
+
+// ------------------------------------------------------
+// Statistics for programmatic access.
+// New fields are only ever added at the end of `mi_stats_t`;
+// the version is increased on any other (incompatible) change.
+// ------------------------------------------------------
+
+#define MI_STAT_VERSION     2     // incremented on incompatible changes to `mi_stats_t`
+#define MI_STAT_BIN_COUNT   (74 + 16) // maximum number of size bins (`MI_BIN_HUGE+1` with at most 16 extra size classes)
+
+// count allocation over time
+typedef struct mi_stat_count_s {
+  int64_t allocated;    // total allocated
+  int64_t freed;        // total freed
+  int64_t peak;         // maximum at any time (only accurate per thread)
+  int64_t current;      // current amount
+} mi_stat_count_t;
+
+// counters only increase
+typedef struct mi_stat_counter_s {
+  int64_t total;        // total sum of the increments
+  int64_t count;        // number of increments
+} mi_stat_counter_t;
+
+typedef struct mi_stats_s {
+  int               version;
+  mi_stat_count_t   segments;
+  mi_stat_count_t   pages;
+  mi_stat_count_t   reserved;
+  mi_stat_count_t   committed;
+  mi_stat_count_t   reset;
+  mi_stat_count_t   purged;
+  mi_stat_count_t   page_committed;
+  mi_stat_count_t   segments_abandoned;
+  mi_stat_count_t   pages_abandoned;
+  mi_stat_count_t   threads;
+  mi_stat_count_t   normal;
+  mi_stat_count_t   huge;
+  mi_stat_count_t   giant;
+  mi_stat_count_t   malloc;
+  mi_stat_count_t   segments_cache;
+  mi_stat_counter_t pages_extended;
+  mi_stat_counter_t mmap_calls;
+  mi_stat_counter_t commit_calls;
+  mi_stat_counter_t reset_calls;
+  mi_stat_counter_t purge_calls;
+  mi_stat_counter_t page_no_retire;
+  mi_stat_counter_t searches;
+  mi_stat_counter_t normal_count;
+  mi_stat_counter_t huge_count;
+  mi_stat_counter_t arena_count;
+  mi_stat_counter_t arena_crossover_count;
+  mi_stat_counter_t arena_rollback_count;
+  mi_stat_counter_t arena_numa_crossover_count;
+  mi_stat_counter_t purge_background;
+  mi_stat_count_t   normal_bins[MI_STAT_BIN_COUNT];  // only maintained if mimalloc is built with `MI_STAT>1`
+  mi_stat_counter_t remap_calls;                     // OS remaps to grow or shrink huge blocks without copying
+  mi_stat_counter_t realloc_no_copy;                 // reallocations that avoided a copy (grown in place or remapped)
+  mi_stat_counter_t page_churn;                      // fresh pages allocated shortly after a retired page of the same size was freed
+  mi_stat_counter_t page_churn_bins[MI_STAT_BIN_COUNT];  // page churn per size bin (only maintained if mimalloc is built with `MI_STAT>1`)
+  mi_stat_counter_t thp_advised;                     // bytes advised to be backed by transparent huge pages (see `mi_option_thp_aware`)
+  mi_stat_counter_t abandoned_hint_reclaim;          // abandoned segments reclaimed through a hint (without scanning the abandoned bitmaps)
+} mi_stats_t;
+
+// Cheap always-on allocation counters (only maintained if mimalloc is built with `MI_STAT_COUNTERS=1`).
+// The counts are exact; the size bins are sampled once every `sample_rate` operations.
+typedef struct mi_stats_counters_s {
+  int64_t malloc_count;                         // allocations from a page free list
+  int64_t malloc_generic_count;                 // calls to the generic (slow path) allocation routine
+  int64_t free_count;                           // frees by the owning thread
+  int64_t free_mt_count;                        // frees by another thread (delayed or concurrent)
+  int64_t sample_rate;                          // one in `sample_rate` operations is sampled in the size bins
+  int64_t threads;                              // number of threads currently registered
+  int64_t malloc_samples[MI_STAT_BIN_COUNT];    // sampled allocations per size bin
+  int64_t free_samples[MI_STAT_BIN_COUNT];      // sampled frees per size bin
+} mi_stats_counters_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Copy the process wide statistics (after merging the statistics of the current thread) into `stats`.
+// Pass `sizeof(mi_stats_t)` as `stats_size`; only the first `stats_size` bytes are written.
+mi_decl_export void   mi_stats_get(size_t stats_size, mi_stats_t* stats) mi_attr_noexcept;
+
+// Write the process wide statistics, arena and sub-process information as a JSON document into `buf`.
+// This never allocates. Returns the length of the full document (excluding the terminating zero);
+// if this is `>= buf_size` the output was truncated (just like `snprintf`).
+mi_decl_export size_t mi_stats_get_json(size_t buf_size, char* buf) mi_attr_noexcept;
+
+// Aggregate the per-thread allocation counters of all live threads and terminated threads into `counters`.
+// Pass `sizeof(mi_stats_counters_t)` as `size`. Returns `false` (and zeros `counters`) if
+// mimalloc was not built with `MI_STAT_COUNTERS=1`.
+mi_decl_export bool   mi_stats_get_counters(size_t size, mi_stats_counters_t* counters) mi_attr_noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MIMALLOC_STATS_H
@@ -157,6 +157,11 @@ mi_decl_export void mi_stats_print_out(mi_output_fun* out, void* arg) mi_attr_no
 mi_decl_export void mi_process_init(void)     mi_attr_noexcept;
 mi_decl_export void mi_thread_init(void)      mi_attr_noexcept;
 mi_decl_export void mi_thread_done(void)      mi_attr_noexcept;
+
+typedef struct mi_thread_handoff_s mi_thread_handoff_t;
+mi_decl_export mi_thread_handoff_t* mi_thread_done_handoff(void) mi_attr_noexcept;
+mi_decl_export bool mi_thread_adopt(mi_thread_handoff_t* handoff) mi_attr_noexcept;
+mi_decl_export void mi_thread_handoff_release(mi_thread_handoff_t* handoff) mi_attr_noexcept;
 mi_decl_export void mi_thread_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept;
 
 mi_decl_export void mi_process_info(size_t* elapsed_msecs, size_t* user_msecs, size_t* system_msecs,
@@ -200,6 +205,11 @@ mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_calloc(mi_heap_t
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_mallocn(mi_heap_t* heap, size_t count, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size2(2, 3);
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_malloc_small(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
 
+// Allocate (or free) many blocks at once; `mi_heap_malloc_batch` returns the number of blocks allocated
+// (only less than `count` when out of memory), and `mi_free_batch` frees consecutive blocks in the same page as a group.
+mi_decl_export size_t mi_heap_malloc_batch(mi_heap_t* heap, size_t size, void** blocks, size_t count) mi_attr_noexcept;
+mi_decl_export void   mi_free_batch(void** blocks, size_t count) mi_attr_noexcept;
+
 mi_decl_nodiscard mi_decl_export void* mi_heap_realloc(mi_heap_t* heap, void* p, size_t newsize)              mi_attr_noexcept mi_attr_alloc_size(3);
 mi_decl_nodiscard mi_decl_export void* mi_heap_reallocn(mi_heap_t* heap, void* p, size_t count, size_t size)  mi_attr_noexcept mi_attr_alloc_size2(3,4);
 mi_decl_nodiscard mi_decl_export void* mi_heap_reallocf(mi_heap_t* heap, void* p, size_t newsize)             mi_attr_noexcept mi_attr_alloc_size(3);
@@ -306,6 +316,28 @@ mi_decl_export bool mi_abandoned_visit_blocks(mi_subproc_id_t subproc_id, int he
 // fall back to `mi_heap_delete`.
 mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id);
 
+// Experimental: as `mi_heap_new_ex` but prefer segments on the given NUMA node (or -1 for the node of the current thread).
+// Fresh segments are allocated in arenas on that node first, and abandoned segments are reclaimed from that node first.
+mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_numa(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id, int numa_node);
+
+// Experimental: sampling heap profiler (enabled by setting `mi_option_heap_profile_interval`).
+// The unwinder captures at most `max_frames` return addresses of the current stack and returns the number captured;
+// pass NULL to use the default unwinder of the platform.
+typedef size_t (mi_cdecl mi_stack_unwind_fun)(void** frames, size_t max_frames, void* arg);
+mi_decl_export void mi_heap_profile_set_unwinder(mi_stack_unwind_fun* unwind, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_heap_profile_dump(mi_output_fun* out, void* arg) mi_attr_noexcept;
+
+// Experimental: active defragmentation of long lived heaps (like a cache that moves its entries out of sparsely used pages).
+// `mi_page_utilization` returns the used and total number of blocks in the page of `p` (approximate if the page is owned by another thread).
+// `mi_heap_defrag_hint` returns true if `p` is in a page of `heap` that is less utilized than the page new blocks of its size are allocated
+// from, and `mi_defrag_hint` does the same for the heap of `p` (if it belongs to the current thread).
+// `mi_heap_defrag_realloc` reallocates `p` to a block that is never in the same page as `p`; it returns NULL (and `p` stays valid) if that fails.
+mi_decl_export bool mi_page_utilization(const void* p, size_t* used, size_t* total) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export bool  mi_heap_defrag_hint(mi_heap_t* heap, const void* p) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export bool  mi_defrag_hint(const void* p) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export void* mi_heap_defrag_realloc(mi_heap_t* heap, void* p, size_t newsize) mi_attr_noexcept mi_attr_alloc_size(3);
+mi_decl_nodiscard mi_decl_export void* mi_defrag_realloc(void* p, size_t newsize) mi_attr_noexcept mi_attr_alloc_size(2);
+
 // deprecated
 mi_decl_export int mi_reserve_huge_os_pages(size_t pages, double max_secs, size_t* pages_reserved) mi_attr_noexcept;
 
@@ -366,6 +398,15 @@ typedef enum mi_option_e {
   mi_option_disallow_arena_alloc,       // 1 = do not use arena's for allocation (except if using specific arena id's)
   mi_option_retry_on_oom,               // retry on out-of-memory for N milli seconds (=400), set to 0 to disable retries. (only on windows)
   mi_option_visit_abandoned,            // allow visiting heap blocks from abandoned threads (=0)
+  mi_option_remote_free_batch,          // collect up to N frees per page from another thread before publishing them with a single atomic operation (=0, disabled)
+  mi_option_purge_background,           // purge arena memory in a background thread instead of on the allocation path; the thread starts on the next arena free or collect if enabled after process initialization, and exits when disabled (=0)
+  mi_option_heap_profile_interval,      // sample an allocation about once every N KiB allocated for the heap profiler (=0, disabled)
+  mi_option_remap_threshold,            // reallocate huge blocks of at least N KiB directly in OS memory (instead of an arena) so they can be remapped without copying later on (=0, disabled)
+  mi_option_thread_data_pool,           // keep the metadata of up to N terminated threads for reuse by new threads (=32)
+  mi_option_thread_warm_start,          // a new thread that reuses thread metadata first reclaims up to N segments abandoned by the previous owner (=1)
+  mi_option_thp_aware,                  // only use transparent huge pages for densely used segments and purge those at huge OS page granularity (=0)
+  mi_option_cpu_cache,                  // Linux only: cache up to N freed small blocks per size class in per-CPU caches shared by all threads (=0, disabled)
+  mi_option_page_max_candidates,        // when looking for a page with free blocks, pick the fullest of the first N pages that have free blocks (=8, 1 for first fit)
   _mi_option_last,
   // legacy option names
   mi_option_large_os_pages = mi_option_allow_large_os_pages,
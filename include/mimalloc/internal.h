@@ -104,9 +104,11 @@ bool       _mi_os_protect(void* addr, size_t size);
 bool       _mi_os_unprotect(void* addr, size_t size);
 bool       _mi_os_purge(void* p, size_t size, mi_stats_t* stats);
 bool       _mi_os_purge_ex(void* p, size_t size, bool allow_reset, mi_stats_t* stats);
+bool       _mi_os_thp_advise(void* addr, size_t size, bool enable, mi_stats_t* stats);
 
 void*      _mi_os_alloc_aligned(size_t size, size_t alignment, bool commit, bool allow_large, mi_memid_t* memid, mi_stats_t* stats);
 void*      _mi_os_alloc_aligned_at_offset(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large, mi_memid_t* memid, mi_stats_t* tld_stats);
+void*      _mi_os_remap(void* addr, size_t size, size_t newsize, size_t alignment, bool allow_move, mi_memid_t* memid, mi_stats_t* tld_stats);
 
 void*      _mi_os_get_aligned_hint(size_t try_alignment, size_t size);
 bool       _mi_os_use_large_page(size_t size, size_t alignment);
@@ -117,19 +119,41 @@ void*      _mi_os_alloc_huge_os_pages(size_t pages, int numa_node, mi_msecs_t ma
 // arena.c
 mi_arena_id_t _mi_arena_id_none(void);
 void       _mi_arena_free(void* p, size_t size, size_t still_committed_size, mi_memid_t memid, mi_stats_t* stats);
-void*      _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid, mi_os_tld_t* tld);
-void*      _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid, mi_os_tld_t* tld);
+void*      _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t req_arena_id, int numa_node, mi_memid_t* memid, mi_os_tld_t* tld);
+void*      _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large, mi_arena_id_t req_arena_id, int numa_node, mi_memid_t* memid, mi_os_tld_t* tld);
+int        _mi_arena_memid_numa_node(mi_memid_t memid);
 bool       _mi_arena_memid_is_suitable(mi_memid_t memid, mi_arena_id_t request_arena_id);
+bool       _mi_arena_memid_is_thp(mi_memid_t memid, size_t size);
+bool       _mi_arena_thp_advise(void* p, size_t size, mi_memid_t memid, mi_stats_t* stats);
 bool       _mi_arena_contains(const void* p);
 void       _mi_arenas_collect(bool force_purge, mi_stats_t* stats);
+bool       _mi_arenas_purge_thread_start(void);
+void       _mi_arenas_purge_thread_stop(void);
 void       _mi_arena_unsafe_destroy_all(mi_stats_t* stats);
 
 bool       _mi_arena_segment_clear_abandoned(mi_segment_t* segment);
 void       _mi_arena_segment_mark_abandoned(mi_segment_t* segment);
+size_t     _mi_arena_segment_abandoned_hint(const mi_segment_t* segment);
+mi_segment_t* _mi_arena_segment_clear_abandoned_hint(mi_subproc_t* subproc, size_t hint);
 
 void*      _mi_arena_meta_zalloc(size_t size, mi_memid_t* memid);
 void       _mi_arena_meta_free(void* p, mi_memid_t memid, size_t size);
 
+typedef struct mi_arena_info_s {
+  size_t         block_size;              // size of an arena block in bytes
+  size_t         block_count;             // size of the arena in blocks (of `MI_ARENA_BLOCK_SIZE`)
+  size_t         inuse_count;             // blocks in use
+  size_t         committed_count;         // blocks committed (equals `block_count` if the arena cannot decommit)
+  size_t         abandoned_count;         // blocks that start an abandoned segment
+  size_t         purge_count;             // blocks scheduled to be purged
+  size_t         thp_count;               // blocks advised to use transparent huge pages (see `mi_option_thp_aware`)
+  int            numa_node;               // associated numa node (or -1)
+  bool           exclusive;               // only used by heaps specifically for this arena
+  bool           is_large;                // consists of large- or huge OS pages
+  bool           is_pinned;               // cannot be decommitted
+} mi_arena_info_t;
+bool       _mi_arena_get_info(size_t arena_index, mi_arena_info_t* info);
+
 typedef struct mi_arena_field_cursor_s { // abstract struct
   size_t         os_list_count;           // max entries to visit in the OS abandoned list
   size_t         start;                   // start arena idx (may need to be wrapped)
@@ -138,8 +162,14 @@ typedef struct mi_arena_field_cursor_s { // abstract struct
   mi_subproc_t*  subproc;                 // only visit blocks in this sub-process
   bool           visit_all;               // ensure all abandoned blocks are seen (blocking)
   bool           hold_visit_lock;         // if the subproc->abandoned_os_visit_lock is held
+  bool           numa_local;              // if only arenas on `numa_node` are visited (first pass)
+  int            numa_node;               // preferred numa node (or -1 if there is no preference)
+  size_t         numa_start;              // start arena idx for the second pass over the non-local arenas
+  mi_page_kind_t hint_kind;               // page kind of the abandoned hints to visit first
+  size_t         hint_idx;                // next abandoned hint slot to visit (may need to be wrapped)
+  size_t         hint_count;              // remaining abandoned hint slots to visit
 } mi_arena_field_cursor_t;
-void          _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool visit_all, mi_arena_field_cursor_t* current);
+void          _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool visit_all, mi_page_kind_t kind, mi_arena_field_cursor_t* current);
 mi_segment_t* _mi_arena_segment_clear_abandoned_next(mi_arena_field_cursor_t* previous);
 void          _mi_arena_field_cursor_done(mi_arena_field_cursor_t* current);
 
@@ -152,16 +182,20 @@ mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t pag
 void       _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld);
 void       _mi_segment_page_abandon(mi_page_t* page, mi_segments_tld_t* tld);
 uint8_t*   _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* page, size_t* page_size);
+uint8_t*   _mi_segment_page_start_ex(const mi_segment_t* segment, const mi_page_t* page, size_t block_size, size_t* page_size);
 
 #if MI_HUGE_PAGE_ABANDON
 void       _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block_t* block);
 #else
 void       _mi_segment_huge_page_reset(mi_segment_t* segment, mi_page_t* page, mi_block_t* block);
 #endif
+mi_page_t* _mi_segment_huge_page_remap(mi_page_t* page, size_t block_size, bool allow_move, mi_segments_tld_t* tld);
 
 void       _mi_segments_collect(bool force, mi_segments_tld_t* tld);
 void       _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld);
 bool       _mi_segment_attempt_reclaim(mi_heap_t* heap, mi_segment_t* segment);
+void       _mi_segments_warm_start(mi_heap_t* heap, const size_t* hints, size_t count);
+void       _mi_segments_absorb(mi_segments_tld_t* tld, mi_segments_tld_t* from);
 bool       _mi_segment_visit_blocks(mi_segment_t* segment, int heap_tag, bool visit_blocks, mi_block_visit_fun* visitor, void* arg);
 
 // "page.c"
@@ -169,7 +203,10 @@ void*      _mi_malloc_generic(mi_heap_t* heap, size_t size, bool zero, size_t hu
 
 void       _mi_page_retire(mi_page_t* page) mi_attr_noexcept;                  // free the page if there are no other pages with many free blocks
 void       _mi_page_unfull(mi_page_t* page);
+void       _mi_page_exclude(mi_page_t* page);                                 // move to the full queue so no blocks are allocated from it
 void       _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force);   // free the page
+mi_page_t* _mi_huge_page_remap(mi_heap_t* heap, mi_page_t* page, size_t size, bool allow_move);  // resize a huge page without copying
+bool       _mi_page_grow_first_block(mi_heap_t* heap, mi_page_t* page, size_t size);                 // grow the only used block of a page in place
 void       _mi_page_abandon(mi_page_t* page, mi_page_queue_t* pq);            // abandon the page, to be picked up by another thread...
 void       _mi_heap_delayed_free_all(mi_heap_t* heap);
 bool       _mi_heap_delayed_free_partial(mi_heap_t* heap);
@@ -185,6 +222,7 @@ void       _mi_page_reclaim(mi_heap_t* heap, mi_page_t* page);   // callback fro
 
 size_t     _mi_bin_size(uint8_t bin);           // for stats
 uint8_t    _mi_bin(size_t size);                // for stats
+void       _mi_page_queues_init(mi_page_queue_t* pages);  // set the block size of each queue (with extra size classes)
 
 // "heap.c"
 void       _mi_heap_init(mi_heap_t* heap, mi_tld_t* tld, mi_arena_id_t arena_id, bool noreclaim, uint8_t tag);
@@ -194,10 +232,31 @@ void       _mi_heap_set_default_direct(mi_heap_t* heap);
 bool       _mi_heap_memid_is_suitable(mi_heap_t* heap, mi_memid_t memid);
 void       _mi_heap_unsafe_destroy_all(void);
 mi_heap_t* _mi_heap_by_tag(mi_heap_t* heap, uint8_t tag);
+void       _mi_heap_handoff(mi_heap_t* heap);
+bool       _mi_heap_adopt(mi_heap_t* heap, mi_heap_t* from);
+void       _mi_heap_handoff_abandon(mi_heap_t* from);
 void       _mi_heap_area_init(mi_heap_area_t* area, mi_page_t* page);
 bool       _mi_heap_area_visit_blocks(const mi_heap_area_t* area, mi_page_t* page, mi_block_visit_fun* visitor, void* arg);
 
+// "profile.c"
+void       _mi_heap_profile_init(void);
+void       _mi_heap_profile_malloc(mi_heap_t* heap, mi_page_t* page, void* p, size_t size);
+void       _mi_heap_profile_free(mi_page_t* page, mi_block_t* block);
+
+// "cpu-cache.c"
+extern bool _mi_cpu_cache_enabled;        // set once the per-CPU caches are in use (see `mi_option_cpu_cache`)
+void       _mi_cpu_cache_init(void);
+bool       _mi_cpu_cache_heap_is_cacheable(const mi_heap_t* heap);
+void*      _mi_cpu_cache_malloc(mi_heap_t* heap, size_t size, bool zero);
+bool       _mi_cpu_cache_free(mi_page_t* page, mi_block_t* block);
+void       _mi_cpu_cache_flush(void);
+void       _mi_cpu_cache_drop_heap(mi_heap_t* heap);
+
 // "stats.c"
+void       _mi_stat_counters_init(mi_tld_t* tld_main);
+void       _mi_stat_counters_thread_init(mi_tld_t* tld);
+void       _mi_stat_counters_thread_done(mi_tld_t* tld);
+void       _mi_stat_counters_sample(_Atomic(size_t)* samples, const mi_page_t* page);
 void       _mi_stats_done(mi_stats_t* stats);
 mi_msecs_t  _mi_clock_now(void);
 mi_msecs_t  _mi_clock_end(mi_msecs_t start);
@@ -214,6 +273,8 @@ mi_block_t* _mi_page_ptr_unalign(const mi_page_t* page, const void* p);
 bool        _mi_free_delayed_block(mi_block_t* block);
 void        _mi_free_generic(mi_segment_t* segment, mi_page_t* page, bool is_local, void* p) mi_attr_noexcept;  // for runtime integration
 void        _mi_padding_shrink(const mi_page_t* page, const mi_block_t* block, const size_t min_size);
+void        _mi_free_remote_flush(mi_tld_t* tld);
+void        _mi_free_uncached(void* p) mi_attr_noexcept;                                                          // called from `cpu-cache.c`
 
 // "libc.c"
 #include    <stdarg.h>
@@ -407,6 +468,18 @@ extern const mi_heap_t _mi_heap_empty;  // read-only empty heap, initial value o
 static inline bool mi_heap_is_backing(const mi_heap_t* heap) {
   return (heap->tld->heap_backing == heap);
 }
+#if MI_STAT_COUNTERS
+// add to a per-thread counter (only written by the owning thread) and sample the size bin
+// of `page` each time the count passes a multiple of `MI_STAT_COUNTERS_SAMPLE`.
+static inline void mi_stat_counters_add(_Atomic(size_t)* count, _Atomic(size_t)* samples, const mi_page_t* page, size_t n) {
+  const size_t prev = mi_atomic_load_relaxed(count);
+  mi_atomic_store_relaxed(count, prev + n);
+  if mi_unlikely((prev % MI_STAT_COUNTERS_SAMPLE) + n >= MI_STAT_COUNTERS_SAMPLE) {
+    _mi_stat_counters_sample(samples, page);
+  }
+}
+#endif
+
 
 static inline bool mi_heap_is_initialized(mi_heap_t* heap) {
   mi_assert_internal(heap != NULL);
@@ -523,6 +596,8 @@ static inline void mi_page_set_heap(mi_page_t* page, mi_heap_t* heap) {
   mi_assert_internal(mi_page_thread_free_flag(page) != MI_DELAYED_FREEING);
   mi_atomic_store_release(&page->xheap,(uintptr_t)heap);
   if (heap != NULL) { page->heap_tag = heap->tag; }
+  page->cpu_cacheable = (heap != NULL && _mi_cpu_cache_heap_is_cacheable(heap));
+  page->remote_batchable = (heap != NULL && !heap->no_reclaim);
 }
 
 // Thread free flag helpers
@@ -555,10 +630,21 @@ static inline bool mi_page_has_any_available(const mi_page_t* page) {
   return (page->used < page->reserved || (mi_page_thread_free(page) != NULL));
 }
 
-// are there immediately available blocks, i.e. blocks available on the free list.
+// can we allocate a fresh block by bumping the capacity? This is only done if there are no recycled
+// blocks in the `local_free` list, and never in secure mode (which uses randomized free lists instead).
+static inline bool mi_page_can_bump(const mi_page_t* page) {
+  #if (MI_SECURE>0)
+  MI_UNUSED(page);
+  return false;
+  #else
+  return (page->local_free == NULL && page->capacity < page->reserved);
+  #endif
+}
+
+// are there immediately available blocks, i.e. blocks available on the free list or by bumping the capacity.
 static inline bool mi_page_immediate_available(const mi_page_t* page) {
   mi_assert_internal(page != NULL);
-  return (page->free != NULL);
+  return (page->free != NULL || mi_page_can_bump(page));
 }
 
 // is more than 7/8th of a page in use?
@@ -593,6 +679,14 @@ static inline void mi_page_set_has_aligned(mi_page_t* page, bool has_aligned) {
   page->flags.x.has_aligned = has_aligned;
 }
 
+static inline bool mi_page_has_sampled(const mi_page_t* page) {
+  return page->flags.x.has_sampled;
+}
+
+static inline void mi_page_set_has_sampled(mi_page_t* page, bool has_sampled) {
+  page->flags.x.has_sampled = has_sampled;
+}
+
 
 /* -------------------------------------------------------------------
 Encoding/Decoding the free list next pointers
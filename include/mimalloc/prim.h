@@ -28,6 +28,7 @@ typedef struct mi_os_mem_config_s {
   bool    has_overcommit;       // can we reserve more memory than can be actually committed?
   bool    has_partial_free;     // can allocated blocks be freed partially? (true for mmap, false for VirtualAlloc)
   bool    has_virtual_reserve;  // supports virtual address space reservation? (if true we can reserve virtual address space without using commit or physical memory)
+  bool    has_remap;            // can mappings be resized or moved without copying? (see `_mi_prim_remap`)
 } mi_os_mem_config_t;
 
 // Initialize
@@ -63,6 +64,22 @@ int _mi_prim_reset(void* addr, size_t size);
 // Protect memory. Returns error code or 0 on success.
 int _mi_prim_protect(void* addr, size_t size, bool protect);
 
+// Grow or shrink the mapping at `addr` from `size` to `newsize` bytes (both multiples of the OS page size).
+// If `newaddr` is NULL this is done in place, otherwise the pages are moved to `newaddr` (which must
+// be a reserved range of `newsize` bytes that is replaced). The protection of the last page
+// is used for any extended part, and new memory is zero initialized.
+// Returns error code or 0 on success (`ENOSYS` if remapping is not supported).
+int _mi_prim_remap(void* addr, size_t size, void* newaddr, size_t newsize);
+
+// Advise the OS to back the range with transparent huge pages (if `enable`), or to not
+// use transparent huge pages for the range (if `!enable`). Only used if `mi_option_thp_aware` is enabled.
+// Returns error code or 0 on success (`ENOSYS` if not supported).
+int _mi_prim_thp_advise(void* addr, size_t size, bool enable);
+
+// Return the number of bytes in the process that are currently backed by transparent huge pages
+// (read from `/proc/self/smaps` on Linux), or 0 if this is not supported. (only for statistics)
+size_t _mi_prim_thp_rss(void);
+
 // Allocate huge (1GiB) pages possibly associated with a NUMA node.
 // `is_zero` is set to true if the memory was zero initialized (as on most OS's)
 // pre: size > 0  and a multiple of 1GiB.
@@ -75,6 +92,14 @@ size_t _mi_prim_numa_node(void);
 // Return the number of logical NUMA nodes
 size_t _mi_prim_numa_node_count(void);
 
+// Return the CPU the calling thread currently runs on (or -1 if unknown).
+// This is used on every allocation by the per-CPU caches (see `cpu-cache.c`) and should be fast;
+// on Linux it reads the `cpu_id` that the kernel maintains in the registered `rseq` area of the thread.
+int _mi_prim_current_cpu(void);
+
+// Return the number of configured CPUs (or 0 if unknown)
+size_t _mi_prim_cpu_count(void);
+
 // Clock ticks
 mi_msecs_t _mi_prim_clock_now(void);
 
@@ -114,6 +139,22 @@ void _mi_prim_thread_done_auto_done(void);
 // Called when the default heap for a thread changes
 void _mi_prim_thread_associate_default_heap(mi_heap_t* heap);
 
+// Start a detached background thread that runs `fun(arg)`. The thread should not
+// allocate from mimalloc. Return `false` if threads are not supported (or on error).
+typedef void (mi_prim_thread_fun_t)(void* arg);
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fun, void* arg);
+
+// Suspend the current thread for (about) `msecs` milli-seconds.
+void _mi_prim_thread_sleep(mi_msecs_t msecs);
+
+// Capture at most `max_frames` return addresses of the current stack, skipping the innermost `skip` frames.
+// Returns the number of frames captured (or 0 if not supported). This may allocate on first use.
+size_t _mi_prim_stack_trace(void** frames, size_t max_frames, size_t skip);
+
+// Output the memory mappings of the process in the format of `/proc/self/maps` (used to symbolize heap profiles).
+// Return `false` if not supported.
+bool _mi_prim_out_mappings(mi_output_fun* out, void* arg);
+
 
 
 //-------------------------------------------------------------------
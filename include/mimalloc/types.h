@@ -24,6 +24,7 @@ terms of the MIT license. A copy of the license can be found in the file
 #include <stddef.h>   // ptrdiff_t
 #include <stdint.h>   // uintptr_t, uint16_t, etc
 #include "atomic.h"   // _Atomic
+#include "../mimalloc-stats.h"  // mi_stats_t
 
 #ifdef _MSC_VER
 #pragma warning(disable:4214) // bitfield is not int
@@ -160,6 +161,7 @@ typedef int32_t  mi_ssize_t;
 
 // Main tuning parameters for segment and page sizes
 // Sizes for 64-bit, divide by two for 32-bit
+// (these can be set at build time; see the `MI_GEOMETRY` cmake option for supported alternatives)
 #ifndef MI_SMALL_PAGE_SHIFT
 #define MI_SMALL_PAGE_SHIFT               (13 + MI_INTPTR_SHIFT)      // 64KiB
 #endif
@@ -190,16 +192,47 @@ typedef int32_t  mi_ssize_t;
 // (Except for large pages since huge objects are allocated in 4MiB chunks)
 #define MI_SMALL_OBJ_SIZE_MAX             (MI_SMALL_PAGE_SIZE/4)   // 16KiB
 #define MI_MEDIUM_OBJ_SIZE_MAX            (MI_MEDIUM_PAGE_SIZE/4)  // 128KiB
+#if (MI_LARGE_PAGE_SHIFT > (20 + MI_INTPTR_SHIFT))
+#define MI_LARGE_OBJ_SIZE_MAX             (MI_ZU(1)<<(19 + MI_INTPTR_SHIFT))  // 4MiB: limited by the number of bins, larger objects are huge
+#else
 #define MI_LARGE_OBJ_SIZE_MAX             (MI_LARGE_PAGE_SIZE/2)   // 2MiB
+#endif
 #define MI_LARGE_OBJ_WSIZE_MAX            (MI_LARGE_OBJ_SIZE_MAX/MI_INTPTR_SIZE)
 
 // Maximum number of size classes. (spaced exponentially in 12.5% increments)
-#define MI_BIN_HUGE  (73U)
+// Extra exact size classes can be defined at build time to reduce the internal
+// fragmentation for frequently allocated sizes (see `MI_EXTRA_SIZE_CLASSES` in `CMakeLists.txt`).
+// These are inserted in between the standard bins.
+#ifndef MI_BIN_EXTRA_COUNT
+#define MI_BIN_EXTRA_COUNT  0
+#endif
+#define MI_BIN_STD_HUGE  (73U)
+#define MI_BIN_HUGE      (MI_BIN_STD_HUGE + MI_BIN_EXTRA_COUNT)
+
+#if (MI_BIN_EXTRA_COUNT > 16)
+#error "mimalloc internal: at most 16 extra size classes can be defined"
+#elif (MI_BIN_EXTRA_COUNT > 0) && !defined(MI_BIN_EXTRA_SIZES)
+#error "mimalloc internal: define the extra size classes in MI_BIN_EXTRA_SIZES"
+#endif
 
 #if (MI_LARGE_OBJ_WSIZE_MAX >= 655360)
 #error "mimalloc internal: define more bins"
 #endif
 
+// Validate the segment and page geometry
+#if (MI_SEGMENT_SHIFT != MI_LARGE_PAGE_SHIFT)
+#error "mimalloc: MI_SEGMENT_SHIFT must be equal to MI_LARGE_PAGE_SHIFT"
+#endif
+#if (MI_SMALL_PAGE_SHIFT >= MI_MEDIUM_PAGE_SHIFT) || (MI_MEDIUM_PAGE_SHIFT >= MI_LARGE_PAGE_SHIFT)
+#error "mimalloc: page sizes must increase from small to medium to large pages"
+#endif
+#if (MI_SMALL_PAGE_SHIFT < 12) || (MI_SEGMENT_SHIFT > 26)
+#error "mimalloc: unsupported geometry; small pages must be at least 4KiB and segments at most 64MiB"
+#endif
+#if (MI_SMALL_OBJ_SIZE_MAX < (MI_SMALL_WSIZE_MAX*MI_INTPTR_SIZE))
+#error "mimalloc: small pages are too small to hold MI_SMALL_SIZE_MAX objects"
+#endif
+
 // Maximum block size for which blocks are guaranteed to be block size aligned. (see `segment.c:_mi_segment_page_start`)
 #define MI_MAX_ALIGN_GUARANTEE   (MI_MEDIUM_OBJ_SIZE_MAX)
 
@@ -235,23 +268,26 @@ typedef enum mi_delayed_e {
 } mi_delayed_t;
 
 
-// The `in_full` and `has_aligned` page flags are put in a union to efficiently
-// test if both are false (`full_aligned == 0`) in the `mi_free` routine.
+// The `in_full`, `has_aligned`, and `has_sampled` page flags are put in a union to efficiently
+// test if all are false (`full_aligned == 0`) in the `mi_free` routine.
 #if !MI_TSAN
 typedef union mi_page_flags_s {
   uint8_t full_aligned;
   struct {
     uint8_t in_full : 1;
     uint8_t has_aligned : 1;
+    uint8_t has_sampled : 1;    // contains blocks sampled by the heap profiler
   } x;
 } mi_page_flags_t;
 #else
 // under thread sanitizer, use a byte for each flag to suppress warning, issue #130
 typedef union mi_page_flags_s {
-  uint16_t full_aligned;
+  uint32_t full_aligned;
   struct {
     uint8_t in_full;
     uint8_t has_aligned;
+    uint8_t has_sampled;
+    uint8_t padding;
   } x;
 } mi_page_flags_t;
 #endif
@@ -295,11 +331,13 @@ typedef struct mi_page_s {
   uint8_t               is_committed:1;    // `true` if the page virtual memory is committed
   uint8_t               is_zero_init:1;    // `true` if the page was initially zero initialized
   uint8_t               is_huge:1;         // `true` if the page is in a huge segment
+  uint8_t               cpu_cacheable:1;   // `true` if freed blocks can be kept in the per-CPU caches (the page belongs to a backing heap, see `cpu-cache.c`)
+  uint8_t               remote_batchable:1; // `true` if frees from other threads can be kept in a remote free magazine (the page belongs to a heap that cannot be destroyed, see `free.c`)
 
   // layout like this to optimize access in `mi_malloc` and `mi_free`
   uint16_t              capacity;          // number of blocks committed, must be the first field, see `segment.c:page_clear`
   uint16_t              reserved;          // number of blocks reserved in memory
-  mi_page_flags_t       flags;             // `in_full` and `has_aligned` flags (8 bits)
+  mi_page_flags_t       flags;             // `in_full`, `has_aligned`, and `has_sampled` flags (8 bits)
   uint8_t               free_is_zero:1;    // `true` if the blocks in the free list are zero initialized
   uint8_t               retire_expire:7;   // expiration count for retired blocks
 
@@ -403,6 +441,7 @@ typedef struct mi_segment_s {
   struct mi_segment_s* next;             // must be the first (non-constant) segment field  -- see `segment.c:segment_init`
   struct mi_segment_s* prev;
   bool                 was_reclaimed;    // true if it was reclaimed (used to limit on-free reclamation)
+  bool                 is_thp;           // true if the segment memory is advised to use transparent huge pages (see `mi_option_thp_aware`)
 
   size_t               abandoned;        // abandoned pages (i.e. the original owning thread stopped) (`abandoned <= used`)
   size_t               abandoned_visits; // count how often this segment is visited for reclaiming (to force reclaim if it is too long)
@@ -479,6 +518,7 @@ struct mi_heap_s {
   _Atomic(mi_block_t*)  thread_delayed_free;
   mi_threadid_t         thread_id;                           // thread this heap belongs too
   mi_arena_id_t         arena_id;                            // arena id if the heap belongs to a specific arena (or 0)
+  int                   numa_node;                           // preferred numa node for segment allocation and reclaim (or -1 for the current thread's node)
   uintptr_t             cookie;                              // random cookie to verify pointers (see `_mi_ptr_cookie`)
   uintptr_t             keys[2];                             // two random keys used to encode the `thread_delayed_free` list
   mi_random_ctx_t       random;                              // random number context used for secure allocation
@@ -490,6 +530,8 @@ struct mi_heap_s {
   uint8_t               tag;                                 // custom tag, can be used for separating heaps based on the object types
   mi_page_t*            pages_free_direct[MI_PAGES_DIRECT];  // optimize: array where every entry points a page with possibly free blocks in the corresponding queue for that size.
   mi_page_queue_t       pages[MI_BIN_FULL + 1];              // queue of pages for each size class (or "bin")
+  uint8_t               retire_cycles[MI_BIN_HUGE];          // adaptive retire expiration per bin (or 0 for the default, see `page.c:_mi_page_retire`)
+  uint32_t              retire_freed_beat[MI_BIN_HUGE];      // heartbeat at which a retired page of the bin was last freed (or 0)
 };
 
 
@@ -540,50 +582,11 @@ void _mi_assert_fail(const char* assertion, const char* fname, unsigned int line
 #endif
 #endif
 
-typedef struct mi_stat_count_s {
-  int64_t allocated;
-  int64_t freed;
-  int64_t peak;
-  int64_t current;
-} mi_stat_count_t;
-
-typedef struct mi_stat_counter_s {
-  int64_t total;
-  int64_t count;
-} mi_stat_counter_t;
-
-typedef struct mi_stats_s {
-  mi_stat_count_t segments;
-  mi_stat_count_t pages;
-  mi_stat_count_t reserved;
-  mi_stat_count_t committed;
-  mi_stat_count_t reset;
-  mi_stat_count_t purged;
-  mi_stat_count_t page_committed;
-  mi_stat_count_t segments_abandoned;
-  mi_stat_count_t pages_abandoned;
-  mi_stat_count_t threads;
-  mi_stat_count_t normal;
-  mi_stat_count_t huge;
-  mi_stat_count_t giant;
-  mi_stat_count_t malloc;
-  mi_stat_count_t segments_cache;
-  mi_stat_counter_t pages_extended;
-  mi_stat_counter_t mmap_calls;
-  mi_stat_counter_t commit_calls;
-  mi_stat_counter_t reset_calls;
-  mi_stat_counter_t purge_calls;
-  mi_stat_counter_t page_no_retire;
-  mi_stat_counter_t searches;
-  mi_stat_counter_t normal_count;
-  mi_stat_counter_t huge_count;
-  mi_stat_counter_t arena_count;
-  mi_stat_counter_t arena_crossover_count;
-  mi_stat_counter_t arena_rollback_count;
-#if MI_STAT>1
-  mi_stat_count_t normal_bins[MI_BIN_HUGE+1];
-#endif
-} mi_stats_t;
+// the statistics types are public (see `mimalloc-stats.h`)
+// (the public bin arrays have a fixed length so their layout does not depend on the build)
+#if (MI_BIN_HUGE+1) > MI_STAT_BIN_COUNT
+#error "the statistics bin count (MI_STAT_BIN_COUNT) must cover the number of bins"
+#endif
 
 
 void _mi_stat_increase(mi_stat_count_t* stat, size_t amount);
@@ -600,6 +603,26 @@ void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount);
 #define mi_stat_counter_increase(stat,amount) (void)0
 #endif
 
+// Cheap per-thread counters that can stay enabled in release builds (`MI_STAT_COUNTERS=1`).
+// These are only written by the owning thread (without atomic read-modify-write operations)
+// and aggregated on demand (see `mi_stats_get_counters`).
+#ifndef MI_STAT_COUNTERS
+#define MI_STAT_COUNTERS 0
+#endif
+
+#define MI_STAT_COUNTERS_SAMPLE   (256)  // record the size bin of every N-th allocation and free
+
+typedef struct mi_thread_counters_s {
+  _Atomic(size_t)  malloc_count;                       // allocations
+  _Atomic(size_t)  malloc_generic_count;               // allocations through the generic (slow) path
+  _Atomic(size_t)  free_count;                         // frees of thread local blocks
+  _Atomic(size_t)  free_mt_count;                      // frees of blocks owned by another thread
+  _Atomic(size_t)  malloc_samples[MI_BIN_HUGE+1];      // sampled allocations per size bin
+  _Atomic(size_t)  free_samples[MI_BIN_HUGE+1];        // sampled (local) frees per size bin
+  struct mi_thread_counters_s* next;                   // list of the counters of all live threads
+  struct mi_thread_counters_s* prev;
+} mi_thread_counters_t;
+
 #define mi_heap_stat_counter_increase(heap,stat,amount)  mi_stat_counter_increase( (heap)->tld->stats.stat, amount)
 #define mi_heap_stat_increase(heap,stat,amount)  mi_stat_increase( (heap)->tld->stats.stat, amount)
 #define mi_heap_stat_decrease(heap,stat,amount)  mi_stat_decrease( (heap)->tld->stats.stat, amount)
@@ -610,9 +633,14 @@ void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount);
 // from other sub processes
 // ------------------------------------------------------
 
+// Abandoned arena segments that have free pages are also recorded in a small set of
+// hint slots (per page kind) so a reclaiming thread can find one without scanning the bitmaps.
+#define MI_ABANDONED_HINT_SLOTS   (16)
+
 struct mi_subproc_s {
   _Atomic(size_t)    abandoned_count;         // count of abandoned segments for this sub-process
   _Atomic(size_t)    abandoned_os_list_count; // count of abandoned segments in the os-list
+  _Atomic(size_t)    abandoned_hints[MI_PAGE_MEDIUM+1][MI_ABANDONED_HINT_SLOTS]; // encoded arena block of abandoned small/medium segments with free pages (or 0)
   mi_lock_t          abandoned_os_lock;       // lock for the abandoned os segment list (outside of arena's) (this lock protect list operations)
   mi_lock_t          abandoned_os_visit_lock; // ensure only one thread per subproc visits the abandoned os list
   mi_segment_t*      abandoned_os_list;       // doubly-linked list of abandoned segments outside of arena's (in OS allocated memory)
@@ -640,21 +668,43 @@ typedef struct mi_os_tld_s {
 } mi_os_tld_t;
 
 // Segments thread local data
+// Maximal number of abandoned segments a thread remembers so a new thread that reuses
+// its metadata can reclaim them directly at startup
+#define MI_WARM_SEGMENTS  (8)
+
+// Number of fill levels by which the segments with free pages are bucketed (see `segment.c:mi_segment_fill_bucket`)
+#define MI_SEGMENT_FILL_BUCKETS  (8)
+
 typedef struct mi_segments_tld_s {
-  mi_segment_queue_t  small_free;   // queue of segments with free small pages
-  mi_segment_queue_t  medium_free;  // queue of segments with free medium pages
+  mi_segment_queue_t  small_free[MI_SEGMENT_FILL_BUCKETS];   // queues of segments with free small pages by fill level
+  mi_segment_queue_t  medium_free[MI_SEGMENT_FILL_BUCKETS];  // queues of segments with free medium pages by fill level
   mi_page_queue_t     pages_purge;  // queue of freed pages that are delay purged
   size_t              count;        // current number of segments;
   size_t              peak_count;   // peak number of segments
   size_t              current_size; // current size of all segments
   size_t              peak_size;    // peak size of all segments
   size_t              reclaim_count;// number of reclaimed (abandoned) segments
+  bool                huge_os_only; // allocate huge segments directly from the OS so they can be remapped (see `alloc.c:_mi_heap_realloc_zero`)
+  size_t              warm_count;   // number of arena segments abandoned by this thread
+  size_t              warm_hints[MI_WARM_SEGMENTS]; // hints of the last abandoned arena segments (reclaimed on a warm start, see `init.c:_mi_thread_heap_init`)
   mi_subproc_t*       subproc;      // sub-process this thread belongs to.
   mi_stats_t*         stats;        // points to tld stats
   mi_os_tld_t*        os;           // points to os tld
 } mi_segments_tld_t;
 
 // Thread local data
+// Remote free magazine: blocks freed in pages owned by another thread are
+// collected per page in a local chain and published with a single CAS
+// (see `free.c`, enabled with `mi_option_remote_free_batch`).
+#define MI_REMOTE_FREE_SLOTS  (8)
+
+typedef struct mi_remote_free_s {
+  mi_page_t*    page;     // page owning the blocks (or NULL if the slot is empty)
+  mi_block_t*   first;    // first block of the local chain
+  mi_block_t*   last;     // last block of the local chain
+  size_t        count;    // number of blocks in the chain
+} mi_remote_free_t;
+
 struct mi_tld_s {
   unsigned long long  heartbeat;     // monotonic heartbeat count
   bool                recurse;       // true if deferred was called; used to prevent infinite recursion.
@@ -663,6 +713,12 @@ struct mi_tld_s {
   mi_segments_tld_t   segments;      // segment tld
   mi_os_tld_t         os;            // os tld
   mi_stats_t          stats;         // statistics
+  mi_remote_free_t    remote_free[MI_REMOTE_FREE_SLOTS];  // remote free magazine
+  long long           profile_countdown;  // bytes left until the next heap profile sample (0 if not yet initialized)
+  bool                profile_busy;       // true while taking a heap profile sample; used to prevent recursion
+  #if MI_STAT_COUNTERS
+  mi_thread_counters_t counters;     // cheap always-on counters
+  #endif
 };
 
 #endif
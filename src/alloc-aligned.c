@@ -19,7 +19,10 @@ static bool mi_malloc_is_naturally_aligned( size_t size, size_t alignment ) {
   // objects up to `MI_MAX_ALIGN_GUARANTEE` are allocated aligned to their size (see `segment.c:_mi_segment_page_start`).
   mi_assert_internal(_mi_is_power_of_two(alignment) && (alignment > 0));
   if (alignment > size) return false;
+  #if (MI_BIN_EXTRA_COUNT == 0)
   if (alignment <= MI_MAX_ALIGN_SIZE) return true;
+  #endif
+  // extra size classes are only word aligned (see `MI_EXTRA_SIZE_CLASSES`) so always check the block size
   const size_t bsize = mi_good_size(size);
   return (bsize <= MI_MAX_ALIGN_GUARANTEE && (bsize & (alignment-1)) == 0);
 }
@@ -138,8 +141,13 @@ static void* mi_heap_malloc_zero_aligned_at(mi_heap_t* const heap, const size_t
     const uintptr_t align_mask = alignment-1;       // for any x, `(x & align_mask) == (x % alignment)`
     const size_t padsize = size + MI_PADDING_SIZE;  
     mi_page_t* page = _mi_heap_get_free_small_page(heap, padsize);
-    if mi_likely(page->free != NULL) {
-      const bool is_aligned = (((uintptr_t)page->free + offset) & align_mask)==0;
+    // the next block is either the first on the free list, or the one after the capacity if we can bump it
+    const mi_block_t* next = page->free;
+    if (next == NULL && mi_page_can_bump(page)) {
+      next = (const mi_block_t*)(mi_page_start(page) + (page->capacity * mi_page_block_size(page)));
+    }
+    if mi_likely(next != NULL) {
+      const bool is_aligned = (((uintptr_t)next + offset) & align_mask)==0;
       if mi_likely(is_aligned)
       {
         #if MI_STAT>1
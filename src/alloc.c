@@ -26,22 +26,39 @@ terms of the MIT license. A copy of the license can be found in the file
 // ------------------------------------------------------
 
 // Fast allocation in a page: just pop from the free list.
-// Fall back to generic allocation only if the list is empty.
+// If the list is empty we allocate a fresh block by bumping the capacity (so a fresh page
+// never writes a free list into memory that may not be used), and fall back to generic
+// allocation only if that is not possible either.
 // Note: in release mode the (inlined) routine is about 7 instructions with a single test.
 extern inline void* _mi_page_malloc_zero(mi_heap_t* heap, mi_page_t* page, size_t size, bool zero) mi_attr_noexcept
 {
   mi_assert_internal(page->block_size == 0 /* empty heap */ || mi_page_block_size(page) >= size);
-  mi_block_t* const block = page->free;
-  if mi_unlikely(block == NULL) {
+  mi_block_t* block = page->free;
+  bool is_zero;  // is the block zero initialized (except for the `next` field)?
+  if mi_likely(block != NULL) {
+    mi_assert_internal(_mi_ptr_page(block) == page);
+    // pop from the free list
+    page->free = mi_block_next(page, block);
+    is_zero = page->free_is_zero;
+    mi_assert_internal(page->free == NULL || _mi_ptr_page(page->free) == page);
+  }
+  else if mi_likely(mi_page_can_bump(page)) {
+    // bump the capacity; blocks beyond the capacity were never touched
+    const size_t bsize = mi_page_block_size(page);
+    block = (mi_block_t*)(mi_page_start(page) + (page->capacity * bsize));
+    page->capacity++;
+    is_zero = page->is_zero_init;
+    mi_stat_increase(heap->tld->stats.page_committed, bsize);
+  }
+  else {
     return _mi_malloc_generic(heap, size, zero, 0);
   }
-  mi_assert_internal(block != NULL && _mi_ptr_page(block) == page);
-  // pop from the free list
-  page->free = mi_block_next(page, block);
   page->used++;
-  mi_assert_internal(page->free == NULL || _mi_ptr_page(page->free) == page);
+  #if MI_STAT_COUNTERS
+  mi_stat_counters_add(&heap->tld->counters.malloc_count, heap->tld->counters.malloc_samples, page, 1);
+  #endif
   #if MI_DEBUG>3
-  if (page->free_is_zero) {
+  if (is_zero) {
     mi_assert_expensive(mi_mem_is_zero(block+1,size - sizeof(*block)));
   }
   #endif
@@ -55,7 +72,7 @@ extern inline void* _mi_page_malloc_zero(mi_heap_t* heap, mi_page_t* page, size_
   if mi_unlikely(zero) {
     mi_assert_internal(page->block_size != 0); // do not call with zero'ing for huge blocks (see _mi_malloc_generic)
     mi_assert_internal(page->block_size >= MI_PADDING_SIZE);
-    if (page->free_is_zero) {
+    if (is_zero) {
       block->next = 0;
       mi_track_mem_defined(block, page->block_size - MI_PADDING_SIZE);
     }
@@ -124,6 +141,15 @@ static inline mi_decl_restrict void* mi_heap_malloc_small_zero(mi_heap_t* heap,
   if (size == 0) { size = sizeof(void*); }
   #endif
 
+  if mi_unlikely(_mi_cpu_cache_enabled) {
+    // try the cache of the current CPU first (see `cpu-cache.c`)
+    void* const p = _mi_cpu_cache_malloc(heap, size + MI_PADDING_SIZE, zero);
+    if (p != NULL) {
+      mi_track_malloc(p,size,zero);
+      return p;
+    }
+  }
+
   mi_page_t* page = _mi_heap_get_free_small_page(heap, size + MI_PADDING_SIZE);
   void* const p = _mi_page_malloc_zero(heap, page, size + MI_PADDING_SIZE, zero);
   mi_track_malloc(p,size,zero);
@@ -189,6 +215,39 @@ mi_decl_nodiscard extern inline mi_decl_restrict void* mi_malloc(size_t size) mi
   return mi_heap_malloc(mi_prim_get_default_heap(), size);
 }
 
+// Allocate up to `count` blocks of `size` bytes into `blocks`; returns the number of blocks allocated
+// (which is only less than `count` if we run out of memory).
+// We allocate the first block of each run through the regular path (which finds a page with
+// free blocks) and then allocate the rest of the run directly from that page (popping its
+// free list or bumping its capacity).
+size_t mi_heap_malloc_batch(mi_heap_t* heap, size_t size, void** blocks, size_t count) mi_attr_noexcept {
+  mi_assert(heap!=NULL);
+  mi_assert(heap->thread_id == 0 || heap->thread_id == _mi_thread_id());   // heaps are thread local
+  if (blocks == NULL) return 0;
+  #if (MI_PADDING)
+  if (size == 0) { size = sizeof(void*); }
+  #endif
+  size_t n = 0;
+  while (n < count) {
+    void* const p = mi_heap_malloc(heap, size);
+    if mi_unlikely(p == NULL) break;
+    blocks[n++] = p;
+    if (!mi_heap_is_initialized(heap)) { heap = mi_prim_get_default_heap(); }
+    mi_page_t* const page = _mi_ptr_page(p);
+    if (mi_page_heap(page) != heap) continue;  // the block came from a per-CPU cache (see `cpu-cache.c`)
+    while (n < count && mi_page_immediate_available(page)) {
+      void* const q = _mi_page_malloc_zero(heap, page, size + MI_PADDING_SIZE, false);
+      mi_assert_internal(q != NULL);
+      mi_track_malloc(q,size,false);
+      #if MI_STAT>1
+      mi_heap_stat_increase(heap, malloc, mi_usable_size(q));
+      #endif
+      blocks[n++] = q;
+    }
+  }
+  return n;
+}
+
 // zero initialized small block
 mi_decl_nodiscard mi_decl_restrict void* mi_zalloc_small(size_t size) mi_attr_noexcept {
   return mi_heap_malloc_small_zero(mi_prim_get_default_heap(), size, true);
@@ -224,18 +283,112 @@ mi_decl_nodiscard mi_decl_restrict void* mi_mallocn(size_t count, size_t size) m
   return mi_heap_mallocn(mi_prim_get_default_heap(),count,size);
 }
 
-// Expand (or shrink) in place (or fail)
-void* mi_expand(void* p, size_t newsize) mi_attr_noexcept {
+#if MI_PADDING && !MI_TRACK_ENABLED
+// Update the padding of a block that was resized in place to `size` bytes (see `_mi_page_malloc_zero`)
+static void mi_block_resize_padding(const mi_page_t* page, uint8_t* block, size_t size) {
+  const size_t ubsize = mi_page_usable_block_size(page);
+  mi_assert_internal(ubsize >= size);
+  mi_padding_t* const padding = (mi_padding_t*)(block + ubsize);
+  const size_t delta = ubsize - size;
+  padding->canary = (uint32_t)(mi_ptr_encode(page, block, page->keys));
+  padding->delta  = (uint32_t)(delta);
+  #if MI_PADDING_CHECK
+  if (!mi_page_is_huge(page)) {
+    uint8_t* fill = (uint8_t*)padding - delta;
+    const size_t maxpad = (delta > MI_MAX_ALIGN_SIZE ? MI_MAX_ALIGN_SIZE : delta); // set at most N initial padding bytes
+    for (size_t i = 0; i < maxpad; i++) { fill[i] = MI_DEBUG_PADDING; }
+  }
+  #endif
+}
+#endif
+
+// Grow a medium or large block of `size` bytes in place if it is the only used block in its page
+// (see `_mi_page_grow_first_block`). Returns NULL if this is not possible.
+static void* mi_heap_try_grow(mi_heap_t* heap, void* p, size_t size, size_t newsize, bool zero) {
+  #if MI_TRACK_ENABLED
+  MI_UNUSED(heap); MI_UNUSED(p); MI_UNUSED(size); MI_UNUSED(newsize); MI_UNUSED(zero);
+  return NULL;  // we cannot track the resized block
+  #else
+  mi_assert_internal(p != NULL && newsize > size);
+  mi_page_t* const page = _mi_ptr_page(p);
+  if (heap == NULL || mi_page_heap(page) != heap || heap->thread_id != _mi_prim_thread_id() ||
+      mi_page_has_sampled(page) || p != mi_page_start(page)) {
+    return NULL;  // not the first block of a page of this thread
+  }
+  const size_t ubsize = mi_page_usable_block_size(page); MI_UNUSED(ubsize);  // only used for statistics
+  if (!_mi_page_grow_first_block(heap, page, newsize + MI_PADDING_SIZE)) return NULL;
+  if (zero) { _mi_memzero((uint8_t*)p + size, newsize - size); }
   #if MI_PADDING
-  // we do not shrink/expand with padding enabled
-  MI_UNUSED(p); MI_UNUSED(newsize);
-  return NULL;
+  mi_block_resize_padding(page, (uint8_t*)p, newsize);
+  #endif
+  #if (MI_STAT>0)
+  const size_t newubsize = mi_page_usable_block_size(page);
+  mi_heap_stat_decrease(heap, normal, ubsize);
+  mi_heap_stat_increase(heap, normal, newubsize);
+  #if (MI_STAT>1)
+  mi_heap_stat_decrease(heap, normal_bins[_mi_bin(ubsize)], 1);
+  mi_heap_stat_increase(heap, normal_bins[_mi_bin(newubsize)], 1);
+  mi_heap_stat_decrease(heap, malloc, size);
+  mi_heap_stat_increase(heap, malloc, mi_usable_size(p));
+  #endif
+  #endif
+  return p;
+  #endif
+}
+
+// Resize a huge block of `size` bytes without copying by remapping its memory (see `_mi_huge_page_remap`).
+// If `allow_move` is set, the block may move to a new address. Returns NULL if this is not possible
+// (e.g. if the block was allocated in an arena) in which case the block is unchanged.
+static void* mi_heap_try_remap(mi_heap_t* heap, void* p, size_t size, size_t newsize, bool allow_move, bool zero) {
+  #if MI_TRACK_ENABLED
+  MI_UNUSED(heap); MI_UNUSED(p); MI_UNUSED(size); MI_UNUSED(newsize); MI_UNUSED(allow_move); MI_UNUSED(zero);
+  return NULL;  // we cannot track the remapped memory
   #else
+  mi_assert_internal(p != NULL);
+  if (newsize > MI_MAX_ALLOC_SIZE) return NULL;
+  mi_page_t* const page = _mi_ptr_page(p);
+  if (heap == NULL || !mi_page_is_huge(page) || mi_page_heap(page) != heap || heap->thread_id != _mi_prim_thread_id() ||
+      mi_page_has_sampled(page) || p != mi_page_start(page)) {
+    return NULL;  // not an (unaligned) huge block of this thread
+  }
+  const size_t bsize = mi_page_block_size(page);
+  mi_page_t* const newpage = _mi_huge_page_remap(heap, page, newsize + MI_PADDING_SIZE, allow_move);
+  if (newpage == NULL) return NULL;
+  uint8_t* const newp = mi_page_start(newpage);
+  mi_assert_internal(mi_page_usable_block_size(newpage) >= newsize);
+  if (zero && newsize > size) {
+    // any memory beyond the original block is fresh (and zero) but the tail of the original block (including the padding) may not be
+    const size_t end = (bsize < newsize ? bsize : newsize);
+    if (end > size) { _mi_memzero(newp + size, end - size); }
+  }
+  #if MI_PADDING
+  mi_block_resize_padding(newpage, newp, newsize);
+  #endif
+  #if (MI_STAT>1)
+  mi_heap_stat_decrease(heap, malloc, size);
+  mi_heap_stat_increase(heap, malloc, mi_usable_size(newp));
+  #endif
+  return newp;
+  #endif
+}
+
+// Expand (or shrink) in place (or fail)
+void* mi_expand(void* p, size_t newsize) mi_attr_noexcept {
   if (p == NULL) return NULL;
   const size_t size = _mi_usable_size(p,"mi_expand");
-  if (newsize > size) return NULL;
-  return p; // it fits
+  #if !MI_PADDING  // with padding we only shrink by remapping as that updates the padding
+  if (newsize <= size) return p; // it fits
   #endif
+  mi_heap_t* const heap = mi_page_heap(_mi_ptr_page(p));
+  if (size > MI_LARGE_OBJ_SIZE_MAX && newsize > MI_LARGE_OBJ_SIZE_MAX) {
+    // huge blocks can grow or shrink in place by remapping
+    return mi_heap_try_remap(heap, p, size, newsize, false /* in place */, false);
+  }
+  if (newsize > size && size > MI_SMALL_OBJ_SIZE_MAX && newsize <= MI_LARGE_OBJ_SIZE_MAX) {
+    // medium and large blocks can grow if they are the only block in their page
+    return mi_heap_try_grow(heap, p, size, newsize, false);
+  }
+  return NULL;
 }
 
 void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero) mi_attr_noexcept {
@@ -250,7 +403,31 @@ void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero)
     // if (newsize < size) { mi_track_mem_noaccess((uint8_t*)p + newsize, size - newsize); }
     return p;  // reallocation still fits and not more than 50% waste
   }
+  if (newsize > size && size > MI_SMALL_OBJ_SIZE_MAX && newsize <= MI_LARGE_OBJ_SIZE_MAX) {
+    // medium and large blocks can grow in place if they are the only block in their page
+    void* const grown = mi_heap_try_grow(heap, p, size, newsize, zero);
+    if (grown != NULL) {
+      mi_heap_stat_counter_increase(heap, realloc_no_copy, 1);
+      return grown;
+    }
+  }
+  bool huge_os_only = false;
+  if (newsize > MI_LARGE_OBJ_SIZE_MAX) {
+    // huge blocks are resized without copying by remapping them if possible
+    if (size > MI_LARGE_OBJ_SIZE_MAX) {
+      void* const remapped = mi_heap_try_remap(heap, p, size, newsize, true /* allow move */, zero);
+      if (remapped != NULL) {
+        mi_heap_stat_counter_increase(heap, realloc_no_copy, 1);
+        return remapped;
+      }
+    }
+    // otherwise allocate large enough blocks directly from the OS (instead of an arena) so later reallocations can be remapped
+    const size_t threshold = mi_option_get_size(mi_option_remap_threshold);
+    huge_os_only = (threshold > 0 && newsize >= threshold && mi_heap_is_initialized(heap));
+  }
+  if (huge_os_only) { heap->tld->segments.huge_os_only = true; }
   void* newp = mi_heap_malloc(heap,newsize);
+  if (huge_os_only) { heap->tld->segments.huge_os_only = false; }
   if mi_likely(newp != NULL) {
     if (zero && newsize > size) {
       // also set last word in the previous allocation to zero to ensure any padding is zero-initialized
@@ -299,6 +476,32 @@ mi_decl_nodiscard void* mi_heap_recalloc(mi_heap_t* heap, void* p, size_t count,
 }
 
 
+// Reallocate `p` to a block in another page so its page can drain (see `heap.c:mi_heap_defrag_hint`).
+// Returns NULL (and `p` stays valid) if no such block could be allocated.
+mi_decl_nodiscard void* mi_heap_defrag_realloc(mi_heap_t* heap, void* p, size_t newsize) mi_attr_noexcept {
+  if (p == NULL) return mi_heap_malloc(heap, newsize);
+  mi_page_t* const page = _mi_ptr_page(p);
+  // don't allocate from the page of `p` for now; it moves back to its queue once `p` is freed
+  const bool exclude = (mi_page_heap(page) == heap && !mi_page_is_in_full(page) && !mi_page_is_huge(page));
+  if (exclude) { _mi_page_exclude(page); }
+  void* newp = mi_heap_malloc(heap, newsize);
+  if (newp != NULL && _mi_ptr_page(newp) == page) {
+    // the block came from a per-CPU cache, or the page was made available again by a delayed free
+    mi_free(newp);
+    newp = NULL;
+  }
+  if mi_unlikely(newp == NULL) {
+    if (exclude && mi_page_is_in_full(page)) { _mi_page_unfull(page); }
+    return NULL;
+  }
+  const size_t size = mi_usable_size(p);
+  const size_t copysize = (newsize > size ? size : newsize);
+  mi_track_mem_defined(p,copysize);
+  _mi_memcpy(newp, p, copysize);
+  mi_free(p);
+  return newp;
+}
+
 mi_decl_nodiscard void* mi_realloc(void* p, size_t newsize) mi_attr_noexcept {
   return mi_heap_realloc(mi_prim_get_default_heap(),p,newsize);
 }
@@ -320,6 +523,10 @@ mi_decl_nodiscard void* mi_recalloc(void* p, size_t count, size_t size) mi_attr_
   return mi_heap_recalloc(mi_prim_get_default_heap(), p, count, size);
 }
 
+mi_decl_nodiscard void* mi_defrag_realloc(void* p, size_t newsize) mi_attr_noexcept {
+  return mi_heap_defrag_realloc(mi_prim_get_default_heap(), p, newsize);
+}
+
 
 
 // ------------------------------------------------------
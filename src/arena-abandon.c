@@ -40,12 +40,40 @@ bool        mi_arena_memid_indices(mi_memid_t memid, size_t* arena_index, mi_bit
   Reclaim and visiting either scan through the `block_abandoned`
   bitmaps of the arena's, or visit the `abandoned_os_list`
 
+  Abandoned arena segments that still have free small or medium pages
+  are also recorded in the `abandoned_hints` slots of the sub-process.
+  A hint encodes the arena and block index (and not the segment pointer)
+  so it can be stale without harm: a reclaiming thread first takes the
+  hint from its slot and then still needs to atomically clear the bit in
+  the `block_abandoned` bitmap to own the segment. This lets reclaim find
+  a segment with a free page of the right kind without a bitmap scan.
+
+  Each arena also keeps an `abandoned_summary` with a bit per field of
+  the `block_abandoned` bitmap that has abandoned segments, so scans skip
+  the (usually many) fields without any.
+
   A potentially nicer design is to use arena's for everything
   and perhaps have virtual arena's to map OS allocated memory
   but this would lack the "density" of our current arena's. TBC.
 ----------------------------------------------------------- */
 
 
+// mark a block as abandoned in the arena `blocks_abandoned` bitmap (and its summary)
+// returns `true` if it was not marked before
+static bool mi_arena_abandoned_mark(mi_arena_t* arena, mi_bitmap_index_t bitmap_idx) {
+  const bool was_unmarked = _mi_bitmap_claim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx, NULL);
+  _mi_bitmap_summary_claimed(arena->abandoned_summary, 1, bitmap_idx);
+  return was_unmarked;
+}
+
+// clear the abandoned mark of a block atomically (and update the summary)
+// returns `true` if it was marked before (i.e. we own the segment now)
+static bool mi_arena_abandoned_unmark(mi_arena_t* arena, mi_bitmap_index_t bitmap_idx) {
+  const bool was_marked = _mi_bitmap_unclaim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx);
+  if (was_marked) { _mi_bitmap_summary_unclaimed(arena->abandoned_summary, arena->blocks_abandoned, 1, bitmap_idx); }
+  return was_marked;
+}
+
 // reclaim a specific OS abandoned segment; `true` on success.
 // sets the thread_id.
 static bool mi_arena_segment_os_clear_abandoned(mi_segment_t* segment, bool take_lock) {
@@ -102,7 +130,7 @@ bool _mi_arena_segment_clear_abandoned(mi_segment_t* segment) {
   mi_arena_t* arena = mi_arena_from_index(arena_idx);
   mi_assert_internal(arena != NULL);
   // reclaim atomically
-  bool was_marked = _mi_bitmap_unclaim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx);
+  bool was_marked = mi_arena_abandoned_unmark(arena, bitmap_idx);
   if (was_marked) {
     mi_assert_internal(mi_atomic_load_acquire(&segment->thread_id) == 0);
     mi_atomic_decrement_relaxed(&segment->subproc->abandoned_count);
@@ -143,6 +171,41 @@ static void mi_arena_segment_os_mark_abandoned(mi_segment_t* segment) {
   return;
 }
 
+// hints encode the arena index and bitmap index of an abandoned segment (where 0 is no hint)
+static size_t mi_arena_abandoned_hint_create(size_t arena_idx, mi_bitmap_index_t bitmap_idx) {
+  mi_assert_internal(arena_idx < MI_MAX_ARENAS);
+  return (1 + arena_idx + (bitmap_idx * MI_MAX_ARENAS));
+}
+
+static void mi_arena_abandoned_hint_decode(size_t hint, size_t* arena_idx, mi_bitmap_index_t* bitmap_idx) {
+  mi_assert_internal(hint != 0);
+  *arena_idx  = (hint - 1) % MI_MAX_ARENAS;
+  *bitmap_idx = (hint - 1) / MI_MAX_ARENAS;
+}
+
+// record an abandoned segment in the hints of its page kind
+static void mi_arena_abandoned_hint_push(mi_subproc_t* subproc, mi_page_kind_t kind, size_t arena_idx, mi_bitmap_index_t bitmap_idx) {
+  mi_assert_internal(kind <= MI_PAGE_MEDIUM);
+  const size_t hint = mi_arena_abandoned_hint_create(arena_idx, bitmap_idx);
+  const size_t start = bitmap_idx % MI_ABANDONED_HINT_SLOTS;
+  for (size_t i = 0; i < MI_ABANDONED_HINT_SLOTS; i++) {
+    _Atomic(size_t)* slot = &subproc->abandoned_hints[kind][(start + i) % MI_ABANDONED_HINT_SLOTS];
+    size_t expected = 0;
+    if (mi_atomic_load_relaxed(slot) == 0 && mi_atomic_cas_strong_release(slot, &expected, hint)) return;
+  }
+  // all slots are in use; overwrite as older hints are more likely to be stale
+  mi_atomic_store_release(&subproc->abandoned_hints[kind][start], hint);
+}
+
+// the hint for an arena segment that is about to be abandoned (or 0 if it is not in an arena)
+size_t _mi_arena_segment_abandoned_hint(const mi_segment_t* segment) {
+  if (segment->memid.memkind != MI_MEM_ARENA) return 0;
+  size_t arena_idx;
+  mi_bitmap_index_t bitmap_idx;
+  mi_arena_memid_indices(segment->memid, &arena_idx, &bitmap_idx);
+  return mi_arena_abandoned_hint_create(arena_idx, bitmap_idx);
+}
+
 // mark a specific segment as abandoned
 // clears the thread_id.
 void _mi_arena_segment_mark_abandoned(mi_segment_t* segment)
@@ -161,10 +224,15 @@ void _mi_arena_segment_mark_abandoned(mi_segment_t* segment)
   mi_assert_internal(arena != NULL);
   // set abandonment atomically
   mi_subproc_t* const subproc = segment->subproc; // don't access the segment after setting it abandoned
-  const bool was_unmarked = _mi_bitmap_claim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx, NULL);
+  const mi_page_kind_t kind = segment->page_kind;
+  const bool has_free_page = (kind <= MI_PAGE_MEDIUM && segment->used < segment->capacity);
+  const bool was_unmarked = mi_arena_abandoned_mark(arena, bitmap_idx);
   if (was_unmarked) { mi_atomic_increment_relaxed(&subproc->abandoned_count); }
   mi_assert_internal(was_unmarked);
   mi_assert_internal(_mi_bitmap_is_claimed(arena->blocks_inuse, arena->field_count, 1, bitmap_idx));
+  if (has_free_page) {
+    mi_arena_abandoned_hint_push(subproc, kind, arena_idx, bitmap_idx);
+  }
 }
 
 
@@ -174,12 +242,17 @@ void _mi_arena_segment_mark_abandoned(mi_segment_t* segment)
 ----------------------------------------------------------- */
 
 // start a cursor at a randomized arena
-void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool visit_all, mi_arena_field_cursor_t* current) {
+void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool visit_all, mi_page_kind_t kind, mi_arena_field_cursor_t* current) {
   mi_assert_internal(heap == NULL || heap->tld->segments.subproc == subproc);
   current->bitmap_idx = 0;
   current->subproc = subproc;
   current->visit_all = visit_all;
   current->hold_visit_lock = false;
+  current->numa_local = false;
+  current->numa_node = -1;
+  current->hint_kind = kind;
+  current->hint_idx = 0;
+  current->hint_count = 0;
   const size_t abandoned_count = mi_atomic_load_relaxed(&subproc->abandoned_count);
   const size_t abandoned_list_count = mi_atomic_load_relaxed(&subproc->abandoned_os_list_count);
   const size_t max_arena = mi_arena_get_count();
@@ -200,10 +273,28 @@ void _mi_arena_field_cursor_init(mi_heap_t* heap, mi_subproc_t* subproc, bool vi
       current->end = 0;
     }
     current->os_list_count = abandoned_list_count; // max entries to visit in the os abandoned list
+    // with multiple numa nodes, first visit the arenas local to the heap, and only then the others
+    if (heap != NULL && !visit_all && current->start < current->end && _mi_os_numa_node_count() > 1) {
+      current->numa_node  = (heap->numa_node >= 0 ? heap->numa_node : _mi_os_numa_node(&heap->tld->os));
+      current->numa_local = true;
+      current->numa_start = current->start;
+    }
+    // first visit the hints for the requested page kind (at a random slot)
+    if (heap != NULL && !visit_all && kind <= MI_PAGE_MEDIUM && abandoned_count > abandoned_list_count) {
+      current->hint_idx = (size_t)_mi_heap_random_next(heap) % MI_ABANDONED_HINT_SLOTS;
+      current->hint_count = MI_ABANDONED_HINT_SLOTS;
+    }
   }
   mi_assert_internal(current->start <= max_arena);
 }
 
+// is an arena skipped in the current numa pass?
+static bool mi_arena_field_cursor_numa_skip(const mi_arena_field_cursor_t* current, const mi_arena_t* arena) {
+  if (current->numa_node < 0) return false;
+  const bool is_local = (arena->numa_node < 0 || arena->numa_node == current->numa_node);
+  return (current->numa_local ? !is_local : is_local);
+}
+
 void _mi_arena_field_cursor_done(mi_arena_field_cursor_t* current) {
   if (current->hold_visit_lock) {
     mi_lock_release(&current->subproc->abandoned_os_visit_lock);
@@ -213,7 +304,7 @@ void _mi_arena_field_cursor_done(mi_arena_field_cursor_t* current) {
 
 static mi_segment_t* mi_arena_segment_clear_abandoned_at(mi_arena_t* arena, mi_subproc_t* subproc, mi_bitmap_index_t bitmap_idx) {
   // try to reclaim an abandoned segment in the arena atomically
-  if (!_mi_bitmap_unclaim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx)) return NULL;
+  if (!mi_arena_abandoned_unmark(arena, bitmap_idx)) return NULL;
   mi_assert_internal(_mi_bitmap_is_claimed(arena->blocks_inuse, arena->field_count, 1, bitmap_idx));
   mi_segment_t* segment = (mi_segment_t*)mi_arena_block_start(arena, bitmap_idx);
   mi_assert_internal(mi_atomic_load_relaxed(&segment->thread_id) == 0);
@@ -223,7 +314,7 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_at(mi_arena_t* arena, mi_s
   //  for regular reclaim it is fine to miss one sometimes so without abandoned visiting we don't need the `abandoned_visit` lock.
   if (segment->subproc != subproc) {
     // it is from another sub-process, re-mark it and continue searching
-    const bool was_zero = _mi_bitmap_claim(arena->blocks_abandoned, arena->field_count, 1, bitmap_idx, NULL);
+    const bool was_zero = mi_arena_abandoned_mark(arena, bitmap_idx);
     mi_assert_internal(was_zero); MI_UNUSED(was_zero);
     return NULL;
   }
@@ -243,10 +334,17 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_
     // index wraps around
     size_t arena_idx = (previous->start >= max_arena ? previous->start % max_arena : previous->start);
     mi_arena_t* arena = mi_arena_from_index(arena_idx);
-    if (arena != NULL) {
+    if (arena != NULL && !mi_arena_field_cursor_numa_skip(previous, arena)) {
       bool has_lock = false;
       // visit the abandoned fields (starting at previous_idx)
       for (; field_idx < arena->field_count; field_idx++, bit_idx = 0) {
+        // skip to the next field with abandoned segments using the summary
+        const size_t next_idx = _mi_bitmap_summary_next(arena->abandoned_summary, arena->field_count, field_idx);
+        if (next_idx != field_idx) {
+          if (next_idx >= arena->field_count) break;
+          field_idx = next_idx;
+          bit_idx = 0;
+        }
         size_t field = mi_atomic_load_relaxed(&arena->blocks_abandoned[field_idx]);
         if mi_unlikely(field != 0) { // skip zero fields quickly
           // we only take the arena lock if there are actually abandoned segments present
@@ -280,6 +378,13 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_field(mi_arena_field_
       if (has_lock) { mi_lock_release(&arena->abandoned_visit_lock); }
     }
   }
+  if (previous->numa_local) {
+    // done with the numa local arena's, restart to visit the arena's on the other numa nodes
+    previous->numa_local = false;
+    previous->start = previous->numa_start;
+    previous->bitmap_idx = 0;
+    return mi_arena_segment_clear_abandoned_next_field(previous);
+  }
   return NULL;
 }
 
@@ -322,9 +427,61 @@ static mi_segment_t* mi_arena_segment_clear_abandoned_next_list(mi_arena_field_c
 }
 
 
+static mi_segment_t* mi_arena_segment_clear_abandoned_next_hint(mi_arena_field_cursor_t* previous) {
+  mi_assert_internal(previous->hint_kind <= MI_PAGE_MEDIUM);
+  _Atomic(size_t)* slot = &previous->subproc->abandoned_hints[previous->hint_kind][previous->hint_idx % MI_ABANDONED_HINT_SLOTS];
+  previous->hint_idx++;
+  size_t hint = mi_atomic_load_relaxed(slot);
+  if (hint == 0) return NULL;
+  size_t arena_idx;
+  mi_bitmap_index_t bitmap_idx;
+  mi_arena_abandoned_hint_decode(hint, &arena_idx, &bitmap_idx);
+  mi_arena_t* const arena = (arena_idx < mi_arena_get_count() ? mi_arena_from_index(arena_idx) : NULL);
+  if (arena == NULL || mi_bitmap_index_field(bitmap_idx) >= arena->field_count) {
+    mi_atomic_cas_strong_acq_rel(slot, &hint, (size_t)0);  // invalid hint
+    return NULL;
+  }
+  if (mi_arena_field_cursor_numa_skip(previous, arena)) return NULL;  // leave it for a thread on that numa node
+  // with abandoned visiting we need the arena visit lock (see `mi_arena_segment_clear_abandoned_at`)
+  const bool need_lock = mi_option_is_enabled(mi_option_visit_abandoned);
+  if (need_lock && !mi_lock_try_acquire(&arena->abandoned_visit_lock)) return NULL;
+  // take the hint; the segment is only ours if we can also clear its abandoned bit
+  mi_segment_t* segment = NULL;
+  if (mi_atomic_cas_strong_acq_rel(slot, &hint, (size_t)0)) {
+    segment = mi_arena_segment_clear_abandoned_at(arena, previous->subproc, bitmap_idx);
+    if (segment != NULL) { _mi_stat_counter_increase(&_mi_stats_main.abandoned_hint_reclaim, 1); }
+  }
+  if (need_lock) { mi_lock_release(&arena->abandoned_visit_lock); }
+  return segment;
+}
+
+// reclaim the abandoned segment of a hint (from `_mi_arena_segment_abandoned_hint`); returns NULL if
+// the hint is stale, or if the segment is no longer abandoned or belongs to another sub-process.
+// this does not set the thread id (so it appears as still abandoned)
+mi_segment_t* _mi_arena_segment_clear_abandoned_hint(mi_subproc_t* subproc, size_t hint) {
+  if (hint == 0) return NULL;
+  size_t arena_idx;
+  mi_bitmap_index_t bitmap_idx;
+  mi_arena_abandoned_hint_decode(hint, &arena_idx, &bitmap_idx);
+  mi_arena_t* const arena = (arena_idx < mi_arena_get_count() ? mi_arena_from_index(arena_idx) : NULL);
+  if (arena == NULL || mi_bitmap_index_field(bitmap_idx) >= arena->field_count) return NULL;
+  // with abandoned visiting we need the arena visit lock (see `mi_arena_segment_clear_abandoned_at`)
+  const bool need_lock = mi_option_is_enabled(mi_option_visit_abandoned);
+  if (need_lock && !mi_lock_try_acquire(&arena->abandoned_visit_lock)) return NULL;
+  mi_segment_t* const segment = mi_arena_segment_clear_abandoned_at(arena, subproc, bitmap_idx);
+  if (need_lock) { mi_lock_release(&arena->abandoned_visit_lock); }
+  return segment;
+}
+
 // reclaim abandoned segments
 // this does not set the thread id (so it appears as still abandoned)
 mi_segment_t* _mi_arena_segment_clear_abandoned_next(mi_arena_field_cursor_t* previous) {
+  // first try the hints (which usually lead to a segment with a free page of the right kind)
+  while (previous->hint_count > 0) {
+    previous->hint_count--;
+    mi_segment_t* segment = mi_arena_segment_clear_abandoned_next_hint(previous);
+    if (segment != NULL) { return segment; }
+  }
   if (previous->start < previous->end) {
     // walk the arena
     mi_segment_t* segment = mi_arena_segment_clear_abandoned_next_field(previous);
@@ -344,7 +501,7 @@ bool mi_abandoned_visit_blocks(mi_subproc_id_t subproc_id, int heap_tag, bool vi
     return false;
   }
   mi_arena_field_cursor_t current;
-  _mi_arena_field_cursor_init(NULL, _mi_subproc_from_id(subproc_id), true /* visit all (blocking) */, &current);
+  _mi_arena_field_cursor_init(NULL, _mi_subproc_from_id(subproc_id), true /* visit all (blocking) */, MI_PAGE_HUGE /* any kind */, &current);
   mi_segment_t* segment;
   bool ok = true;
   while (ok && (segment = _mi_arena_segment_clear_abandoned_next(&current)) != NULL) {
@@ -22,6 +22,7 @@ The arena allocation needs to be thread safe and we use an atomic bitmap to allo
 #include "mimalloc.h"
 #include "mimalloc/internal.h"
 #include "mimalloc/atomic.h"
+#include "mimalloc/prim.h"  // _mi_prim_thread_start
 #include "bitmap.h"
 
 
@@ -48,8 +49,12 @@ typedef struct mi_arena_s {
   mi_bitmap_field_t* blocks_committed;     // are the blocks committed? (can be NULL for memory that cannot be decommitted)
   mi_bitmap_field_t* blocks_purge;         // blocks that can be (reset) decommitted. (can be NULL for memory that cannot be (reset) decommitted)
   mi_bitmap_field_t* blocks_abandoned;     // blocks that start with an abandoned segment. (This crosses API's but it is convenient to have here)
+  mi_bitmap_field_t* blocks_thp;           // blocks advised to use transparent huge pages (see `mi_option_thp_aware`) (NULL for memory that cannot be purged)
+  _Atomic(size_t)*   field_ranges;         // free range index with a summary of the free ranges per `blocks_inuse` field
+  mi_bitmap_field_t* purge_summary;        // summary of `blocks_purge` with a bit per field that has blocks to purge
+  mi_bitmap_field_t* abandoned_summary;    // summary of `blocks_abandoned` with a bit per field that has abandoned segments
   mi_bitmap_field_t   blocks_inuse[1];      // in-place bitmap of in-use blocks (of size `field_count`)
-  // do not add further fields here as the dirty, committed, purged, and abandoned bitmaps follow the inuse bitmap fields.
+  // do not add further fields here as the dirty, committed, purged, abandoned, and thp bitmaps, the free range index, and the summaries follow the inuse bitmap fields.
 } mi_arena_t;
 
 
@@ -139,6 +144,54 @@ bool mi_arena_memid_indices(mi_memid_t memid, size_t* arena_index, mi_bitmap_ind
   return memid.mem.arena.is_exclusive;
 }
 
+// the numa node of the arena the memory belongs to (or -1 if unknown or not in an arena)
+int _mi_arena_memid_numa_node(mi_memid_t memid) {
+  if (memid.memkind != MI_MEM_ARENA) return -1;
+  const size_t arena_index = mi_arena_id_index(memid.mem.arena.id);
+  if (arena_index >= mi_arena_get_count()) return -1;
+  mi_arena_t* arena = mi_arena_from_index(arena_index);
+  return (arena == NULL ? -1 : arena->numa_node);
+}
+
+
+/* -----------------------------------------------------------
+  Transparent huge pages (if `mi_option_thp_aware` is enabled)
+  Arena memory is advised to not use transparent huge pages when it is
+  reserved, and segments that are densely used advise their arena blocks
+  to use them after all. Since the advice is a property of the OS mapping
+  we track it per arena block (it persists when segments are freed and purged).
+----------------------------------------------------------- */
+
+static mi_arena_t* mi_arena_from_memid(mi_memid_t memid, mi_bitmap_index_t* bitmap_index) {
+  if (memid.memkind != MI_MEM_ARENA) return NULL;
+  size_t arena_index;
+  mi_arena_memid_indices(memid, &arena_index, bitmap_index);
+  if (arena_index >= MI_MAX_ARENAS) return NULL;
+  return mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[arena_index]);
+}
+
+// Is the arena memory of `size` bytes advised to use transparent huge pages?
+bool _mi_arena_memid_is_thp(mi_memid_t memid, size_t size) {
+  mi_bitmap_index_t bitmap_index;
+  mi_arena_t* arena = mi_arena_from_memid(memid, &bitmap_index);
+  if (arena == NULL || arena->blocks_thp == NULL) return false;
+  return _mi_bitmap_is_claimed_across(arena->blocks_thp, arena->field_count, mi_block_count_of_size(size), bitmap_index);
+}
+
+// Advise the arena memory at `p` of `size` bytes to use transparent huge pages.
+// Returns `true` if the memory is (now) advised.
+bool _mi_arena_thp_advise(void* p, size_t size, mi_memid_t memid, mi_stats_t* stats) {
+  mi_bitmap_index_t bitmap_index;
+  mi_arena_t* arena = mi_arena_from_memid(memid, &bitmap_index);
+  if (arena == NULL || arena->blocks_thp == NULL) return false;
+  const size_t blocks = mi_block_count_of_size(size);
+  if (_mi_bitmap_is_claimed_across(arena->blocks_thp, arena->field_count, blocks, bitmap_index)) return true;
+  mi_assert_internal(p == mi_arena_block_start(arena, bitmap_index));
+  if (!_mi_os_thp_advise(p, mi_arena_block_size(blocks), true, stats)) return false;
+  _mi_bitmap_claim_across(arena->blocks_thp, arena->field_count, blocks, bitmap_index, NULL);
+  return true;
+}
+
 
 
 /* -----------------------------------------------------------
@@ -215,15 +268,134 @@ void* mi_arena_block_start(mi_arena_t* arena, mi_bitmap_index_t bindex) {
   Thread safe allocation in an arena
 ----------------------------------------------------------- */
 
+/* -----------------------------------------------------------
+  Free range index
+  For each `blocks_inuse` field we keep a summary of its free ranges:
+  the free blocks at the start (prefix) and at the end (suffix) of the
+  field, and the longest free range in between (the longest inner range).
+  This lets us find the best fitting free range (instead of the first one)
+  with a single load per field, which bounds fragmentation when a large
+  arena is churned by huge allocations. Only fields with an inner range
+  that fits are scanned bit by bit.
+  The summary is a hint that is recomputed after every claim and unclaim;
+  claims still go through the `blocks_inuse` bitmap.
+----------------------------------------------------------- */
+
+#define MI_RANGE_BITS  (8)
+#define MI_RANGE_MASK  ((MI_ZU(1) << MI_RANGE_BITS) - 1)
+
+static size_t mi_range_prefix(size_t range)  { return (range & MI_RANGE_MASK); }
+static size_t mi_range_suffix(size_t range)  { return ((range >> MI_RANGE_BITS) & MI_RANGE_MASK); }
+static size_t mi_range_longest(size_t range) { return ((range >> (2*MI_RANGE_BITS)) & MI_RANGE_MASK); }
+
+// Summarize the free ranges in a `blocks_inuse` field
+// (for a completely free field the longest inner range is the whole field)
+static size_t mi_range_of_field(size_t map) {
+  if (map == 0) return (MI_BITMAP_FIELD_BITS | (MI_BITMAP_FIELD_BITS << MI_RANGE_BITS) | (MI_BITMAP_FIELD_BITS << (2*MI_RANGE_BITS)));
+  const size_t prefix = mi_ctz(map);
+  const size_t suffix = mi_clz(map);
+  // count the longest inner range by treating the prefix and suffix as in use
+  const size_t inner = map | ((MI_ZU(1) << prefix) - 1) | (suffix == 0 ? 0 : ~(MI_BITMAP_FIELD_FULL >> suffix));
+  size_t longest = 0;
+  for (size_t free = ~inner; free != 0; free &= (free >> 1)) { longest++; }
+  return (prefix | (suffix << MI_RANGE_BITS) | (longest << (2*MI_RANGE_BITS)));
+}
+
+// Recompute the range summaries of the fields that contain `count` blocks at `bitmap_idx`
+static void mi_arena_ranges_update(mi_arena_t* arena, size_t count, mi_bitmap_index_t bitmap_idx) {
+  const size_t first = mi_bitmap_index_field(bitmap_idx);
+  const size_t last  = mi_bitmap_index_field(bitmap_idx + count - 1);
+  for (size_t i = first; i <= last; i++) {
+    size_t map = mi_atomic_load_acquire(&arena->blocks_inuse[i]);
+    while (true) {
+      mi_atomic_store_release(&arena->field_ranges[i], mi_range_of_field(map));
+      // validate as the field may have changed concurrently (and another thread may have stored an older summary)
+      const size_t current = mi_atomic_load_acquire(&arena->blocks_inuse[i]);
+      if (current == map) break;
+      map = current;
+    }
+  }
+}
+
+// Unclaim `count` blocks at `bitmap_idx` and update the free range index
+static bool mi_arena_unclaim(mi_arena_t* arena, size_t count, mi_bitmap_index_t bitmap_idx) {
+  const bool all_inuse = _mi_bitmap_unclaim_across(arena->blocks_inuse, arena->field_count, count, bitmap_idx);
+  mi_arena_ranges_update(arena, count, bitmap_idx);
+  return all_inuse;
+}
+
+// Consider a free range as the best fit; returns `true` if it fits exactly.
+static bool mi_arena_fit_range(size_t count, mi_bitmap_index_t run_idx, size_t run_len, mi_bitmap_index_t* best_idx, size_t* best_len) {
+  if (run_len < count || run_len >= *best_len) return false;
+  *best_idx = run_idx;
+  *best_len = run_len;
+  return (run_len == count);
+}
+
+// Find the smallest free range of at least `count` blocks (the first one if there are several);
+// stops early on an exact fit. Returns `false` if no such range exists.
+static bool mi_arena_find_best_fit(mi_arena_t* arena, size_t count, mi_bitmap_index_t* bitmap_idx) {
+  size_t best_len = SIZE_MAX;
+  mi_bitmap_index_t run_idx = 0;  // the current free range (that can cross fields)
+  size_t run_len = 0;
+  for (size_t i = 0; i < arena->field_count; i++) {
+    const size_t range = mi_atomic_load_relaxed(&arena->field_ranges[i]);
+    if (range == 0) {
+      // all in use: the current range ends here and we can skip over any further full fields
+      if (mi_arena_fit_range(count, run_idx, run_len, bitmap_idx, &best_len)) return true;
+      run_len = 0;
+      i = _mi_bitmap_skip_fields(arena->field_ranges, i + 1, arena->field_count, MI_BITMAP_FIELD_FULL, 0) - 1;
+      continue;
+    }
+    const size_t prefix = mi_range_prefix(range);
+    if (prefix == MI_BITMAP_FIELD_BITS) {
+      // all free: extend the current range with this and any further free fields
+      const size_t next = _mi_bitmap_skip_fields(arena->field_ranges, i + 1, arena->field_count, MI_BITMAP_FIELD_FULL, range);
+      if (run_len == 0) { run_idx = mi_bitmap_index_create(i, 0); }
+      run_len += (next - i) * MI_BITMAP_FIELD_BITS;
+      i = next - 1;
+      continue;
+    }
+    // the current range ends in the prefix of this field
+    if (prefix > 0 && run_len == 0) { run_idx = mi_bitmap_index_create(i, 0); }
+    if (mi_arena_fit_range(count, run_idx, run_len + prefix, bitmap_idx, &best_len)) return true;
+    // scan the field if it has an inner range that fits
+    const size_t suffix = mi_range_suffix(range);
+    if (mi_range_longest(range) >= count) {
+      const size_t map = mi_atomic_load_relaxed(&arena->blocks_inuse[i]);
+      size_t bitidx = prefix;
+      while (bitidx < MI_BITMAP_FIELD_BITS - suffix) {
+        bitidx += mi_ctz(~(map >> bitidx));  // skip the blocks in use
+        if (bitidx >= MI_BITMAP_FIELD_BITS - suffix) break;
+        const size_t zeros = mi_ctz(map >> bitidx);
+        if (mi_arena_fit_range(count, mi_bitmap_index_create(i, bitidx), zeros, bitmap_idx, &best_len)) return true;
+        bitidx += zeros;
+      }
+    }
+    // and a new range starts with the suffix
+    if (suffix > 0) { run_idx = mi_bitmap_index_create(i, MI_BITMAP_FIELD_BITS - suffix); }
+    run_len = suffix;
+  }
+  mi_arena_fit_range(count, run_idx, run_len, bitmap_idx, &best_len);
+  return (best_len != SIZE_MAX);
+}
+
 // claim the `blocks_inuse` bits
 static bool mi_arena_try_claim(mi_arena_t* arena, size_t blocks, mi_bitmap_index_t* bitmap_idx, mi_stats_t* stats)
 {
-  size_t idx = 0; // mi_atomic_load_relaxed(&arena->search_idx);  // start from last search; ok to be relaxed as the exact start does not matter
-  if (_mi_bitmap_try_find_from_claim_across(arena->blocks_inuse, arena->field_count, idx, blocks, bitmap_idx, stats)) {
-    mi_atomic_store_relaxed(&arena->search_idx, mi_bitmap_index_field(*bitmap_idx));  // start search from found location next time around
-    return true;
-  };
-  return false;
+  bool claimed = false;
+  for (int tries = 0; tries < 3 && !claimed; tries++) {
+    if (!mi_arena_find_best_fit(arena, blocks, bitmap_idx)) return false;
+    claimed = _mi_bitmap_try_claim_across(arena->blocks_inuse, arena->field_count, blocks, *bitmap_idx, stats);
+  }
+  if (!claimed) {
+    // under contention, fall back to a linear search
+    size_t idx = mi_atomic_load_relaxed(&arena->search_idx);  // start from last search; ok to be relaxed as the exact start does not matter
+    if (!_mi_bitmap_try_find_from_claim_across(arena->blocks_inuse, arena->field_count, idx, blocks, bitmap_idx, stats)) return false;
+  }
+  mi_atomic_store_relaxed(&arena->search_idx, mi_bitmap_index_field(*bitmap_idx));  // start a fallback search from the found location next time around
+  mi_arena_ranges_update(arena, blocks, *bitmap_idx);
+  return true;
 }
 
 
@@ -231,6 +403,8 @@ static bool mi_arena_try_claim(mi_arena_t* arena, size_t blocks, mi_bitmap_index
   Arena Allocation
 ----------------------------------------------------------- */
 
+static void mi_arena_purge_unmark(mi_arena_t* arena, size_t blocks, mi_bitmap_index_t bitmap_idx);
+
 static mi_decl_noinline void* mi_arena_try_alloc_at(mi_arena_t* arena, size_t arena_index, size_t needed_bcount,
                                                     bool commit, mi_memid_t* memid, mi_os_tld_t* tld)
 {
@@ -248,7 +422,7 @@ static mi_decl_noinline void* mi_arena_try_alloc_at(mi_arena_t* arena, size_t ar
   // none of the claimed blocks should be scheduled for a decommit
   if (arena->blocks_purge != NULL) {
     // this is thread safe as a potential purge only decommits parts that are not yet claimed as used (in `blocks_inuse`).
-    _mi_bitmap_unclaim_across(arena->blocks_purge, arena->field_count, needed_bcount, bitmap_index);
+    mi_arena_purge_unmark(arena, needed_bcount, bitmap_index);
   }
 
   // set the dirty bits (todo: no need for an atomic op here?)
@@ -385,13 +559,13 @@ static bool mi_arena_reserve(size_t req_size, bool allow_large, mi_arena_id_t re
 
 
 void* _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset, bool commit, bool allow_large,
-                              mi_arena_id_t req_arena_id, mi_memid_t* memid, mi_os_tld_t* tld)
+                              mi_arena_id_t req_arena_id, int req_numa_node, mi_memid_t* memid, mi_os_tld_t* tld)
 {
   mi_assert_internal(memid != NULL && tld != NULL);
   mi_assert_internal(size > 0);
   *memid = _mi_memid_none();
 
-  const int numa_node = _mi_os_numa_node(tld); // current numa node
+  const int numa_node = (req_numa_node >= 0 ? req_numa_node : _mi_os_numa_node(tld)); // requested or current numa node
 
   // try to allocate in an arena if the alignment is small enough and the object is not too small (as for heap meta data)
   if (!mi_option_is_enabled(mi_option_disallow_arena_alloc) || req_arena_id != _mi_arena_id_none()) {  // is arena allocation allowed?
@@ -427,9 +601,9 @@ void* _mi_arena_alloc_aligned(size_t size, size_t alignment, size_t align_offset
   }
 }
 
-void* _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t req_arena_id, mi_memid_t* memid, mi_os_tld_t* tld)
+void* _mi_arena_alloc(size_t size, bool commit, bool allow_large, mi_arena_id_t req_arena_id, int req_numa_node, mi_memid_t* memid, mi_os_tld_t* tld)
 {
-  return _mi_arena_alloc_aligned(size, MI_ARENA_BLOCK_SIZE, 0, commit, allow_large, req_arena_id, memid, tld);
+  return _mi_arena_alloc_aligned(size, MI_ARENA_BLOCK_SIZE, 0, commit, allow_large, req_arena_id, req_numa_node, memid, tld);
 }
 
 
@@ -453,6 +627,12 @@ static long mi_arena_purge_delay(void) {
   return (mi_option_get(mi_option_purge_delay) * mi_option_get(mi_option_arena_purge_mult));
 }
 
+// clear the purge bits of a range of blocks (and update the purge summary)
+static void mi_arena_purge_unmark(mi_arena_t* arena, size_t blocks, mi_bitmap_index_t bitmap_idx) {
+  _mi_bitmap_unclaim_across(arena->blocks_purge, arena->field_count, blocks, bitmap_idx);
+  _mi_bitmap_summary_unclaimed(arena->purge_summary, arena->blocks_purge, blocks, bitmap_idx);
+}
+
 // reset or decommit in an arena and update the committed/decommit bitmaps
 // assumes we own the area (i.e. blocks_in_use is claimed by us)
 static void mi_arena_purge(mi_arena_t* arena, size_t bitmap_idx, size_t blocks, mi_stats_t* stats) {
@@ -477,7 +657,7 @@ static void mi_arena_purge(mi_arena_t* arena, size_t bitmap_idx, size_t blocks,
   }
 
   // clear the purged blocks
-  _mi_bitmap_unclaim_across(arena->blocks_purge, arena->field_count, blocks, bitmap_idx);
+  mi_arena_purge_unmark(arena, blocks, bitmap_idx);
   // update committed bitmap
   if (needs_recommit) {
     _mi_bitmap_unclaim_across(arena->blocks_committed, arena->field_count, blocks, bitmap_idx);
@@ -505,6 +685,7 @@ static void mi_arena_schedule_purge(mi_arena_t* arena, size_t bitmap_idx, size_t
       mi_atomic_storei64_release(&arena->purge_expire, _mi_clock_now() + delay);
     }
     _mi_bitmap_claim_across(arena->blocks_purge, arena->field_count, blocks, bitmap_idx, NULL);
+    _mi_bitmap_summary_claimed(arena->purge_summary, blocks, bitmap_idx);
   }
 }
 
@@ -548,7 +729,9 @@ static bool mi_arena_try_purge(mi_arena_t* arena, mi_msecs_t now, bool force, mi
   // potential purges scheduled, walk through the bitmap
   bool any_purged = false;
   bool full_purge = true;
-  for (size_t i = 0; i < arena->field_count; i++) {
+  // (using the summary to only visit fields with blocks to purge)
+  for (size_t i = _mi_bitmap_summary_next(arena->purge_summary, arena->field_count, 0); i < arena->field_count;
+              i = _mi_bitmap_summary_next(arena->purge_summary, arena->field_count, i + 1)) {
     size_t purge = mi_atomic_load_relaxed(&arena->blocks_purge[i]);
     if (purge != 0) {
       size_t bitidx = 0;
@@ -576,7 +759,7 @@ static bool mi_arena_try_purge(mi_arena_t* arena, mi_msecs_t now, bool force, mi
           }
           any_purged = true;
           // release the claimed `in_use` bits again
-          _mi_bitmap_unclaim(arena->blocks_inuse, arena->field_count, bitlen, bitmap_index);
+          mi_arena_unclaim(arena, bitlen, bitmap_index);
         }
         bitidx += (bitlen+1);  // +1 to skip the zero (or end)
       } // while bitidx
@@ -591,14 +774,16 @@ static bool mi_arena_try_purge(mi_arena_t* arena, mi_msecs_t now, bool force, mi
   return any_purged;
 }
 
-static void mi_arenas_try_purge( bool force, bool visit_all, mi_stats_t* stats ) {
-  if (_mi_preloading() || mi_arena_purge_delay() <= 0) return;  // nothing will be scheduled
+// returns the number of arenas that were purged
+static size_t mi_arenas_try_purge( bool force, bool visit_all, mi_stats_t* stats ) {
+  if (_mi_preloading() || mi_arena_purge_delay() <= 0) return 0;  // nothing will be scheduled
 
   const size_t max_arena = mi_atomic_load_acquire(&mi_arena_count);
-  if (max_arena == 0) return;
+  if (max_arena == 0) return 0;
 
   // allow only one thread to purge at a time
   static mi_atomic_guard_t purge_guard;
+  size_t purge_count = 0;
   mi_atomic_guard(&purge_guard)
   {
     mi_msecs_t now = _mi_clock_now();
@@ -607,12 +792,101 @@ static void mi_arenas_try_purge( bool force, bool visit_all, mi_stats_t* stats )
       mi_arena_t* arena = mi_atomic_load_ptr_acquire(mi_arena_t, &mi_arenas[i]);
       if (arena != NULL) {
         if (mi_arena_try_purge(arena, now, force, stats)) {
+          purge_count++;
           if (max_purge_count <= 1) break;
           max_purge_count--;
         }
       }
     }
   }
+  return purge_count;
+}
+
+
+/* -----------------------------------------------------------
+  Background purging
+  With `mi_option_purge_background` enabled, a background thread
+  purges the arenas once their purge delay expires, and the
+  (non-forced) purges on the free and collect paths are skipped.
+  Delayed page purges inside segments are owned by their thread
+  and are still done inline.
+  The thread is started at process initialization, or on the next
+  arena free or collect if the option is enabled later on (or if
+  an earlier start failed). It exits when the option is disabled,
+  and it is stopped at process exit (and not started again after that).
+----------------------------------------------------------- */
+
+#define MI_PURGE_THREAD_NONE     (0)
+#define MI_PURGE_THREAD_RUNNING  (1)
+#define MI_PURGE_THREAD_STOP     (2)
+#define MI_PURGE_THREAD_DONE     (3)
+
+static mi_decl_cache_align _Atomic(size_t) mi_purge_thread_state; // = MI_PURGE_THREAD_NONE
+
+static bool mi_arenas_purge_thread_is_running(void) {
+  return (mi_atomic_load_relaxed(&mi_purge_thread_state) == MI_PURGE_THREAD_RUNNING);
+}
+
+// Does the background thread purge the arenas? (starts it if needed)
+static bool mi_arenas_purge_in_background(void) {
+  const size_t state = mi_atomic_load_relaxed(&mi_purge_thread_state);
+  if mi_likely(state == MI_PURGE_THREAD_RUNNING) return true;
+  if (state != MI_PURGE_THREAD_NONE || !mi_option_is_enabled(mi_option_purge_background)) return false;
+  return _mi_arenas_purge_thread_start();
+}
+
+static bool mi_arenas_purge_thread_continue(void) {
+  return (mi_arenas_purge_thread_is_running() && mi_option_is_enabled(mi_option_purge_background));
+}
+
+static void mi_arenas_purge_thread(void* arg) {
+  MI_UNUSED(arg);
+  const mi_msecs_t step = 10;
+  while (mi_arenas_purge_thread_continue()) {
+    // wait for about the purge delay (in small steps so we can stop quickly)
+    mi_msecs_t delay = mi_arena_purge_delay();
+    if (delay <= 0) { delay = 100; }
+    else if (delay > 1000) { delay = 1000; }
+    for (mi_msecs_t waited = 0; waited < delay && mi_arenas_purge_thread_continue(); waited += step) {
+      _mi_prim_thread_sleep(step);
+    }
+    if (!mi_arenas_purge_thread_continue()) break;
+    const size_t count = mi_arenas_try_purge(false, true /* visit all */, &_mi_stats_main);
+    if (count > 0) {
+      _mi_stat_counter_increase(&_mi_stats_main.purge_background, count);
+    }
+  }
+  // if the option was disabled we can be started again, but not if we were stopped
+  size_t expected = MI_PURGE_THREAD_RUNNING;
+  if (!mi_atomic_cas_strong_acq_rel(&mi_purge_thread_state, &expected, (size_t)MI_PURGE_THREAD_NONE)) {
+    mi_atomic_store_release(&mi_purge_thread_state, (size_t)MI_PURGE_THREAD_DONE);
+  }
+}
+
+// Start the background purge thread; returns `true` if it is running.
+bool _mi_arenas_purge_thread_start(void) {
+  size_t expected = MI_PURGE_THREAD_NONE;
+  if (!mi_atomic_cas_strong_acq_rel(&mi_purge_thread_state, &expected, (size_t)MI_PURGE_THREAD_RUNNING)) {
+    return (expected == MI_PURGE_THREAD_RUNNING);
+  }
+  if (!_mi_prim_thread_start(&mi_arenas_purge_thread, NULL)) {
+    mi_atomic_store_release(&mi_purge_thread_state, (size_t)MI_PURGE_THREAD_NONE);  // we may try again later
+    _mi_warning_message("unable to start the background purge thread (purging inline instead)\n");
+    return false;
+  }
+  _mi_verbose_message("background purge thread started\n");
+  return true;
+}
+
+// Stop the background purge thread (for good) and wait (briefly) until it is done.
+void _mi_arenas_purge_thread_stop(void) {
+  size_t expected = MI_PURGE_THREAD_NONE;
+  if (mi_atomic_cas_strong_acq_rel(&mi_purge_thread_state, &expected, (size_t)MI_PURGE_THREAD_DONE)) return;  // not running
+  if (expected != MI_PURGE_THREAD_RUNNING) return;
+  if (!mi_atomic_cas_strong_acq_rel(&mi_purge_thread_state, &expected, (size_t)MI_PURGE_THREAD_STOP)) return;
+  for (int i = 0; i < 1000 && mi_atomic_load_acquire(&mi_purge_thread_state) == MI_PURGE_THREAD_STOP; i++) {
+    _mi_prim_thread_sleep(1);
+  }
 }
 
 
@@ -685,7 +959,7 @@ void _mi_arena_free(void* p, size_t size, size_t committed_size, mi_memid_t memi
     }
 
     // and make it available to others again
-    bool all_inuse = _mi_bitmap_unclaim_across(arena->blocks_inuse, arena->field_count, blocks, bitmap_idx);
+    bool all_inuse = mi_arena_unclaim(arena, blocks, bitmap_idx);
     if (!all_inuse) {
       _mi_error_message(EAGAIN, "trying to free an already freed arena block: %p, size %zu\n", p, size);
       return;
@@ -696,8 +970,10 @@ void _mi_arena_free(void* p, size_t size, size_t committed_size, mi_memid_t memi
     mi_assert_internal(memid.memkind < MI_MEM_OS);
   }
 
-  // purge expired decommits
-  mi_arenas_try_purge(false, false, stats);
+  // purge expired decommits (unless the background thread does this)
+  if (!mi_arenas_purge_in_background()) {
+    mi_arenas_try_purge(false, false, stats);
+  }
 }
 
 // destroy owned arenas; this is unsafe and should only be done using `mi_option_destroy_on_exit`
@@ -727,7 +1003,9 @@ static void mi_arenas_unsafe_destroy(void) {
 
 // Purge the arenas; if `force_purge` is true, amenable parts are purged even if not yet expired
 void _mi_arenas_collect(bool force_purge, mi_stats_t* stats) {
-  mi_arenas_try_purge(force_purge, force_purge /* visit all? */, stats);
+  if (force_purge || !mi_arenas_purge_in_background()) {
+    mi_arenas_try_purge(force_purge, force_purge /* visit all? */, stats);
+  }
 }
 
 // destroy owned arenas; this is unsafe and should only be done using `mi_option_destroy_on_exit`
@@ -782,8 +1060,8 @@ static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int
 
   const size_t bcount = size / MI_ARENA_BLOCK_SIZE;
   const size_t fields = _mi_divide_up(bcount, MI_BITMAP_FIELD_BITS);
-  const size_t bitmaps = (memid.is_pinned ? 3 : 5);
-  const size_t asize  = sizeof(mi_arena_t) + (bitmaps*fields*sizeof(mi_bitmap_field_t));
+  const size_t bitmaps = (memid.is_pinned ? 3 : 6);
+  const size_t asize  = sizeof(mi_arena_t) + (((bitmaps+1)*fields + 2*mi_bitmap_summary_fields(fields))*sizeof(mi_bitmap_field_t));
   mi_memid_t meta_memid;
   mi_arena_t* arena   = (mi_arena_t*)_mi_arena_meta_zalloc(asize, &meta_memid);
   if (arena == NULL) return false;
@@ -808,6 +1086,10 @@ static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int
   arena->blocks_abandoned = &arena->blocks_inuse[2 * fields]; // just after dirty bitmap
   arena->blocks_committed = (arena->memid.is_pinned ? NULL : &arena->blocks_inuse[3*fields]); // just after abandoned bitmap
   arena->blocks_purge     = (arena->memid.is_pinned ? NULL : &arena->blocks_inuse[4*fields]); // just after committed bitmap
+  arena->blocks_thp       = (arena->memid.is_pinned ? NULL : &arena->blocks_inuse[5*fields]); // just after purge bitmap
+  arena->field_ranges     = &arena->blocks_inuse[bitmaps*fields]; // after all bitmaps
+  arena->purge_summary    = &arena->blocks_inuse[(bitmaps+1)*fields]; // after the free range index
+  arena->abandoned_summary = &arena->purge_summary[mi_bitmap_summary_fields(fields)];
   // initialize committed bitmap?
   if (arena->blocks_committed != NULL && arena->memid.initially_committed) {
     memset((void*)arena->blocks_committed, 0xFF, fields*sizeof(mi_bitmap_field_t)); // cast to void* to avoid atomic warning
@@ -821,6 +1103,8 @@ static bool mi_manage_os_memory_ex2(void* start, size_t size, bool is_large, int
     mi_bitmap_index_t postidx = mi_bitmap_index_create(fields - 1, MI_BITMAP_FIELD_BITS - post);
     _mi_bitmap_claim(arena->blocks_inuse, fields, post, postidx, NULL);
   }
+  // initialize the free range index
+  mi_arena_ranges_update(arena, fields*MI_BITMAP_FIELD_BITS, 0);
   return mi_arena_add(arena, arena_id, &_mi_stats_main);
 
 }
@@ -838,9 +1122,15 @@ int mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exc
   if (arena_id != NULL) *arena_id = _mi_arena_id_none();
   size = _mi_align_up(size, MI_ARENA_BLOCK_SIZE); // at least one block
   mi_memid_t memid;
-  void* start = _mi_os_alloc_aligned(size, MI_SEGMENT_ALIGN, commit, allow_large, &memid, &_mi_stats_main);
+  const bool thp_aware = mi_option_is_enabled(mi_option_thp_aware);
+  const size_t alignment = (thp_aware ? _mi_align_up(MI_SEGMENT_ALIGN, _mi_os_large_page_size()) : MI_SEGMENT_ALIGN); // huge OS page aligned blocks
+  void* start = _mi_os_alloc_aligned(size, alignment, commit, allow_large, &memid, &_mi_stats_main);
   if (start == NULL) return ENOMEM;
   const bool is_large = memid.is_pinned; // todo: use separate is_large field?
+  if (thp_aware && !is_large) {
+    // only densely used segments use transparent huge pages (see `segment.c:mi_segment_thp_try_advise`)
+    _mi_os_thp_advise(start, size, false, &_mi_stats_main);
+  }
   if (!mi_manage_os_memory_ex2(start, size, is_large, -1 /* numa node */, exclusive, memid, arena_id)) {
     _mi_os_free_ex(start, size, commit, memid, &_mi_stats_main);
     _mi_verbose_message("failed to reserve %zu KiB memory\n", _mi_divide_up(size, 1024));
@@ -890,6 +1180,34 @@ static size_t mi_debug_show_bitmap(const char* prefix, const char* header, size_
   return inuse_count;
 }
 
+static size_t mi_arena_bitmap_count(mi_bitmap_field_t* fields, size_t field_count) {
+  size_t count = 0;
+  for (size_t i = 0; i < field_count; i++) {
+    size_t field = mi_atomic_load_relaxed(&fields[i]);
+    while (field != 0) { field &= (field - 1); count++; }
+  }
+  return count;
+}
+
+// get (approximate) information about an arena (used for statistics)
+bool _mi_arena_get_info(size_t arena_index, mi_arena_info_t* info) {
+  if (arena_index >= mi_atomic_load_relaxed(&mi_arena_count)) return false;
+  mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[arena_index]);
+  if (arena == NULL) return false;
+  info->block_size  = MI_ARENA_BLOCK_SIZE;
+  info->block_count = arena->block_count;
+  info->inuse_count = mi_arena_bitmap_count(arena->blocks_inuse, arena->field_count);
+  info->committed_count = (arena->blocks_committed == NULL ? arena->block_count : mi_arena_bitmap_count(arena->blocks_committed, arena->field_count));
+  info->abandoned_count = mi_arena_bitmap_count(arena->blocks_abandoned, arena->field_count);
+  info->purge_count = (arena->blocks_purge == NULL ? 0 : mi_arena_bitmap_count(arena->blocks_purge, arena->field_count));
+  info->thp_count = (arena->blocks_thp == NULL ? 0 : mi_arena_bitmap_count(arena->blocks_thp, arena->field_count));
+  info->numa_node = arena->numa_node;
+  info->exclusive = arena->exclusive;
+  info->is_large  = arena->is_large;
+  info->is_pinned = arena->memid.is_pinned;
+  return true;
+}
+
 void mi_debug_show_arenas(bool show_inuse, bool show_abandoned, bool show_purge) mi_attr_noexcept {
   size_t max_arenas = mi_atomic_load_relaxed(&mi_arena_count);
   size_t inuse_total = 0;
@@ -20,6 +20,10 @@ between the fields. (This is used in arena allocation)
 #include "mimalloc/internal.h"
 #include "bitmap.h"
 
+#if MI_BITMAP_USE_AVX2
+extern bool _mi_cpu_has_avx2;   // detected at process initialization (see `mi_detect_cpu_features` in `init.c`)
+#endif
+
 /* -----------------------------------------------------------
   Bitmap definition
 ----------------------------------------------------------- */
@@ -34,6 +38,113 @@ static inline size_t mi_bitmap_mask_(size_t count, size_t bitidx) {
 }
 
 
+/* -----------------------------------------------------------
+  Skip fields
+  Large arenas have long bitmaps where most fields cannot satisfy a claim
+  (for example, when they are full). We skip those fields many at a time:
+  with AVX2 (if available at runtime) we compare 4 fields per instruction,
+  and otherwise we combine 4 fields with bit operations.
+----------------------------------------------------------- */
+
+#if MI_BITMAP_USE_AVX2
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static size_t mi_bitmap_skip_fields_avx2(mi_bitmap_t bitmap, size_t from, size_t to, size_t mask, size_t value) {
+  const __m256i vmask  = _mm256_set1_epi64x((long long)mask);
+  const __m256i vvalue = _mm256_set1_epi64x((long long)value);
+  size_t idx = from;
+  while (idx + 4 <= to) {
+    // (the fields are only a hint here so we can load them non-atomically)
+    const __m256i fields = _mm256_loadu_si256((const __m256i*)(const void*)&bitmap[idx]);
+    const __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(fields, vmask), vvalue);
+    const unsigned int skip = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    if (skip != 0x0F) {
+      return idx + mi_ctz(~(size_t)skip);
+    }
+    idx += 4;
+  }
+  return idx;
+}
+#endif
+
+// Return the index of the first field in `[from,to)` where `(field & mask) != value`, or `to` if there is none.
+size_t _mi_bitmap_skip_fields(mi_bitmap_t bitmap, size_t from, size_t to, size_t mask, size_t value) {
+  size_t idx = from;
+  #if MI_BITMAP_USE_AVX2
+  if (_mi_cpu_has_avx2 && from + 8 <= to) {
+    idx = mi_bitmap_skip_fields_avx2(bitmap, from, to, mask, value);
+  }
+  #endif
+  while (idx + 4 <= to) {
+    const size_t diff = ((mi_atomic_load_relaxed(&bitmap[idx])   & mask) ^ value) | ((mi_atomic_load_relaxed(&bitmap[idx+1]) & mask) ^ value) |
+                        ((mi_atomic_load_relaxed(&bitmap[idx+2]) & mask) ^ value) | ((mi_atomic_load_relaxed(&bitmap[idx+3]) & mask) ^ value);
+    if (diff != 0) break;
+    idx += 4;
+  }
+  while (idx < to && (mi_atomic_load_relaxed(&bitmap[idx]) & mask) == value) {
+    idx++;
+  }
+  return idx;
+}
+
+
+
+/* -----------------------------------------------------------
+  Summary bitmaps
+  A summary has a bit per field of a bitmap that is set if the field is
+  (potentially) non-zero, such that scans only visit fields with set bits.
+  A summary bit is set after setting bits in its field, and it is only
+  cleared once the field has become zero (and then validated again as
+  the field may have been set concurrently). Both sides update the summary
+  with an atomic read-modify-write: if the clearing `and` follows the
+  setting `or`, it synchronizes with it and the validation is guaranteed
+  to see the bits set in the field.
+----------------------------------------------------------- */
+
+// Update the summary after setting `count` bits at `bitmap_idx`
+void _mi_bitmap_summary_claimed(mi_bitmap_t summary, size_t count, mi_bitmap_index_t bitmap_idx) {
+  const size_t first = mi_bitmap_index_field(bitmap_idx);
+  const size_t last  = mi_bitmap_index_field(bitmap_idx + count - 1);
+  for (size_t i = first; i <= last; i++) {
+    const size_t bit = ((size_t)1 << mi_bitmap_index_bit_in_field(i));
+    mi_bitmap_field_t* const sfield = &summary[mi_bitmap_index_field(i)];
+    mi_atomic_or_acq_rel(sfield, bit);  // always, even if it looks set already (see above)
+  }
+}
+
+// Update the summary after clearing `count` bits at `bitmap_idx` in `bitmap`
+void _mi_bitmap_summary_unclaimed(mi_bitmap_t summary, mi_bitmap_t bitmap, size_t count, mi_bitmap_index_t bitmap_idx) {
+  const size_t first = mi_bitmap_index_field(bitmap_idx);
+  const size_t last  = mi_bitmap_index_field(bitmap_idx + count - 1);
+  for (size_t i = first; i <= last; i++) {
+    if (mi_atomic_load_relaxed(&bitmap[i]) != 0) continue;
+    const size_t bit = ((size_t)1 << mi_bitmap_index_bit_in_field(i));
+    mi_bitmap_field_t* const sfield = &summary[mi_bitmap_index_field(i)];
+    mi_atomic_and_acq_rel(sfield, ~bit);
+    if (mi_atomic_load_acquire(&bitmap[i]) != 0) {
+      mi_atomic_or_acq_rel(sfield, bit);  // set concurrently
+    }
+  }
+}
+
+// Return the index of the first field at or after `field_idx` that has its summary bit set (or `bitmap_fields` if there is none)
+size_t _mi_bitmap_summary_next(mi_bitmap_t summary, size_t bitmap_fields, size_t field_idx) {
+  const size_t summary_fields = mi_bitmap_summary_fields(bitmap_fields);
+  size_t sidx = mi_bitmap_index_field(field_idx);
+  if (sidx >= summary_fields) return bitmap_fields;
+  size_t map = (mi_atomic_load_relaxed(&summary[sidx]) >> mi_bitmap_index_bit_in_field(field_idx));
+  if (map == 0) {
+    sidx = _mi_bitmap_skip_fields(summary, sidx + 1, summary_fields, MI_BITMAP_FIELD_FULL, 0);
+    if (sidx >= summary_fields) return bitmap_fields;
+    field_idx = mi_bitmap_index_create(sidx, 0);
+    map = mi_atomic_load_relaxed(&summary[sidx]);
+    if (map == 0) return _mi_bitmap_summary_next(summary, bitmap_fields, field_idx);  // cleared concurrently
+  }
+  field_idx += mi_ctz(map);
+  return (field_idx < bitmap_fields ? field_idx : bitmap_fields);
+}
+
 
 /* -----------------------------------------------------------
   Claim a bit sequence atomically
@@ -98,11 +209,15 @@ bool _mi_bitmap_try_find_claim_field(mi_bitmap_t bitmap, size_t idx, const size_
 // Starts at idx, and wraps around to search in all `bitmap_fields` fields.
 // For now, `count` can be at most MI_BITMAP_FIELD_BITS and will never cross fields.
 bool _mi_bitmap_try_find_from_claim(mi_bitmap_t bitmap, const size_t bitmap_fields, const size_t start_field_idx, const size_t count, mi_bitmap_index_t* bitmap_idx) {
-  size_t idx = start_field_idx;
-  for (size_t visited = 0; visited < bitmap_fields; visited++, idx++) {
-    if (idx >= bitmap_fields) { idx = 0; } // wrap
-    if (_mi_bitmap_try_find_claim_field(bitmap, idx, count, bitmap_idx)) {
-      return true;
+  // visit `[start_field_idx,bitmap_fields)` and then wrap around to `[0,start_field_idx)`
+  for (size_t pass = 0; pass < 2; pass++) {
+    const size_t end = (pass == 0 ? bitmap_fields : start_field_idx);
+    size_t idx = (pass == 0 ? start_field_idx : 0);
+    while ((idx = _mi_bitmap_skip_fields(bitmap, idx, end, MI_BITMAP_FIELD_FULL, MI_BITMAP_FIELD_FULL)) < end) {  // skip full fields
+      if (_mi_bitmap_try_find_claim_field(bitmap, idx, count, bitmap_idx)) {
+        return true;
+      }
+      idx++;
     }
   }
   return false;
@@ -282,21 +397,26 @@ bool _mi_bitmap_try_find_from_claim_across(mi_bitmap_t bitmap, const size_t bitm
     return _mi_bitmap_try_find_from_claim(bitmap, bitmap_fields, start_field_idx, count, bitmap_idx);
   }
 
-  // visit the fields
-  size_t idx = start_field_idx;
-  for (size_t visited = 0; visited < bitmap_fields; visited++, idx++) {
-    if (idx >= bitmap_fields) { idx = 0; } // wrap
-    // first try to claim inside a field
-    /*
-    if (count <= MI_BITMAP_FIELD_BITS) {
-      if (_mi_bitmap_try_find_claim_field(bitmap, idx, count, bitmap_idx)) {
+  // visit the fields in `[start_field_idx,bitmap_fields)` and then wrap around to `[0,start_field_idx)`
+  const size_t top_bit = ((size_t)1 << (MI_BITMAP_FIELD_BITS - 1));
+  for (size_t pass = 0; pass < 2; pass++) {
+    const size_t end = (pass == 0 ? bitmap_fields : start_field_idx);
+    size_t idx = (pass == 0 ? start_field_idx : 0);
+    // a range can only start in a field where the most significant bit is free
+    while ((idx = _mi_bitmap_skip_fields(bitmap, idx, end, top_bit, top_bit)) < end) {
+      // first try to claim inside a field
+      /*
+      if (count <= MI_BITMAP_FIELD_BITS) {
+        if (_mi_bitmap_try_find_claim_field(bitmap, idx, count, bitmap_idx)) {
+          return true;
+        }
+      }
+      */
+      // if that fails, then try to claim across fields
+      if (mi_bitmap_try_find_claim_field_across(bitmap, bitmap_fields, idx, count, 0, bitmap_idx, stats)) {
         return true;
       }
-    }
-    */
-    // if that fails, then try to claim across fields
-    if (mi_bitmap_try_find_claim_field_across(bitmap, bitmap_fields, idx, count, 0, bitmap_idx, stats)) {
-      return true;
+      idx++;
     }
   }
   return false;
@@ -379,6 +499,54 @@ bool _mi_bitmap_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t co
 }
 
 
+// Try to set `count` bits at `bitmap_idx` from 0 to 1 atomically.
+// Returns `true` if successful when all previous `count` bits were 0 (and leaves the bitmap unchanged otherwise).
+bool _mi_bitmap_try_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx, mi_stats_t* stats) {
+  size_t pre_mask;
+  size_t mid_mask;
+  size_t post_mask;
+  const size_t mid_count = mi_bitmap_mask_across(bitmap_idx, bitmap_fields, count, &pre_mask, &mid_mask, &post_mask);
+  MI_UNUSED(stats);
+  mi_bitmap_field_t* const initial_field = &bitmap[mi_bitmap_index_field(bitmap_idx)];
+  mi_bitmap_field_t* field = initial_field;
+  size_t map;
+
+  // initial field
+  map = mi_atomic_load_relaxed(field);
+  do {
+    if ((map & pre_mask) != 0) return false;
+  } while (!mi_atomic_cas_strong_acq_rel(field, &map, map | pre_mask));
+  if (mid_count == 0 && post_mask == 0) return true;
+
+  // intermediate fields
+  mi_bitmap_field_t* const final_field = initial_field + mid_count + 1;
+  while (++field < final_field) {
+    map = 0;
+    if (!mi_atomic_cas_strong_acq_rel(field, &map, mid_mask)) { goto rollback; }
+  }
+
+  // final field
+  if (post_mask != 0) {
+    mi_assert_internal(field == final_field);
+    map = mi_atomic_load_relaxed(field);
+    do {
+      if ((map & post_mask) != 0) { goto rollback; }
+    } while (!mi_atomic_cas_strong_acq_rel(field, &map, map | post_mask));
+  }
+  mi_stat_counter_increase(stats->arena_crossover_count, 1);
+  return true;
+
+rollback:
+  // roll back the intermediate fields and the initial field (we just failed to claim `field`)
+  while (--field > initial_field) {
+    mi_assert_internal(mi_atomic_load_relaxed(field) == mid_mask);
+    mi_atomic_store_release(field, (size_t)0);
+  }
+  mi_atomic_and_acq_rel(initial_field, ~pre_mask);
+  mi_stat_counter_increase(stats->arena_rollback_count, 1);
+  return false;
+}
+
 // Returns `true` if all `count` bits were 1.
 // `any_ones` is `true` if there was at least one bit set to one.
 static bool mi_bitmap_is_claimedx_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx, bool* pany_ones) {
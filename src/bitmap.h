@@ -20,6 +20,11 @@ between the fields. (This is used in arena allocation)
 #ifndef MI_BITMAP_H
 #define MI_BITMAP_H
 
+#if (defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))) || (defined(_M_X64) && defined(_MSC_VER))
+#define MI_BITMAP_USE_AVX2  1
+#include <immintrin.h>  // note: included early in `static.c` as it declares `posix_memalign`
+#endif
+
 /* -----------------------------------------------------------
   Bitmap definition
 ----------------------------------------------------------- */
@@ -55,6 +60,29 @@ static inline size_t mi_bitmap_index_bit(mi_bitmap_index_t bitmap_idx) {
   return bitmap_idx;
 }
 
+// Return the index of the first field in `[from,to)` where `(field & mask) != value`, or `to` if there is none.
+// Uses AVX2 if it is available at runtime.
+size_t _mi_bitmap_skip_fields(mi_bitmap_t bitmap, size_t from, size_t to, size_t mask, size_t value);
+
+/* -----------------------------------------------------------
+  Summary bitmaps with a bit per field of a bitmap that is set
+  if the field is (potentially) non-zero
+----------------------------------------------------------- */
+
+// The number of fields of the summary for a bitmap of `bitmap_fields` fields
+static inline size_t mi_bitmap_summary_fields(size_t bitmap_fields) {
+  return ((bitmap_fields + MI_BITMAP_FIELD_BITS - 1) / MI_BITMAP_FIELD_BITS);
+}
+
+// Update the summary after setting `count` bits at `bitmap_idx`
+void _mi_bitmap_summary_claimed(mi_bitmap_t summary, size_t count, mi_bitmap_index_t bitmap_idx);
+
+// Update the summary after clearing `count` bits at `bitmap_idx` in `bitmap`
+void _mi_bitmap_summary_unclaimed(mi_bitmap_t summary, mi_bitmap_t bitmap, size_t count, mi_bitmap_index_t bitmap_idx);
+
+// Return the index of the first field at or after `field_idx` that has its summary bit set (or `bitmap_fields` if there is none)
+size_t _mi_bitmap_summary_next(mi_bitmap_t summary, size_t bitmap_fields, size_t field_idx);
+
 /* -----------------------------------------------------------
   Claim a bit sequence atomically
 ----------------------------------------------------------- */
@@ -100,6 +128,10 @@ bool _mi_bitmap_unclaim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t
 // Returns `true` if all `count` bits were 0 previously. `any_zero` is `true` if there was at least one zero bit.
 bool _mi_bitmap_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx, bool* pany_zero);
 
+// Try to set `count` bits at `bitmap_idx` from 0 to 1 atomically.
+// Returns `true` if successful when all previous `count` bits were 0.
+bool _mi_bitmap_try_claim_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx, mi_stats_t* stats);
+
 bool _mi_bitmap_is_claimed_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx);
 bool _mi_bitmap_is_any_claimed_across(mi_bitmap_t bitmap, size_t bitmap_fields, size_t count, mi_bitmap_index_t bitmap_idx);
 
@@ -0,0 +1,330 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2024, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+Per-CPU caches.
+
+Normally each thread allocates from the pages of its own heap. With thousands
+of threads that are mostly idle this means the memory use scales with the
+number of threads (as each thread keeps partially used pages for each size
+class). If `mi_option_cpu_cache` is set (Linux with glibc 2.35+), freed small blocks are
+instead kept in a cache per CPU (up to N blocks per size class), and
+allocations through the default (backing) heap first try the cache of the CPU
+the thread runs on. The cache sits in front of the regular page and segment
+machinery: cached blocks remain allocated as far as their page is concerned.
+
+The current CPU is read from the `rseq` area that glibc registers for each
+thread (see `_mi_prim_current_cpu`); if there is no such area the caches stay
+disabled (as a system call on every allocation and free would cost more than
+the cache saves). Instead of a restartable sequence (which
+requires hand written assembly for each architecture) each cache is protected
+by a lock that is only ever tried: as threads on the same CPU only contend when
+one of them is preempted (or migrated) while holding the lock, we simply fall
+back to the regular heap when the lock is taken.
+
+Only blocks from pages that belong to a backing heap in the main sub-process
+are cached since those are never destroyed while the block is in use (see
+`page->cpu_cacheable`). As pages can still move to another heap through
+reclaiming abandoned segments, `mi_heap_destroy` drops any cached blocks of
+the destroyed heap.
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc/internal.h"
+#include "mimalloc/atomic.h"
+#include "mimalloc/prim.h"
+
+#include <string.h>  // memset
+
+#define MI_CPU_CACHE_BINS   (32)    // cache bins up to `MI_SMALL_SIZE_MAX` (plus padding)
+
+typedef struct mi_cpu_cache_s {
+  _Atomic(uintptr_t) lock;                        // 1 while in use
+  mi_block_t*        free[MI_CPU_CACHE_BINS];     // cached blocks per bin (linked through the encoded `next` field)
+  uint16_t           count[MI_CPU_CACHE_BINS];    // number of cached blocks per bin
+} mi_cpu_cache_t;
+
+typedef struct mi_cpu_caches_s {
+  mi_memid_t         memid;
+  size_t             count;                       // number of caches (the number of configured CPUs)
+  size_t             stride;                      // size of each cache (aligned to a cache line)
+  size_t             max_count;                   // maximal number of blocks per bin
+  size_t             max_bin;                     // largest bin that is cached
+} mi_cpu_caches_t;
+
+bool _mi_cpu_cache_enabled;                       // = false
+static _Atomic(mi_cpu_caches_t*) mi_cpu_caches;   // = NULL
+
+static mi_cpu_cache_t* mi_cpu_cache_at(mi_cpu_caches_t* caches, size_t i) {
+  mi_assert_internal(i < caches->count);
+  return (mi_cpu_cache_t*)((uint8_t*)caches + _mi_align_up(sizeof(mi_cpu_caches_t), MI_CACHE_LINE) + (i * caches->stride));
+}
+
+static mi_cpu_caches_t* mi_cpu_caches_get(void) {
+  return mi_atomic_load_ptr_acquire(mi_cpu_caches_t, &mi_cpu_caches);
+}
+
+// Enable the per-CPU caches if `mi_option_cpu_cache` is set; called on process and thread initialization
+void _mi_cpu_cache_init(void) {
+  #if MI_TRACK_ENABLED
+  return;  // cached blocks would be invisible to the memory tracker
+  #else
+  if (_mi_cpu_cache_enabled) return;
+  const size_t max_count = (size_t)mi_option_get_clamp(mi_option_cpu_cache, 0, UINT16_MAX);
+  if (max_count == 0) return;
+  if (mi_cpu_caches_get() != NULL) {
+    // enabled before (and disabled again by `_mi_cpu_cache_flush`)
+    _mi_cpu_cache_enabled = true;
+    return;
+  }
+  const size_t count = _mi_prim_cpu_count();
+  if (count == 0 || _mi_prim_current_cpu() < 0) return;  // not supported on this platform
+
+  const size_t stride = _mi_align_up(sizeof(mi_cpu_cache_t), MI_CACHE_LINE);
+  const size_t size = _mi_align_up(sizeof(mi_cpu_caches_t), MI_CACHE_LINE) + (count * stride);
+  mi_memid_t memid;
+  mi_cpu_caches_t* caches = (mi_cpu_caches_t*)_mi_os_alloc(size, &memid, &_mi_stats_main);
+  if (caches == NULL) return;
+  if (!memid.initially_zero) { _mi_memzero_aligned(caches, size); }
+  caches->memid = memid;
+  caches->count = count;
+  caches->stride = stride;
+  caches->max_count = max_count;
+  caches->max_bin = _mi_bin(MI_SMALL_SIZE_MAX + MI_PADDING_SIZE);
+  mi_assert_internal(caches->max_bin < MI_CPU_CACHE_BINS);
+  if (caches->max_bin >= MI_CPU_CACHE_BINS) { caches->max_bin = MI_CPU_CACHE_BINS - 1; }
+
+  mi_cpu_caches_t* expected = NULL;
+  if (!mi_atomic_cas_ptr_strong_release(mi_cpu_caches_t, &mi_cpu_caches, &expected, caches)) {
+    // another thread enabled the caches concurrently
+    _mi_os_free(caches, size, memid, &_mi_stats_main);
+    return;
+  }
+  _mi_verbose_message("per-CPU caches enabled (%zu CPUs, up to %zu blocks per size class)\n", count, max_count);
+  _mi_cpu_cache_enabled = true;
+  #endif
+}
+
+// Can blocks in pages of this heap be cached? Only for backing heaps in the main sub-process
+// (as these are never destroyed).
+bool _mi_cpu_cache_heap_is_cacheable(const mi_heap_t* heap) {
+  return (mi_heap_is_initialized((mi_heap_t*)heap) && mi_heap_is_backing(heap) && heap->tag == 0 &&
+          heap->tld->segments.subproc == _mi_subproc_from_id(NULL /* main */));
+}
+
+// Try to acquire the cache of the current CPU; returns NULL if it is in use.
+static mi_cpu_cache_t* mi_cpu_cache_try_acquire(mi_cpu_caches_t* caches) {
+  const int cpu = _mi_prim_current_cpu();
+  if mi_unlikely(cpu < 0) return NULL;
+  mi_cpu_cache_t* const cache = mi_cpu_cache_at(caches, (size_t)cpu % caches->count);
+  uintptr_t expected = 0;
+  if mi_unlikely(!mi_atomic_cas_strong_acq_rel(&cache->lock, &expected, 1)) return NULL;
+  return cache;
+}
+
+static void mi_cpu_cache_acquire(mi_cpu_cache_t* cache) {
+  uintptr_t expected = 0;
+  while (!mi_atomic_cas_weak_acq_rel(&cache->lock, &expected, 1)) {
+    expected = 0;
+    mi_atomic_yield();
+  }
+}
+
+static void mi_cpu_cache_release(mi_cpu_cache_t* cache) {
+  mi_atomic_store_release(&cache->lock, (uintptr_t)0);
+}
+
+// The blocks in a cache bin come from different pages, so each `next` field is encoded with
+// the keys of the page of its own block (and we cannot use `mi_block_next` which checks that
+// the next block is in the same page).
+static mi_block_t* mi_cpu_cache_next(const mi_block_t* block) {
+  #ifdef MI_ENCODE_FREELIST
+  const mi_page_t* const page = _mi_segment_page_of(_mi_ptr_segment(block), block);
+  return mi_block_nextx(page, block, page->keys);
+  #else
+  return mi_block_nextx(NULL, block, NULL);
+  #endif
+}
+
+static void mi_cpu_cache_set_next(mi_block_t* block, mi_block_t* next) {
+  #ifdef MI_ENCODE_FREELIST
+  const mi_page_t* const page = _mi_ptr_page(block);
+  mi_block_set_nextx(page, block, next, page->keys);
+  #else
+  mi_block_set_nextx(NULL, block, next, NULL);
+  #endif
+}
+
+#if (MI_ENCODE_FREELIST && (MI_SECURE>=4 || MI_DEBUG!=0))
+// Is the block already in the cache bin? (a double free of a cached block; the regular
+// check in `free.c:mi_check_is_double_free` only looks at the free lists of the page)
+static bool mi_cpu_cache_contains(const mi_cpu_cache_t* cache, size_t bin, const mi_block_t* block) {
+  for (const mi_block_t* b = cache->free[bin]; b != NULL; b = mi_cpu_cache_next(b)) {
+    if (b == block) {
+      _mi_error_message(EAGAIN, "double free detected of block %p with size %zu\n", block, mi_page_block_size(_mi_segment_page_of(_mi_ptr_segment(block), block)));
+      return true;
+    }
+  }
+  return false;
+}
+#else
+static bool mi_cpu_cache_contains(const mi_cpu_cache_t* cache, size_t bin, const mi_block_t* block) {
+  MI_UNUSED(cache); MI_UNUSED(bin); MI_UNUSED(block);
+  return false;
+}
+#endif
+
+
+/* -----------------------------------------------------------
+  Allocation and free
+----------------------------------------------------------- */
+
+// Allocate a block of `size` (including padding) from the cache of the current CPU;
+// returns NULL if the cache is empty (or in use).
+void* _mi_cpu_cache_malloc(mi_heap_t* heap, size_t size, bool zero) {
+  mi_assert_internal(_mi_cpu_cache_enabled);
+  // cached blocks can come from any backing heap, so we only serve allocations from a backing heap
+  if (!_mi_cpu_cache_heap_is_cacheable(heap)) return NULL;
+  mi_cpu_caches_t* const caches = mi_cpu_caches_get();
+  const size_t bin = _mi_bin(size);
+  if (caches == NULL || bin > caches->max_bin) return NULL;
+
+  mi_cpu_cache_t* const cache = mi_cpu_cache_try_acquire(caches);
+  if (cache == NULL) return NULL;
+  mi_block_t* const block = cache->free[bin];
+  if (block != NULL) {
+    cache->free[bin] = mi_cpu_cache_next(block);
+    cache->count[bin]--;
+  }
+  mi_cpu_cache_release(cache);
+  if (block == NULL) return NULL;
+
+  // initialize the block as in `_mi_page_malloc_zero`
+  const mi_page_t* const page = _mi_ptr_page(block);
+  mi_assert_internal(mi_page_block_size(page) >= size && _mi_bin(mi_page_block_size(page)) == bin);
+  if (zero) {
+    _mi_memzero_aligned(block, mi_page_usable_block_size(page));
+  }
+  #if (MI_DEBUG>0) && !MI_TSAN
+  else {
+    memset(block, MI_DEBUG_UNINIT, mi_page_usable_block_size(page));
+  }
+  #elif (MI_SECURE!=0)
+  else {
+    block->next = 0;  // don't leak internal data
+  }
+  #endif
+
+  #if MI_PADDING
+  mi_padding_t* const padding = (mi_padding_t*)((uint8_t*)block + mi_page_usable_block_size(page));
+  const ptrdiff_t delta = ((uint8_t*)padding - (uint8_t*)block - (size - MI_PADDING_SIZE));
+  mi_assert_internal(delta >= 0 && mi_page_usable_block_size(page) >= (size - MI_PADDING_SIZE + delta));
+  padding->canary = (uint32_t)(mi_ptr_encode(page,block,page->keys));
+  padding->delta  = (uint32_t)(delta);
+  #if MI_PADDING_CHECK
+  uint8_t* fill = (uint8_t*)padding - delta;
+  const size_t maxpad = (delta > MI_MAX_ALIGN_SIZE ? MI_MAX_ALIGN_SIZE : delta); // set at most N initial padding bytes
+  for (size_t i = 0; i < maxpad; i++) { fill[i] = MI_DEBUG_PADDING; }
+  #endif
+  #endif
+  return block;
+}
+
+// Try to keep a freed block in the cache of the current CPU; returns `false` if the
+// cache is full (or in use) in which case the block should be freed normally.
+bool _mi_cpu_cache_free(mi_page_t* page, mi_block_t* block) {
+  mi_assert_internal(_mi_ptr_page(block) == page);  // note: `page->cpu_cacheable` may have been reset concurrently if the page was just abandoned
+  mi_cpu_caches_t* const caches = mi_cpu_caches_get();
+  const size_t bin = _mi_bin(mi_page_block_size(page));
+  if (caches == NULL || bin > caches->max_bin) return false;
+
+  mi_cpu_cache_t* const cache = mi_cpu_cache_try_acquire(caches);
+  if (cache == NULL) return false;
+  if mi_unlikely(mi_cpu_cache_contains(cache, bin, block)) {
+    mi_cpu_cache_release(cache);
+    return true;  // ignore the double free
+  }
+  const bool cached = (cache->count[bin] < caches->max_count);
+  if (cached) {
+    #if (MI_DEBUG>0) && !MI_TSAN
+    memset(block, MI_DEBUG_FREED, mi_page_usable_block_size(page));
+    #if MI_PADDING
+    // as we overwrote the padding fill, mark the full block as used (for when the block is freed on a flush)
+    mi_padding_t* const padding = (mi_padding_t*)((uint8_t*)block + mi_page_usable_block_size(page));
+    padding->delta = 0;
+    #endif
+    #endif
+    mi_cpu_cache_set_next(block, cache->free[bin]);
+    cache->free[bin] = block;
+    cache->count[bin]++;
+  }
+  mi_cpu_cache_release(cache);
+  return cached;
+}
+
+
+/* -----------------------------------------------------------
+  Flushing
+----------------------------------------------------------- */
+
+// Free all cached blocks back to their pages (called on a forced collect).
+// Disables the caches if `mi_option_cpu_cache` was set to 0 in the mean time; a block that is
+// cached concurrently with disabling is freed at the next forced collect.
+void _mi_cpu_cache_flush(void) {
+  mi_cpu_caches_t* const caches = mi_cpu_caches_get();
+  if (caches == NULL) return;
+  if (_mi_cpu_cache_enabled && mi_option_get(mi_option_cpu_cache) <= 0) {
+    _mi_cpu_cache_enabled = false;
+    _mi_verbose_message("per-CPU caches disabled\n");
+  }
+  for (size_t i = 0; i < caches->count; i++) {
+    mi_cpu_cache_t* const cache = mi_cpu_cache_at(caches, i);
+    mi_block_t* blocks[MI_CPU_CACHE_BINS];
+    mi_cpu_cache_acquire(cache);
+    for (size_t bin = 0; bin < MI_CPU_CACHE_BINS; bin++) {
+      blocks[bin] = cache->free[bin];
+      cache->free[bin] = NULL;
+      cache->count[bin] = 0;
+    }
+    mi_cpu_cache_release(cache);
+    // and free them outside the lock
+    for (size_t bin = 0; bin < MI_CPU_CACHE_BINS; bin++) {
+      mi_block_t* block = blocks[bin];
+      while (block != NULL) {
+        mi_block_t* const next = mi_cpu_cache_next(block);
+        _mi_free_uncached(block);
+        block = next;
+      }
+    }
+  }
+}
+
+// Remove all cached blocks that belong to pages of `heap` (called when the heap pages are destroyed)
+void _mi_cpu_cache_drop_heap(mi_heap_t* heap) {
+  mi_cpu_caches_t* const caches = mi_cpu_caches_get();
+  if (caches == NULL) return;
+  for (size_t i = 0; i < caches->count; i++) {
+    mi_cpu_cache_t* const cache = mi_cpu_cache_at(caches, i);
+    mi_cpu_cache_acquire(cache);
+    for (size_t bin = 0; bin < MI_CPU_CACHE_BINS; bin++) {
+      mi_block_t* prev = NULL;
+      mi_block_t* block = cache->free[bin];
+      while (block != NULL) {
+        mi_block_t* const next = mi_cpu_cache_next(block);
+        if (mi_page_heap(_mi_ptr_page(block)) == heap) {
+          if (prev == NULL) { cache->free[bin] = next; }
+                       else { mi_cpu_cache_set_next(prev, next); }
+          cache->count[bin]--;
+        }
+        else {
+          prev = block;
+        }
+        block = next;
+      }
+    }
+    mi_cpu_cache_release(cache);
+  }
+}
@@ -34,6 +34,12 @@ static inline void mi_free_block_local(mi_page_t* page, mi_block_t* block, bool
   if mi_unlikely(mi_check_is_double_free(page, block)) return;
   mi_check_padding(page, block);
   if (track_stats) { mi_stat_free(page, block); }
+  #if MI_STAT_COUNTERS
+  if (track_stats) {
+    mi_thread_counters_t* const counters = &mi_page_heap(page)->tld->counters;
+    mi_stat_counters_add(&counters->free_count, counters->free_samples, page, 1);
+  }
+  #endif
   #if (MI_DEBUG>0) && !MI_TRACK_ENABLED  && !MI_TSAN
   memset(block, MI_DEBUG_FREED, mi_page_block_size(page));
   #endif
@@ -73,12 +79,14 @@ mi_block_t* _mi_page_ptr_unalign(const mi_page_t* page, const void* p) {
 static void mi_decl_noinline mi_free_generic_local(mi_page_t* page, mi_segment_t* segment, void* p) mi_attr_noexcept {
   MI_UNUSED(segment);
   mi_block_t* const block = (mi_page_has_aligned(page) ? _mi_page_ptr_unalign(page, p) : (mi_block_t*)p);
+  if mi_unlikely(mi_page_has_sampled(page)) { _mi_heap_profile_free(page, block); }
   mi_free_block_local(page, block, true /* track stats */, true /* check for a full page */);
 }
 
 // free a pointer owned by another thread (page parameter comes first for better codegen)
 static void mi_decl_noinline mi_free_generic_mt(mi_page_t* page, mi_segment_t* segment, void* p) mi_attr_noexcept {
   mi_block_t* const block = _mi_page_ptr_unalign(page, p); // don't check `has_aligned` flag to avoid a race (issue #865)
+  if mi_unlikely(mi_page_has_sampled(page)) { _mi_heap_profile_free(page, block); }
   mi_free_block_mt(page, segment, block);
 }
 
@@ -124,16 +132,10 @@ static inline mi_segment_t* mi_checked_ptr_segment(const void* p, const char* ms
   return segment;
 }
 
-// Free a block
-// Fast path written carefully to prevent register spilling on the stack
-void mi_free(void* p) mi_attr_noexcept
+// Free a block (bypassing the per-CPU caches)
+static inline void mi_free_ex(mi_segment_t* segment, mi_page_t* page, void* p) mi_attr_noexcept
 {
-  mi_segment_t* const segment = mi_checked_ptr_segment(p,"mi_free");
-  if mi_unlikely(segment==NULL) return;
-
   const bool is_local = (_mi_prim_thread_id() == mi_atomic_load_relaxed(&segment->thread_id));
-  mi_page_t* const page = _mi_segment_page_of(segment, p);
-
   if mi_likely(is_local) {                        // thread-local free?
     if mi_likely(page->flags.full_aligned == 0) { // and it is not a full page (full pages need to move from the full bin), nor has aligned blocks (aligned blocks need to be unaligned)
       // thread-local, aligned, and not a full page
@@ -151,6 +153,97 @@ void mi_free(void* p) mi_attr_noexcept
   }
 }
 
+// Try to keep a freed block in the cache of the current CPU (see `cpu-cache.c`)
+static mi_decl_noinline bool mi_free_cpu_cache(mi_page_t* page, void* p) mi_attr_noexcept
+{
+  if (page->flags.x.has_aligned || page->flags.x.has_sampled) return false;  // needs the generic path
+  mi_block_t* const block = (mi_block_t*)p;
+  if mi_unlikely(mi_check_is_double_free(page, block)) return true;
+  mi_check_padding(page, block);
+  return _mi_cpu_cache_free(page, block);
+}
+
+// Free a block
+// Fast path written carefully to prevent register spilling on the stack
+void mi_free(void* p) mi_attr_noexcept
+{
+  mi_segment_t* const segment = mi_checked_ptr_segment(p,"mi_free");
+  if mi_unlikely(segment==NULL) return;
+
+  mi_page_t* const page = _mi_segment_page_of(segment, p);
+  if mi_unlikely(_mi_cpu_cache_enabled && page->cpu_cacheable) {
+    if (mi_free_cpu_cache(page, p)) return;
+  }
+  mi_free_ex(segment, page, p);
+}
+
+// Free a block that was kept in a per-CPU cache
+void _mi_free_uncached(void* p) mi_attr_noexcept
+{
+  mi_segment_t* const segment = _mi_ptr_segment(p);
+  mi_page_t* const page = _mi_segment_page_of(segment, p);
+  mi_free_ex(segment, page, p);
+}
+
+// Free a run of thread-local blocks that all belong to `page` (which is not full and has no aligned blocks).
+// The blocks are pushed on the local free list one by one, but the `used` count is updated only once.
+static void mi_free_blocks_local(mi_page_t* page, void** blocks, size_t count)
+{
+  mi_assert_internal(page->flags.full_aligned == 0);
+  size_t freed = 0;
+  for (size_t i = 0; i < count; i++) {
+    mi_block_t* const block = (mi_block_t*)blocks[i];
+    mi_assert_internal(_mi_ptr_page(block) == page);
+    if mi_unlikely(mi_check_is_double_free(page, block)) continue;
+    mi_check_padding(page, block);
+    mi_stat_free(page, block);
+    #if (MI_DEBUG>0) && !MI_TRACK_ENABLED  && !MI_TSAN
+    memset(block, MI_DEBUG_FREED, mi_page_block_size(page));
+    #endif
+    mi_track_free_size(block, mi_page_usable_size_of(page, block));
+    mi_block_set_next(page, block, page->local_free);
+    page->local_free = block;
+    freed++;
+  }
+  mi_assert_internal(page->used >= freed);
+  #if MI_STAT_COUNTERS
+  if (freed > 0) {
+    mi_thread_counters_t* const counters = &mi_page_heap(page)->tld->counters;
+    mi_stat_counters_add(&counters->free_count, counters->free_samples, page, freed);
+  }
+  #endif
+  page->used -= (uint16_t)freed;
+  if mi_unlikely(page->used == 0) {
+    _mi_page_retire(page);
+  }
+}
+
+// Free an array of blocks. Consecutive blocks in the same thread-local page are
+// freed as a group; all other blocks go through the regular `mi_free`.
+void mi_free_batch(void** blocks, size_t count) mi_attr_noexcept
+{
+  if (blocks == NULL) return;
+  const mi_threadid_t tid = _mi_prim_thread_id();
+  size_t i = 0;
+  while (i < count) {
+    void* const p = blocks[i];
+    mi_segment_t* const segment = mi_checked_ptr_segment(p, "mi_free_batch");
+    if mi_unlikely(segment == NULL) { i++; continue; }
+    mi_page_t* const page = _mi_segment_page_of(segment, p);
+    if (tid != mi_atomic_load_relaxed(&segment->thread_id) || page->flags.full_aligned != 0) {
+      // not thread-local, full, or with aligned blocks; use the regular path
+      mi_free(p);
+      i++;
+      continue;
+    }
+    // extend the run as long as the blocks are in the same page
+    size_t n = 1;
+    while (i + n < count && blocks[i+n] != NULL && _mi_ptr_page(blocks[i+n]) == page) { n++; }
+    mi_free_blocks_local(page, &blocks[i], n);
+    i += n;
+  }
+}
+
 // return true if successful
 bool _mi_free_delayed_block(mi_block_t* block) {
   // get segment and page
@@ -227,9 +320,91 @@ static void mi_decl_noinline mi_free_block_delayed_mt( mi_page_t* page, mi_block
   }
 }
 
+// ------------------------------------------------------
+// Remote free magazine
+// If enabled (`mi_option_remote_free_batch` > 1), blocks freed in pages that are
+// owned by another thread are collected per page in a small thread local cache
+// of chains. A chain is spliced into the `xthread_free` list of its page with a
+// single CAS once it reaches the threshold, when its slot is needed for another
+// page, or when the thread collects or terminates.
+// Pending blocks are still counted as used by the owning page which keeps the
+// page alive until the chain is published. The exception is `mi_heap_destroy`
+// that frees pages with blocks still in use; therefore we only collect blocks
+// of pages in heaps that cannot be destroyed (`page->remote_batchable`).
+// ------------------------------------------------------
+
+// Push a chain of blocks (`first` to `last`) on the thread free list of `page`.
+static void mi_free_chain_delayed_mt(mi_page_t* page, mi_block_t* first, mi_block_t* last)
+{
+  mi_thread_free_t tfreex;
+  mi_thread_free_t tfree = mi_atomic_load_relaxed(&page->xthread_free);
+  do {
+    if mi_unlikely(mi_tf_delayed(tfree) == MI_USE_DELAYED_FREE) {
+      // unlikely: the page is in the full list; push the blocks one by one
+      // so the first one is put on the heap delayed free list
+      mi_block_t* block = first;
+      while (block != NULL) {
+        mi_block_t* const next = (block == last ? NULL : mi_block_next(page, block));
+        mi_free_block_delayed_mt(page, block);
+        block = next;
+      }
+      return;
+    }
+    mi_block_set_next(page, last, mi_tf_block(tfree));
+    tfreex = mi_tf_set_block(tfree, first);
+  } while (!mi_atomic_cas_weak_release(&page->xthread_free, &tfree, tfreex));
+}
+
+static void mi_remote_free_flush_slot(mi_remote_free_t* slot) {
+  if (slot->page == NULL) return;
+  mi_free_chain_delayed_mt(slot->page, slot->first, slot->last);
+  slot->page  = NULL;
+  slot->first = NULL;
+  slot->last  = NULL;
+  slot->count = 0;
+}
+
+// Publish all pending blocks in the remote free magazine of a thread.
+void _mi_free_remote_flush(mi_tld_t* tld) {
+  if (tld == NULL) return;
+  for (size_t i = 0; i < MI_REMOTE_FREE_SLOTS; i++) {
+    mi_remote_free_flush_slot(&tld->remote_free[i]);
+  }
+}
+
+// Add a non-local block to the remote free magazine; returns `false` if the magazine is disabled.
+static bool mi_remote_free_push(mi_page_t* page, mi_block_t* block) {
+  const long max_count = mi_option_get_clamp(mi_option_remote_free_batch, 0, 4096);
+  if mi_likely(max_count <= 1) return false;
+  if (!page->remote_batchable) return false;  // the owning heap may be destroyed while the block is pending
+  mi_heap_t* const heap = mi_prim_get_default_heap();
+  if (!mi_heap_is_initialized(heap)) return false;
+  mi_tld_t* const tld = heap->tld;
+  const size_t idx = ((uintptr_t)page->segment_idx ^ ((uintptr_t)page >> MI_SEGMENT_SHIFT)) % MI_REMOTE_FREE_SLOTS;
+  mi_remote_free_t* const slot = &tld->remote_free[idx];
+  if (slot->page != page) {
+    mi_remote_free_flush_slot(slot);
+    slot->page = page;
+    slot->last = block;
+  }
+  mi_block_set_next(page, block, slot->first);
+  slot->first = block;
+  slot->count++;
+  if (slot->count >= (size_t)max_count) {
+    mi_remote_free_flush_slot(slot);
+  }
+  return true;
+}
+
 // Multi-threaded free (`_mt`) (or free in huge block if compiled with MI_HUGE_PAGE_ABANDON)
 static void mi_decl_noinline mi_free_block_mt(mi_page_t* page, mi_segment_t* segment, mi_block_t* block)
 {
+  #if MI_STAT_COUNTERS
+  mi_heap_t* const cheap = mi_prim_get_default_heap();
+  if (mi_heap_is_initialized(cheap)) {
+    mi_atomic_store_relaxed(&cheap->tld->counters.free_mt_count, mi_atomic_load_relaxed(&cheap->tld->counters.free_mt_count) + 1);
+  }
+  #endif
   // first see if the segment was abandoned and if we can reclaim it into our thread
   if (mi_option_is_enabled(mi_option_abandoned_reclaim_on_free) &&
       #if MI_HUGE_PAGE_ABANDON
@@ -277,6 +452,7 @@ static void mi_decl_noinline mi_free_block_mt(mi_page_t* page, mi_segment_t* seg
 
   // and finally free the actual block by pushing it on the owning heap
   // thread_delayed free list (or heap delayed free list)
+  if (segment->page_kind != MI_PAGE_HUGE && mi_remote_free_push(page, block)) return;  // or collect it in the remote free magazine
   mi_free_block_delayed_mt(page,block);
 }
 
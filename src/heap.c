@@ -123,6 +123,16 @@ static void mi_heap_collect_ex(mi_heap_t* heap, mi_collect_t collect)
   const bool force = (collect >= MI_FORCE);
   _mi_deferred_free(heap, force);
 
+  // return the blocks in the per-CPU caches to their pages
+  if (collect == MI_FORCE) {
+    _mi_cpu_cache_flush();  // also if the caches were disabled in the mean time
+  }
+
+  // publish pending frees of this thread into pages of other threads
+  if (heap->thread_id == _mi_thread_id()) {
+    _mi_free_remote_flush(heap->tld);
+  }
+
   // python/cpython#112532: we may be called from a thread that is not the owner of the heap
   const bool is_main_thread = (_mi_is_main_thread() && heap->thread_id == _mi_thread_id());
 
@@ -207,6 +217,7 @@ mi_heap_t* mi_heap_get_backing(void) {
 
 void _mi_heap_init(mi_heap_t* heap, mi_tld_t* tld, mi_arena_id_t arena_id, bool noreclaim, uint8_t tag) {
   _mi_memcpy_aligned(heap, &_mi_heap_empty, sizeof(mi_heap_t));
+  _mi_page_queues_init(heap->pages);
   heap->tld = tld;
   heap->thread_id  = _mi_thread_id();
   heap->arena_id   = arena_id;
@@ -226,15 +237,21 @@ void _mi_heap_init(mi_heap_t* heap, mi_tld_t* tld, mi_arena_id_t arena_id, bool
   heap->tld->heaps = heap;
 }
 
-mi_decl_nodiscard mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id) {
+mi_decl_nodiscard mi_heap_t* mi_heap_new_numa(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id, int numa_node) {
   mi_heap_t* bheap = mi_heap_get_backing();
   mi_heap_t* heap = mi_heap_malloc_tp(bheap, mi_heap_t);  // todo: OS allocate in secure mode?
   if (heap == NULL) return NULL;
   mi_assert(heap_tag >= 0 && heap_tag < 256);
   _mi_heap_init(heap, bheap->tld, arena_id, allow_destroy /* no reclaim? */, (uint8_t)heap_tag /* heap tag */);
+  // a node outside the available range means no preference (use the node of the current thread)
+  heap->numa_node = (numa_node >= 0 && (size_t)numa_node < _mi_os_numa_node_count() ? numa_node : -1);
   return heap;
 }
 
+mi_decl_nodiscard mi_heap_t* mi_heap_new_ex(int heap_tag, bool allow_destroy, mi_arena_id_t arena_id) {
+  return mi_heap_new_numa(heap_tag, allow_destroy, arena_id, -1 /* current numa node */);
+}
+
 mi_decl_nodiscard mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id) {
   return mi_heap_new_ex(0 /* default heap tag */, false /* don't allow `mi_heap_destroy` */, arena_id);
 }
@@ -259,6 +276,7 @@ static void mi_heap_reset_pages(mi_heap_t* heap) {
   // TODO: copy full empty heap instead?
   memset(&heap->pages_free_direct, 0, sizeof(heap->pages_free_direct));
   _mi_memcpy_aligned(&heap->pages, &_mi_heap_empty.pages, sizeof(heap->pages));
+  _mi_page_queues_init(heap->pages);
   heap->thread_delayed_free = NULL;
   heap->page_count = 0;
 }
@@ -351,6 +369,7 @@ static bool _mi_heap_page_destroy(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_
 }
 
 void _mi_heap_destroy_pages(mi_heap_t* heap) {
+  _mi_cpu_cache_drop_heap(heap);  // (also if the caches were disabled in the mean time)
   mi_heap_visit_pages(heap, &_mi_heap_page_destroy, NULL, NULL);
   mi_heap_reset_pages(heap);
 }
@@ -469,6 +488,84 @@ mi_heap_t* mi_heap_set_default(mi_heap_t* heap) {
 }
 
 
+/* -----------------------------------------------------------
+  Hand off the backing heap of a terminating thread to a
+  successor thread (see `init.c:mi_thread_done_handoff`)
+----------------------------------------------------------- */
+
+static bool mi_heap_page_set_segment_owner(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_t* page, void* arg1, void* arg2) {
+  MI_UNUSED(heap); MI_UNUSED(pq); MI_UNUSED(arg2);
+  const mi_threadid_t tid = *((const mi_threadid_t*)arg1);
+  mi_segment_t* const segment = _mi_page_segment(page);
+  if (segment != NULL) { mi_atomic_store_release(&segment->thread_id, tid); }
+  return true;
+}
+
+// set the owning thread of the heap and of all its segments.
+// note: every segment of a thread has at least one page in use in one of its heaps.
+static void mi_heap_set_owner(mi_heap_t* heap, mi_threadid_t tid) {
+  mi_heap_visit_pages(heap, &mi_heap_page_set_segment_owner, &tid, NULL);
+  heap->thread_id = tid;
+}
+
+// Release the backing heap of the current thread (and its segments) from the thread.
+// Segments without owner are freed into as if owned by another thread, but unlike abandoned
+// segments they are not marked in the arena abandoned bitmap (or the OS abandoned list)
+// so they cannot be reclaimed by other threads.
+void _mi_heap_handoff(mi_heap_t* heap) {
+  mi_assert_internal(mi_heap_is_backing(heap));
+  mi_assert_internal(heap->thread_id == _mi_thread_id());
+
+  // delete all non-backing heaps in this thread (which transfers their pages to the backing heap)
+  mi_heap_t* curr = heap->tld->heaps;
+  while (curr != NULL) {
+    mi_heap_t* next = curr->next; // save `next` as `curr` will be freed
+    if (curr != heap) {
+      mi_assert_internal(!mi_heap_is_backing(curr));
+      mi_heap_delete(curr);
+    }
+    curr = next;
+  }
+  mi_assert_internal(heap->tld->heaps == heap && heap->next == NULL);
+
+  // publish our remote frees, free the delayed frees, and free retired pages
+  // (but keep the pending purges of the segments for the adopting thread)
+  _mi_deferred_free(heap, false);
+  _mi_free_remote_flush(heap->tld);
+  _mi_heap_delayed_free_all(heap);
+  _mi_heap_collect_retired(heap, false);
+  mi_heap_set_owner(heap, 0);
+}
+
+// Abandon a handed off heap (and its segments) from the current thread, just like
+// a terminating thread abandons its heap, so other threads can reclaim its segments.
+void _mi_heap_handoff_abandon(mi_heap_t* from) {
+  mi_assert_internal(mi_heap_is_backing(from));
+  mi_assert_internal(from->thread_id == 0);
+  mi_heap_set_owner(from, _mi_thread_id());
+  _mi_heap_collect_abandon(from);
+}
+
+// Adopt a handed off heap into the (backing) `heap` of the current thread;
+// returns `false` if it was abandoned instead as it belongs to another sub-process.
+bool _mi_heap_adopt(mi_heap_t* heap, mi_heap_t* from) {
+  mi_assert_internal(mi_heap_is_backing(heap) && mi_heap_is_backing(from));
+  mi_assert_internal(heap->thread_id == _mi_thread_id());
+  mi_assert_internal(from->thread_id == 0);
+  if (from->tld->segments.subproc != heap->tld->segments.subproc) {
+    _mi_heap_handoff_abandon(from);
+    return false;
+  }
+  mi_heap_set_owner(from, heap->thread_id);
+  // transfer the segments, and then the pages; pages that are freed while absorbing
+  // (due to delayed frees) must use our segments as well so we also switch the `tld`
+  _mi_segments_absorb(&heap->tld->segments, &from->tld->segments);
+  from->tld = heap->tld;
+  mi_heap_absorb(heap, from);
+  return true;
+}
+
+
 
 
 /* -----------------------------------------------------------
@@ -515,6 +612,53 @@ bool mi_check_owned(const void* p) {
   return mi_heap_check_owned(mi_prim_get_default_heap(), p);
 }
 
+/* -----------------------------------------------------------
+  Defragmentation hints
+----------------------------------------------------------- */
+
+// Return the segment of `p` if it points into memory managed by mimalloc (and NULL otherwise).
+// Like `free.c:mi_checked_ptr_segment` but always checked as these functions may be called with any pointer.
+static const mi_segment_t* mi_defrag_checked_segment(const void* p) {
+  if (p == NULL || !mi_is_in_heap_region(p)) return NULL;
+  const mi_segment_t* const segment = _mi_ptr_segment(p);
+  if mi_unlikely(segment == NULL || _mi_ptr_cookie(segment) != segment->cookie) return NULL;
+  return segment;
+}
+
+bool mi_page_utilization(const void* p, size_t* used, size_t* total) mi_attr_noexcept {
+  const mi_segment_t* const segment = mi_defrag_checked_segment(p);
+  if (segment == NULL) return false;
+  const mi_page_t* const page = _mi_segment_page_of(segment, p);
+  if (used != NULL)  { *used = page->used; }    // note: does not include blocks freed by other threads that are not yet collected
+  if (total != NULL) { *total = page->reserved; }
+  return true;
+}
+
+// Is `p` in a page of `heap` that is less utilized than the pages from which blocks of the same size are allocated?
+// In that case, moving `p` (with `mi_heap_defrag_realloc`) helps the page to drain so it can be freed.
+// Like `page.c:mi_page_queue_find_free_ex` we look at the first few pages in the queue that have free blocks.
+bool mi_heap_defrag_hint(mi_heap_t* heap, const void* p) mi_attr_noexcept {
+  if (heap==NULL || !mi_heap_is_initialized(heap)) return false;
+  if (mi_defrag_checked_segment(p) == NULL || mi_heap_of_block(p) != heap) return false;
+  const mi_page_t* const page = _mi_segment_page_of(_mi_ptr_segment(p), p);
+  if (page->reserved <= 1 || mi_page_is_in_full(page)) return false;  // huge blocks or full pages
+  const size_t candidate_max = (size_t)mi_option_get_clamp(mi_option_page_max_candidates, 1, 1024);
+  size_t candidate_count = 0;
+  for (const mi_page_t* target = mi_page_queue(heap, mi_page_block_size(page))->first; target != NULL && candidate_count < candidate_max; target = target->next) {
+    if (target == page || target->used >= target->reserved) continue;
+    if (page->used * target->reserved < target->used * page->reserved) return true;  // a denser page has room
+    candidate_count++;
+  }
+  return false;  // otherwise we may end up allocating a fresh page
+}
+
+bool mi_defrag_hint(const void* p) mi_attr_noexcept {
+  if (mi_defrag_checked_segment(p) == NULL) return false;
+  mi_heap_t* const heap = mi_heap_of_block(p);
+  if (heap == NULL || heap->thread_id != _mi_thread_id()) return false;
+  return mi_heap_defrag_hint(heap, p);
+}
+
 /* -----------------------------------------------------------
   Visit all heap blocks and areas
   Todo: enable visiting abandoned pages, and
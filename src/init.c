@@ -15,7 +15,7 @@ terms of the MIT license. A copy of the license can be found in the file
 // Empty page used to initialize the small free pages array
 const mi_page_t _mi_page_empty = {
   0,
-  false, false, false, false,
+  false, false, false, false, false, false,
   0,       // capacity
   0,       // reserved capacity
   { 0 },   // flags
@@ -50,7 +50,8 @@ const mi_page_t _mi_page_empty = {
 #endif
 
 
-// Empty page queues for every bin
+// Empty page queues for every standard bin
+// (with extra size classes the queues are initialized at runtime, see `page-queue.c:_mi_page_queues_init`)
 #define QNULL(sz)  { NULL, NULL, (sz)*sizeof(uintptr_t) }
 #define MI_PAGE_QUEUES_EMPTY \
   { QNULL(1), \
@@ -69,13 +70,10 @@ const mi_page_t _mi_page_empty = {
 #define MI_STAT_COUNT_NULL()  {0,0,0,0}
 
 // Empty statistics
-#if MI_STAT>1
 #define MI_STAT_COUNT_END_NULL()  , { MI_STAT_COUNT_NULL(), MI_INIT32(MI_STAT_COUNT_NULL) }
-#else
-#define MI_STAT_COUNT_END_NULL()
-#endif
 
 #define MI_STATS_NULL  \
+  MI_STAT_VERSION, \
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
@@ -86,8 +84,11 @@ const mi_page_t _mi_page_empty = {
   MI_STAT_COUNT_NULL(), \
   { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, \
   { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, \
-  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } \
-  MI_STAT_COUNT_END_NULL()
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, \
+  { 0, 0 }, { 0, 0 } \
+  MI_STAT_COUNT_END_NULL(), \
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, \
+  { { 0, 0 } }, { 0, 0 }, { 0, 0 }
 
 // --------------------------------------------------------
 // Statically allocate an empty heap as the initial
@@ -102,8 +103,9 @@ mi_decl_cache_align const mi_heap_t _mi_heap_empty = {
   NULL,
   MI_ATOMIC_VAR_INIT(NULL),
   0,                // tid
-  0,                // cookie
   0,                // arena id
+  -1,               // numa node
+  0,                // cookie
   { 0, 0 },         // keys
   { {0}, {0}, 0, true }, // random
   0,                // page count
@@ -112,7 +114,9 @@ mi_decl_cache_align const mi_heap_t _mi_heap_empty = {
   false,            // can reclaim
   0,                // tag
   MI_SMALL_PAGES_EMPTY,
-  MI_PAGE_QUEUES_EMPTY
+  MI_PAGE_QUEUES_EMPTY,
+  { 0 },            // retire cycles
+  { 0 }             // retire freed beat
 };
 
 
@@ -130,20 +134,26 @@ static mi_decl_cache_align mi_subproc_t mi_subproc_default;
 static mi_decl_cache_align mi_tld_t tld_main = {
   0, false,
   &_mi_heap_main, &_mi_heap_main,
-  { { NULL, NULL }, {NULL ,NULL}, {NULL ,NULL, 0},
-    0, 0, 0, 0, 0, &mi_subproc_default,
+  { { { NULL, NULL } }, { {NULL ,NULL} }, {NULL ,NULL, 0},
+    0, 0, 0, 0, 0, false, 0, { 0 }, &mi_subproc_default,
     &tld_main.stats, &tld_main.os
   }, // segments
   { 0, &tld_main.stats },  // os
-  { MI_STATS_NULL }       // stats
+  { MI_STATS_NULL },      // stats
+  { { NULL, NULL, NULL, 0 } }, // remote free magazine
+  0, false                     // heap profile
+  #if MI_STAT_COUNTERS
+  , { 0, 0, 0, 0, { 0 }, { 0 }, NULL, NULL }  // counters
+  #endif
 };
 
 mi_decl_cache_align mi_heap_t _mi_heap_main = {
   &tld_main,
   MI_ATOMIC_VAR_INIT(NULL),
   0,                // thread id
-  0,                // initial cookie
   0,                // arena id
+  -1,               // numa node
+  0,                // initial cookie
   { 0, 0 },         // the key of the main heap can be fixed (unlike page keys that need to be secure!)
   { {0x846ca68b}, {0}, 0, true },  // random
   0,                // page count
@@ -152,7 +162,9 @@ mi_decl_cache_align mi_heap_t _mi_heap_main = {
   false,            // can reclaim
   0,                // tag
   MI_SMALL_PAGES_EMPTY,
-  MI_PAGE_QUEUES_EMPTY
+  MI_PAGE_QUEUES_EMPTY,
+  { 0 },            // retire cycles
+  { 0 }             // retire freed beat
 };
 
 bool _mi_process_is_initialized = false;  // set to `true` in `mi_process_init`.
@@ -172,8 +184,11 @@ static void mi_heap_main_init(void) {
     _mi_heap_main.cookie  = _mi_heap_random_next(&_mi_heap_main);
     _mi_heap_main.keys[0] = _mi_heap_random_next(&_mi_heap_main);
     _mi_heap_main.keys[1] = _mi_heap_random_next(&_mi_heap_main);
+    _mi_page_queues_init(_mi_heap_main.pages);
     mi_lock_init(&mi_subproc_default.abandoned_os_lock);
     mi_lock_init(&mi_subproc_default.abandoned_os_visit_lock);
+    _mi_stat_counters_init(&tld_main);
+    _mi_heap_profile_init();
   }
 }
 
@@ -243,6 +258,7 @@ void mi_subproc_add_current_thread(mi_subproc_id_t subproc_id) {
 typedef struct mi_thread_data_s {
   mi_heap_t  heap;   // must come first due to cast in `_mi_heap_done`
   mi_tld_t   tld;
+  _Atomic(struct mi_thread_data_s*) pool_next;  // next entry in the thread data pool (not zero'd)
   mi_memid_t memid;  // must come last due to zero'ing
 } mi_thread_data_t;
 
@@ -250,23 +266,98 @@ typedef struct mi_thread_data_s {
 // Thread meta-data is allocated directly from the OS. For
 // some programs that do not use thread pools and allocate and
 // destroy many OS threads, this may causes too much overhead
-// per thread so we maintain a small cache of recently freed metadata.
+// per thread so we maintain a pool of recently freed metadata
+// of at most `mi_option_thread_data_pool` entries.
+//
+// The pool is a lock-free (Treiber) stack. Thread metadata is OS page
+// aligned so we use the low bits of the top pointer as a tag that
+// is incremented on every update to avoid the ABA problem.
+// A pop reads the `pool_next` field of the top entry which may
+// concurrently be popped by another thread and be freed; the
+// `td_pool_readers` count ensures we only free thread metadata
+// to the OS when no pop is in progress.
+
+#define MI_TD_TAG_MASK  ((uintptr_t)0xFFF)  // at least 4KiB OS page alignment
+
+static mi_decl_cache_align _Atomic(uintptr_t) td_pool;  // tagged pointer to the top of the stack
+static _Atomic(size_t) td_pool_count;
+static _Atomic(size_t) td_pool_readers;
+
+static mi_thread_data_t* mi_td_tagged_ptr(uintptr_t ts) {
+  return (mi_thread_data_t*)(ts & ~MI_TD_TAG_MASK);
+}
+
+static uintptr_t mi_td_tagged(mi_thread_data_t* td, uintptr_t ts) {
+  mi_assert_internal(((uintptr_t)td & MI_TD_TAG_MASK) == 0);
+  const uintptr_t tag = ((ts & MI_TD_TAG_MASK) + 1) & MI_TD_TAG_MASK;
+  return ((uintptr_t)td | tag);
+}
+
+static mi_thread_data_t* mi_thread_data_pool_pop(void) {
+  if (mi_td_tagged_ptr(mi_atomic_load_relaxed(&td_pool)) == NULL) return NULL;
+  mi_atomic_increment_acq_rel(&td_pool_readers);
+  uintptr_t ts = mi_atomic_load_acquire(&td_pool);
+  mi_thread_data_t* td;
+  uintptr_t tsnext = 0;
+  do {
+    td = mi_td_tagged_ptr(ts);
+    if (td == NULL) break;
+    mi_thread_data_t* const next = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td->pool_next);
+    tsnext = mi_td_tagged(next, ts);
+  } while (!mi_atomic_cas_weak_acq_rel(&td_pool, &ts, tsnext));
+  mi_atomic_decrement_acq_rel(&td_pool_readers);
+  if (td != NULL) { mi_atomic_decrement_relaxed(&td_pool_count); }
+  return td;
+}
 
-#define TD_CACHE_SIZE (32)
-static _Atomic(mi_thread_data_t*) td_cache[TD_CACHE_SIZE];
+static bool mi_thread_data_pool_push(mi_thread_data_t* td, bool force) {
+  if (((uintptr_t)td & MI_TD_TAG_MASK) != 0) return false;  // cannot be tagged
+  const size_t max = (size_t)mi_option_get_clamp(mi_option_thread_data_pool, 0, 1024*1024);
+  if (mi_atomic_increment_relaxed(&td_pool_count) >= max && !force) {
+    mi_atomic_decrement_relaxed(&td_pool_count);
+    return false;  // the pool is full
+  }
+  uintptr_t ts = mi_atomic_load_relaxed(&td_pool);
+  uintptr_t tsnew;
+  do {
+    mi_atomic_store_ptr_relaxed(mi_thread_data_t, &td->pool_next, mi_td_tagged_ptr(ts));
+    tsnew = mi_td_tagged(td, ts);
+  } while (!mi_atomic_cas_weak_release(&td_pool, &ts, tsnew));
+  return true;
+}
 
-static mi_thread_data_t* mi_thread_data_zalloc(void) {
-  // try to find thread metadata in the cache
+#define MI_TD_FREE_SPIN_MAX  (1000)
+
+// Free thread metadata to the OS. This waits until no pop can still read the `pool_next`
+// field of `td`; if a pop takes too long (as its thread was preempted for example) we
+// keep `td` in the pool instead (even if it is full) and return `false`.
+static bool mi_thread_data_os_free(mi_thread_data_t* td) {
+  for (size_t i = 0; mi_atomic_load_acquire(&td_pool_readers) != 0; i++) {
+    if (i >= MI_TD_FREE_SPIN_MAX) {
+      mi_thread_data_pool_push(td, true /* even if full */);
+      return false;
+    }
+    mi_atomic_yield();
+  }
+  _mi_os_free(td, sizeof(mi_thread_data_t), td->memid, &_mi_stats_main);
+  return true;
+}
+
+// allocate zero'd thread metadata; if it is reused from the pool, `warm_hints` receives
+// the hints of the segments that were abandoned by its previous owner.
+static mi_thread_data_t* mi_thread_data_zalloc(size_t* warm_hints, size_t* warm_count) {
+  *warm_count = 0;
+  // try to reuse thread metadata from the pool
   bool is_zero = false;
-  mi_thread_data_t* td = NULL;
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td != NULL) {
-      // found cached allocation, try use it
-      td = mi_atomic_exchange_ptr_acq_rel(mi_thread_data_t, &td_cache[i], NULL);
-      if (td != NULL) {
-        break;
-      }
+  mi_thread_data_t* td = mi_thread_data_pool_pop();
+  if (td != NULL) {
+    // reclaim at most N segments on a warm start (as this delays the start of the thread),
+    // starting with the most recently abandoned one (which is the most likely to still be warm)
+    const mi_segments_tld_t* const segments = &td->tld.segments;
+    const size_t max = (size_t)mi_option_get_clamp(mi_option_thread_warm_start, 0, MI_WARM_SEGMENTS);
+    *warm_count = (segments->warm_count < max ? segments->warm_count : max);
+    for (size_t i = 0; i < *warm_count; i++) {
+      warm_hints[i] = segments->warm_hints[(segments->warm_count - 1 - i) % MI_WARM_SEGMENTS];
     }
   }
 
@@ -289,36 +380,23 @@ static mi_thread_data_t* mi_thread_data_zalloc(void) {
   }
 
   if (td != NULL && !is_zero) {
-    _mi_memzero_aligned(td, offsetof(mi_thread_data_t,memid));
+    _mi_memzero_aligned(td, offsetof(mi_thread_data_t,pool_next));
   }
   return td;
 }
 
 static void mi_thread_data_free( mi_thread_data_t* tdfree ) {
-  // try to add the thread metadata to the cache
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    mi_thread_data_t* td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td == NULL) {
-      mi_thread_data_t* expected = NULL;
-      if (mi_atomic_cas_ptr_weak_acq_rel(mi_thread_data_t, &td_cache[i], &expected, tdfree)) {
-        return;
-      }
-    }
-  }
+  // try to add the thread metadata to the pool
+  if (mi_thread_data_pool_push(tdfree, false)) return;
   // if that fails, just free it directly
-  _mi_os_free(tdfree, sizeof(mi_thread_data_t), tdfree->memid, &_mi_stats_main);
+  mi_thread_data_os_free(tdfree);
 }
 
 void _mi_thread_data_collect(void) {
-  // free all thread metadata from the cache
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    mi_thread_data_t* td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td != NULL) {
-      td = mi_atomic_exchange_ptr_acq_rel(mi_thread_data_t, &td_cache[i], NULL);
-      if (td != NULL) {
-        _mi_os_free(td, sizeof(mi_thread_data_t), td->memid, &_mi_stats_main);
-      }
-    }
+  // free all thread metadata from the pool
+  mi_thread_data_t* td;
+  while ((td = mi_thread_data_pool_pop()) != NULL) {
+    if (!mi_thread_data_os_free(td)) break;  // pushed back; free it on a next collect
   }
 }
 
@@ -334,7 +412,9 @@ static bool _mi_thread_heap_init(void) {
   }
   else {
     // use `_mi_os_alloc` to allocate directly from the OS
-    mi_thread_data_t* td = mi_thread_data_zalloc();
+    size_t warm_hints[MI_WARM_SEGMENTS];
+    size_t warm_count;
+    mi_thread_data_t* td = mi_thread_data_zalloc(warm_hints, &warm_count);
     if (td == NULL) return false;
 
     mi_tld_t*  tld = &td->tld;
@@ -342,6 +422,9 @@ static bool _mi_thread_heap_init(void) {
     _mi_tld_init(tld, heap);  // must be before `_mi_heap_init`
     _mi_heap_init(heap, tld, _mi_arena_id_none(), false /* can reclaim */, 0 /* default tag */);
     _mi_heap_set_default_direct(heap);
+    if (warm_count > 0) {
+      _mi_segments_warm_start(heap, warm_hints, warm_count);
+    }
   }
   return false;
 }
@@ -355,6 +438,7 @@ void _mi_tld_init(mi_tld_t* tld, mi_heap_t* bheap) {
   tld->segments.stats = &tld->stats;
   tld->segments.os = &tld->os;
   tld->os.stats = &tld->stats;
+  _mi_stat_counters_thread_init(tld);
 }
 
 // Free the thread local default heap (called from `mi_thread_done`)
@@ -388,6 +472,9 @@ static bool _mi_thread_heap_done(mi_heap_t* heap) {
 
   // merge stats
   _mi_stats_done(&heap->tld->stats);
+  if (heap != &_mi_heap_main) {
+    _mi_stat_counters_thread_done(heap->tld);
+  }
 
   // free if not the main thread
   if (heap != &_mi_heap_main) {
@@ -449,6 +536,9 @@ void mi_thread_init(void) mi_attr_noexcept
   // ensure our process has started already
   mi_process_init();
 
+  // enable the per-CPU caches if `mi_option_cpu_cache` was set after the process started
+  _mi_cpu_cache_init();
+
   // initialize the thread local default heap
   // (this will call `_mi_heap_set_default_direct` and thus set the
   //  fiber/pthread key to a non-zero value, ensuring `_mi_thread_done` is called)
@@ -483,10 +573,63 @@ void _mi_thread_done(mi_heap_t* heap)
   // check thread-id as on Windows shutdown with FLS the main (exit) thread may call this on thread-local heaps...
   if (heap->thread_id != _mi_thread_id()) return;
 
+  // publish any frees that are still pending in the remote free magazine
+  _mi_free_remote_flush(heap->tld);
+
   // abandon the thread local heap
   if (_mi_thread_heap_done(heap)) return;  // returns true if already ran
 }
 
+// Uninitialize the thread but keep its memory together for a successor thread
+// that calls `mi_thread_adopt` (instead of abandoning it).
+mi_thread_handoff_t* mi_thread_done_handoff(void) mi_attr_noexcept {
+  mi_heap_t* heap = mi_prim_get_default_heap();
+  if (heap == NULL || !mi_heap_is_initialized(heap)) return NULL;
+  heap = heap->tld->heap_backing;
+  if (heap == &_mi_heap_main || heap->thread_id != _mi_thread_id()) {
+    // the statically allocated main heap cannot be handed off
+    mi_thread_done();
+    return NULL;
+  }
+
+  // adjust stats
+  mi_atomic_decrement_relaxed(&thread_count);
+  _mi_stat_decrease(&_mi_stats_main.threads, 1);
+
+  // reset the default heap and release the backing heap from this thread
+  _mi_heap_set_default_direct((mi_heap_t*)&_mi_heap_empty);
+  _mi_heap_handoff(heap);
+  _mi_stat_counters_thread_done(heap->tld);
+  return (mi_thread_handoff_t*)heap;  // the heap is the start of the thread metadata
+}
+
+// Adopt the memory of a thread that called `mi_thread_done_handoff`.
+bool mi_thread_adopt(mi_thread_handoff_t* handoff) mi_attr_noexcept {
+  if (handoff == NULL) return false;
+  mi_thread_init();
+  mi_heap_t* const heap = mi_prim_get_default_heap()->tld->heap_backing;
+  if (heap == NULL || !mi_heap_is_initialized(heap)) return false;  // out of memory
+  mi_thread_data_t* const td = (mi_thread_data_t*)handoff;
+  mi_assert_internal(td->tld.heap_backing == &td->heap && &td->heap != &_mi_heap_main);
+  const bool adopted = _mi_heap_adopt(heap, &td->heap);
+  // merge the statistics of the handed off thread and release its metadata
+  _mi_stats_done(&td->tld.stats);
+  mi_thread_data_free(td);
+  return adopted;
+}
+
+// Release the memory of a thread that called `mi_thread_done_handoff` without adopting it;
+// its segments are abandoned (as if the thread had called `mi_thread_done`).
+void mi_thread_handoff_release(mi_thread_handoff_t* handoff) mi_attr_noexcept {
+  if (handoff == NULL) return;
+  mi_thread_data_t* const td = (mi_thread_data_t*)handoff;
+  mi_assert_internal(td->tld.heap_backing == &td->heap && &td->heap != &_mi_heap_main);
+  _mi_heap_handoff_abandon(&td->heap);
+  mi_assert_internal(td->tld.segments.count == 0);
+  _mi_stats_done(&td->tld.stats);
+  mi_thread_data_free(td);
+}
+
 void _mi_heap_set_default_direct(mi_heap_t* heap)  {
   mi_assert_internal(heap != NULL);
   #if defined(MI_TLS_SLOT)
@@ -582,6 +725,10 @@ static void mi_process_load(void) {
   _mi_random_reinit_if_weak(&_mi_heap_main.random);
 }
 
+#if defined(__x86_64__) || defined(_M_X64)
+mi_decl_cache_align bool _mi_cpu_has_avx2 = false;  // used for bitmap scanning (see `bitmap.c`)
+#endif
+
 #if defined(_WIN32) && (defined(_M_IX86) || defined(_M_X64))
 #include <intrin.h>
 mi_decl_cache_align bool _mi_cpu_has_fsrm = false;
@@ -591,6 +738,18 @@ static void mi_detect_cpu_features(void) {
   int32_t cpu_info[4];
   __cpuid(cpu_info, 7);
   _mi_cpu_has_fsrm = ((cpu_info[3] & (1 << 4)) != 0); // bit 4 of EDX : see <https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features>
+  #if defined(_M_X64)
+  // AVX2 (bit 5 of EBX) if the OS also saves the ymm registers (OSXSAVE, bit 27 of ECX in leaf 1, and XCR0 bits 1 and 2)
+  const bool has_avx2 = ((cpu_info[1] & (1 << 5)) != 0);
+  __cpuid(cpu_info, 1);
+  _mi_cpu_has_avx2 = (has_avx2 && (cpu_info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x06) == 0x06);
+  #endif
+}
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+static void mi_detect_cpu_features(void) {
+  // AVX2 for bitmap scanning (this also checks if the OS saves the ymm registers)
+  __builtin_cpu_init();
+  _mi_cpu_has_avx2 = (__builtin_cpu_supports("avx2") != 0);
 }
 #else
 static void mi_detect_cpu_features(void) {
@@ -648,6 +807,9 @@ void mi_process_init(void) mi_attr_noexcept {
       mi_reserve_os_memory((size_t)ksize*MI_KiB, true, true);
     }
   }
+  if (mi_option_is_enabled(mi_option_purge_background)) {
+    _mi_arenas_purge_thread_start();
+  }
 }
 
 // Called when the process is done (through `at_exit`)
@@ -659,6 +821,9 @@ static void mi_cdecl mi_process_done(void) {
   if (process_done) return;
   process_done = true;
 
+  // stop purging in the background (so any remaining purges happen on this thread)
+  _mi_arenas_purge_thread_stop();
+
   // release any thread specific resources and ensure _mi_thread_done is called on all but the main thread
   _mi_prim_thread_done_auto_done();
 
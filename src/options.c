@@ -99,12 +99,22 @@ static mi_option_desc_t options[_mi_option_last] =
 #else
   { 0,   UNINIT, MI_OPTION(visit_abandoned) },          
 #endif
+  { 0,   UNINIT, MI_OPTION(remote_free_batch) },        // collect up to N non-local frees per page in a thread local magazine (0 = disabled)
+  { 0,   UNINIT, MI_OPTION(purge_background) },         // purge arenas in a background thread (started at process initialization or when enabled later)
+  { 0,   UNINIT, MI_OPTION(heap_profile_interval) },    // sample about once every N KiB allocated for the heap profiler (0 = disabled) (use `option_get_size`)
+  { 0,   UNINIT, MI_OPTION(remap_threshold) },          // reallocate huge blocks of at least N KiB in (remappable) OS memory instead of an arena (0 = disabled) (use `option_get_size`)
+  { 32,  UNINIT, MI_OPTION(thread_data_pool) },         // max number of pooled thread metadata entries
+  { 1,   UNINIT, MI_OPTION(thread_warm_start) },        // reclaim up to N (most recent) segments of the previous owner of pooled thread metadata
+  { 0,   UNINIT, MI_OPTION(thp_aware) },                // advise transparent huge pages only for densely used segments
+  { 0,   UNINIT, MI_OPTION(cpu_cache) },                // max blocks per size class in each per-CPU cache (0 = disabled)
+  { 8,   UNINIT, MI_OPTION(page_max_candidates) },      // pick the fullest of the first N pages with free blocks (1 = first fit)
 };
 
 static void mi_option_init(mi_option_desc_t* desc);
 
 static bool mi_option_has_size_in_kib(mi_option_t option) {
-  return (option == mi_option_reserve_os_memory || option == mi_option_arena_reserve);
+  return (option == mi_option_reserve_os_memory || option == mi_option_arena_reserve || option == mi_option_heap_profile_interval ||
+          option == mi_option_remap_threshold);
 }
 
 void _mi_options_init(void) {
@@ -20,7 +20,8 @@ static mi_os_mem_config_t mi_os_mem_config = {
   4096,   // allocation granularity
   true,   // has overcommit?  (if true we use MAP_NORESERVE on mmap systems)
   false,  // can we partially free allocated blocks? (on mmap systems we can free anywhere in a mapped range, but on Windows we must free the entire span)
-  true    // has virtual reserve? (if true we can reserve virtual address space without using commit or physical memory)
+  true,   // has virtual reserve? (if true we can reserve virtual address space without using commit or physical memory)
+  false   // has remap? (if true we can grow or move mappings without copying)
 };
 
 bool _mi_os_has_overcommit(void) {
@@ -369,6 +370,64 @@ void* _mi_os_alloc_aligned_at_offset(size_t size, size_t alignment, size_t offse
   }
 }
 
+/* -----------------------------------------------------------
+  OS remap: grow or shrink a (committed) OS allocation without
+  copying. This is used to reallocate huge blocks.
+----------------------------------------------------------- */
+
+// Resize the OS allocation at `addr` from `size` to `newsize` bytes. We first try to resize in place,
+// and if that fails (and `allow_move` is set) we move the pages to a fresh range aligned to `alignment`.
+// Returns the (possibly new) address, or NULL if it failed in which case the allocation is unchanged.
+// The extended part is committed and zero initialized.
+void* _mi_os_remap(void* addr, size_t size, size_t newsize, size_t alignment, bool allow_move, mi_memid_t* memid, mi_stats_t* tld_stats) {
+  MI_UNUSED(tld_stats);
+  mi_assert_internal(addr != NULL && size > 0 && newsize > 0);
+  if (!mi_os_mem_config.has_remap) return NULL;
+  if (memid->memkind != MI_MEM_OS || memid->is_pinned || memid->mem.os.base != addr) return NULL;  // only plain (unaligned at offset) OS memory
+  mi_stats_t* stats = &_mi_stats_main;
+  const size_t csize    = _mi_os_good_alloc_size(size);
+  const size_t cnewsize = _mi_os_good_alloc_size(newsize);
+  if (cnewsize == csize) return addr;
+
+  // try in place first
+  mi_stat_counter_increase(stats->remap_calls, 1);
+  if (_mi_prim_remap(addr, csize, NULL, cnewsize) == 0) {
+    if (cnewsize > csize) {
+      _mi_stat_increase(&stats->reserved, cnewsize - csize);
+      _mi_stat_increase(&stats->committed, cnewsize - csize);
+    }
+    else {
+      _mi_stat_decrease(&stats->reserved, csize - cnewsize);
+      _mi_stat_decrease(&stats->committed, csize - cnewsize);
+    }
+    return addr;
+  }
+  if (!allow_move || cnewsize < csize) return NULL;
+
+  // otherwise reserve a fresh aligned range and move the pages there
+  bool is_large = false;
+  bool is_zero = false;
+  void* base = NULL;
+  void* newaddr = mi_os_prim_alloc_aligned(cnewsize, alignment, false /* commit */, false /* allow large */, &is_large, &is_zero, &base, stats);
+  if (newaddr == NULL) return NULL;
+  mi_assert_internal(base == newaddr);  // as remap implies partial free
+  mi_stat_counter_increase(stats->remap_calls, 1);
+  const int err = _mi_prim_remap(addr, csize, newaddr, cnewsize);
+  if (err != 0) {
+    _mi_verbose_message("unable to remap OS memory (error: %d (0x%x), size: 0x%zx bytes, new size: 0x%zx bytes, address: %p)\n", err, err, csize, cnewsize, addr);
+    mi_os_prim_free(newaddr, cnewsize, false, stats);
+    return NULL;
+  }
+  // the old range is unmapped and the reservation is now committed
+  _mi_stat_decrease(&stats->reserved, csize);
+  _mi_stat_decrease(&stats->committed, csize);
+  _mi_stat_increase(&stats->committed, cnewsize);
+  memid->mem.os.base = newaddr;
+  memid->mem.os.alignment = alignment;
+  return newaddr;
+}
+
+
 /* -----------------------------------------------------------
   OS memory API: reset, commit, decommit, protect, unprotect.
 ----------------------------------------------------------- */
@@ -508,6 +567,21 @@ bool _mi_os_purge(void* p, size_t size, mi_stats_t * stats) {
   return _mi_os_purge_ex(p, size, true, stats);
 }
 
+// Advise the OS to back the range with transparent huge pages (or not, if `!enable`).
+// Only used if `mi_option_thp_aware` is enabled. Returns `true` on success.
+bool _mi_os_thp_advise(void* addr, size_t size, bool enable, mi_stats_t* stats) {
+  size_t csize = 0;
+  void* start = mi_os_page_align_area_conservative(addr, size, &csize);
+  if (csize == 0) return false;
+  const int err = _mi_prim_thp_advise(start, csize, enable);
+  if (err != 0) {
+    _mi_verbose_message("unable to advise transparent huge pages (error: %d (0x%x), address: %p, size: 0x%zx bytes)\n", err, err, start, csize);
+    return false;
+  }
+  if (enable) { _mi_stat_counter_increase(&stats->thp_advised, csize); }
+  return true;
+}
+
 
 // Protect a region in memory to be not accessible.
 static  bool mi_os_protectx(void* addr, size_t size, bool protect) {
@@ -53,11 +53,11 @@ static inline bool mi_page_queue_is_special(const mi_page_queue_t* pq) {
   Bins
 ----------------------------------------------------------- */
 
-// Return the bin for a given field size.
-// Returns MI_BIN_HUGE if the size is too large.
+// Return the standard bin for a given field size (not counting any extra size classes).
+// Returns MI_BIN_STD_HUGE if the size is too large.
 // We use `wsize` for the size in "machine word sizes",
 // i.e. byte size == `wsize*sizeof(void*)`.
-static inline uint8_t mi_bin(size_t size) {
+static inline uint8_t mi_bin_std(size_t size) {
   size_t wsize = _mi_wsize_from_size(size);
   uint8_t bin;
   if (wsize <= 1) {
@@ -77,7 +77,7 @@ static inline uint8_t mi_bin(size_t size) {
   }
   #endif
   else if (wsize > MI_LARGE_OBJ_WSIZE_MAX) {
-    bin = MI_BIN_HUGE;
+    bin = MI_BIN_STD_HUGE;
   }
   else {
     #if defined(MI_ALIGN4W)
@@ -90,9 +90,39 @@ static inline uint8_t mi_bin(size_t size) {
     // - adjust with 3 because we use do not round the first 8 sizes
     //   which each get an exact bin
     bin = ((b << 2) + (uint8_t)((wsize >> (b - 2)) & 0x03)) - 3;
-    mi_assert_internal(bin < MI_BIN_HUGE);
+    mi_assert_internal(bin < MI_BIN_STD_HUGE);
+  }
+  mi_assert_internal(bin > 0 && bin <= MI_BIN_STD_HUGE);
+  return bin;
+}
+
+#if (MI_BIN_EXTRA_COUNT > 0)
+// Extra exact size classes in bytes. These must be strictly increasing multiples
+// of the word size that differ from the standard bin sizes (which `CMakeLists.txt`
+// ensures for `MI_EXTRA_SIZE_CLASSES`).
+static const size_t mi_bin_extra_sizes[MI_BIN_EXTRA_COUNT] = { MI_BIN_EXTRA_SIZES };
+#endif
+
+// Return the bin for a given field size.
+// Returns MI_BIN_HUGE if the size is too large.
+static inline uint8_t mi_bin(size_t size) {
+  uint8_t bin = mi_bin_std(size);
+  #if (MI_BIN_EXTRA_COUNT > 0)
+  if (bin == MI_BIN_STD_HUGE) {
+    bin = MI_BIN_HUGE;
+  }
+  else {
+    // The extra classes are inserted in between the standard bins (ordered by size).
+    // Each extra class that is smaller than the size shifts the bin up by one. This is
+    // also the bin of the smallest extra class that fits the size (if it is smaller than
+    // the standard bin size) as all standard bins below it are smaller than the size.
+    const size_t wsize = _mi_wsize_from_size(size);
+    for (size_t i = 0; i < MI_BIN_EXTRA_COUNT; i++) {
+      if (_mi_wsize_from_size(mi_bin_extra_sizes[i]) < wsize) { bin++; }
+    }
   }
   mi_assert_internal(bin > 0 && bin <= MI_BIN_HUGE);
+  #endif
   return bin;
 }
 
@@ -107,7 +137,35 @@ uint8_t _mi_bin(size_t size) {
 }
 
 size_t _mi_bin_size(uint8_t bin) {
+  #if (MI_BIN_EXTRA_COUNT > 0)
+  // the empty heap only has the standard bins (see `MI_PAGE_QUEUES_EMPTY`)
+  if (bin >= MI_BIN_HUGE) {
+    return _mi_heap_empty.pages[bin - MI_BIN_EXTRA_COUNT].block_size;  // huge and full queue
+  }
+  size_t std_bin = bin;
+  for (size_t i = 0; i < MI_BIN_EXTRA_COUNT; i++) {
+    const uint8_t extra_bin = mi_bin(mi_bin_extra_sizes[i]);
+    if (extra_bin == bin) return mi_bin_extra_sizes[i];
+    if (extra_bin < bin) { std_bin--; }
+  }
+  return _mi_heap_empty.pages[std_bin].block_size;
+  #else
   return _mi_heap_empty.pages[bin].block_size;
+  #endif
+}
+
+// Initialize the block size of each page queue.
+// Only needed with extra size classes as the statically initialized queues
+// (`MI_PAGE_QUEUES_EMPTY`) contain just the standard bins.
+void _mi_page_queues_init(mi_page_queue_t* pages) {
+  #if (MI_BIN_EXTRA_COUNT > 0)
+  for (size_t bin = 0; bin <= MI_BIN_FULL; bin++) {
+    mi_assert_internal(bin == 0 || bin >= MI_BIN_HUGE || _mi_bin_size((uint8_t)bin) >= _mi_bin_size((uint8_t)(bin - 1)));
+    pages[bin].block_size = _mi_bin_size((uint8_t)bin);
+  }
+  #else
+  MI_UNUSED(pages);
+  #endif
 }
 
 // Good size for allocation
@@ -260,6 +318,15 @@ static void mi_page_queue_push(mi_heap_t* heap, mi_page_queue_t* queue, mi_page_
 }
 
 
+static void mi_page_queue_move_to_front(mi_heap_t* heap, mi_page_queue_t* queue, mi_page_t* page) {
+  mi_assert_internal(mi_page_heap(page) == heap);
+  mi_assert_expensive(mi_page_queue_contains(queue, page));
+  if (queue->first == page) return;
+  mi_page_queue_remove(queue, page);
+  mi_page_queue_push(heap, queue, page);
+  mi_assert_internal(queue->first == page);
+}
+
 static void mi_page_queue_enqueue_from(mi_page_queue_t* to, mi_page_queue_t* from, mi_page_t* page) {
   mi_assert_internal(page != NULL);
   mi_assert_expensive(mi_page_queue_contains(from, page));
@@ -312,6 +379,8 @@ size_t _mi_page_queue_append(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_queue
     // inline `mi_page_set_heap` to avoid wrong assertion during absorption;
     // in this case it is ok to be delayed freeing since both "to" and "from" heap are still alive.
     mi_atomic_store_release(&page->xheap, (uintptr_t)heap);
+    page->cpu_cacheable = _mi_cpu_cache_heap_is_cacheable(heap);
+    page->remote_batchable = !heap->no_reclaim;
     // set the flag to delayed free (not overriding NEVER_DELAYED_FREE) which has as a
     // side effect that it spins until any DELAYED_FREEING is finished. This ensures
     // that after appending only the new heap will be used for delayed free operations.
@@ -38,6 +38,7 @@ static inline mi_block_t* mi_page_block_at(const mi_page_t* page, void* page_sta
 
 static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t size, mi_tld_t* tld);
 static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld);
+static void mi_heap_retire_fresh(mi_heap_t* heap, size_t bin);
 
 #if (MI_DEBUG>=3)
 static size_t mi_page_list_count(mi_page_t* page, mi_block_t* head) {
@@ -300,6 +301,7 @@ static mi_page_t* mi_page_fresh(mi_heap_t* heap, mi_page_queue_t* pq) {
   mi_assert_internal(mi_heap_contains_queue(heap, pq));
   mi_page_t* page = mi_page_fresh_alloc(heap, pq, pq->block_size, 0);
   if (page==NULL) return NULL;
+  mi_heap_retire_fresh(heap, (size_t)(pq - heap->pages));
   mi_assert_internal(pq->block_size==mi_page_block_size(page));
   mi_assert_internal(pq==mi_page_queue(heap, mi_page_block_size(page)));
   return page;
@@ -360,6 +362,17 @@ void _mi_page_unfull(mi_page_t* page) {
   mi_page_queue_enqueue_from(pq, pqfull, page);
 }
 
+// Move a page that may still have free blocks to the full queue so no blocks are allocated
+// from it until one of its blocks is freed (see `alloc.c:mi_heap_defrag_realloc`)
+void _mi_page_exclude(mi_page_t* page) {
+  mi_assert_internal(page != NULL);
+  mi_assert_expensive(_mi_page_is_valid(page));
+  if (mi_page_is_in_full(page)) return;
+  mi_heap_t* heap = mi_page_heap(page);
+  mi_page_queue_t* pq = mi_heap_page_queue_of(heap, page);
+  mi_page_queue_enqueue_from(&heap->pages[MI_BIN_FULL], pq, page);
+}
+
 static void mi_page_to_full(mi_page_t* page, mi_page_queue_t* pq) {
   mi_assert_internal(pq == mi_page_queue_of(page));
   mi_assert_internal(!mi_page_immediate_available(page));
@@ -412,8 +425,9 @@ void _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force) {
   mi_assert_internal(mi_page_all_free(page));
   mi_assert_internal(mi_page_thread_free_flag(page)!=MI_DELAYED_FREEING);
 
-  // no more aligned blocks in here
+  // no more aligned or sampled blocks in here
   mi_page_set_has_aligned(page, false);
+  mi_page_set_has_sampled(page, false);
 
   // remove from the page list
   // (no need to do _mi_heap_delayed_free first as all blocks are already free)
@@ -427,6 +441,67 @@ void _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force) {
 
 #define MI_MAX_RETIRE_SIZE    MI_LARGE_OBJ_SIZE_MAX   // should be less than size for MI_BIN_HUGE
 #define MI_RETIRE_CYCLES      (16)
+#define MI_RETIRE_CYCLES_MAX  (127)     // fits in `page->retire_expire`
+#define MI_RETIRE_CHURN_BEATS (256)     // a fresh page within this many heartbeats after freeing a retired page is churn
+#define MI_RETIRE_PAGES_MAX   (8)       // maximal retired pages in a churning size bin
+
+// The retire expiration adapts per size bin to the recent demand in a heap:
+// if a fresh page is needed shortly after a retired page of the same bin
+// was freed, we were too eager and double the expiration for that bin
+// (and also keep up to `MI_RETIRE_PAGES_MAX` pages that are not the only page
+// in the queue). If a retired page expires without being reused we halve it again.
+static size_t mi_page_retire_cycles_default(size_t bsize) {
+  return (bsize <= MI_SMALL_OBJ_SIZE_MAX ? MI_RETIRE_CYCLES : MI_RETIRE_CYCLES/4);
+}
+
+static size_t mi_heap_retire_cycles(const mi_heap_t* heap, size_t bin, size_t bsize) {
+  const size_t cycles = heap->retire_cycles[bin];
+  return (cycles == 0 ? mi_page_retire_cycles_default(bsize) : cycles);
+}
+
+static bool mi_heap_retire_is_churning(const mi_heap_t* heap, size_t bin, size_t bsize) {
+  return (heap->retire_cycles[bin] > mi_page_retire_cycles_default(bsize));
+}
+
+// the number of retired pages at the head of a queue (up to `MI_RETIRE_PAGES_MAX`)
+static size_t mi_page_queue_retired_count(const mi_page_queue_t* pq) {
+  size_t count = 0;
+  const mi_page_t* page = pq->first;
+  for (size_t i = 0; page != NULL && i <= MI_RETIRE_PAGES_MAX && count < MI_RETIRE_PAGES_MAX; i++) {
+    if (page->retire_expire != 0) { count++; }
+    page = page->next;
+  }
+  return count;
+}
+
+// a retired page was freed
+static void mi_heap_retire_freed(mi_heap_t* heap, size_t bin, bool expired) {
+  mi_assert_internal(bin < MI_BIN_HUGE);
+  uint32_t beat = (uint32_t)heap->tld->heartbeat;
+  heap->retire_freed_beat[bin] = (beat == 0 ? 1 : beat);
+  if (expired && heap->retire_cycles[bin] != 0) {
+    // not reused in time: decay back to the default
+    const size_t bsize = heap->pages[bin].block_size;
+    const size_t cycles = heap->retire_cycles[bin] / 2;
+    heap->retire_cycles[bin] = (cycles <= mi_page_retire_cycles_default(bsize) ? 0 : (uint8_t)cycles);
+  }
+}
+
+// a fresh page is allocated in a bin; detect churn
+static void mi_heap_retire_fresh(mi_heap_t* heap, size_t bin) {
+  if (bin >= MI_BIN_HUGE) return;
+  const uint32_t freed = heap->retire_freed_beat[bin];
+  if (freed == 0) return;
+  heap->retire_freed_beat[bin] = 0;
+  if ((uint32_t)heap->tld->heartbeat - freed > MI_RETIRE_CHURN_BEATS) return;
+  // we freed a page too early: retire longer in this bin
+  mi_heap_stat_counter_increase(heap, page_churn, 1);
+  #if (MI_STAT>1)
+  mi_heap_stat_counter_increase(heap, page_churn_bins[bin], 1);
+  #endif
+  const size_t cycles = 2*mi_heap_retire_cycles(heap, bin, heap->pages[bin].block_size);
+  heap->retire_cycles[bin] = (uint8_t)(cycles > MI_RETIRE_CYCLES_MAX ? MI_RETIRE_CYCLES_MAX : cycles);
+}
 
 // Retire a page with no more used blocks
 // Important to not retire too quickly though as new
@@ -440,56 +515,71 @@ void _mi_page_retire(mi_page_t* page) mi_attr_noexcept {
   mi_assert_internal(mi_page_all_free(page));
 
   mi_page_set_has_aligned(page, false);
+  mi_page_set_has_sampled(page, false);
 
   // don't retire too often..
   // (or we end up retiring and re-allocating most of the time)
-  // NOTE: refine this more: we should not retire if this
-  // is the only page left with free blocks. It is not clear
-  // how to check this efficiently though...
-  // for now, we don't retire if it is the only page left of this size class.
+  // we don't retire if it is the only page left of this size class, or,
+  // if the size class is churning, if there are not too many retired pages yet.
+  // Retired pages are kept at the head of the queue.
   mi_page_queue_t* pq = mi_page_queue_of(page);
   const size_t bsize = mi_page_block_size(page);
   if mi_likely( /* bsize < MI_MAX_RETIRE_SIZE && */ !mi_page_queue_is_special(pq)) {  // not full or huge queue?
-    if (pq->last==page && pq->first==page) { // the only page in the queue?
+    mi_heap_t* heap = mi_page_heap(page);
+    mi_assert_internal(pq >= heap->pages);
+    const size_t index = pq - heap->pages;
+    mi_assert_internal(index < MI_BIN_FULL && index < MI_BIN_HUGE);
+    const bool only_page = (pq->last==page && pq->first==page);
+    if (only_page ||
+        (mi_heap_retire_is_churning(heap, index, bsize) && mi_page_queue_retired_count(pq) < MI_RETIRE_PAGES_MAX))
+    {
       mi_stat_counter_increase(_mi_stats_main.page_no_retire,1);
-      page->retire_expire = (bsize <= MI_SMALL_OBJ_SIZE_MAX ? MI_RETIRE_CYCLES : MI_RETIRE_CYCLES/4);
-      mi_heap_t* heap = mi_page_heap(page);
-      mi_assert_internal(pq >= heap->pages);
-      const size_t index = pq - heap->pages;
-      mi_assert_internal(index < MI_BIN_FULL && index < MI_BIN_HUGE);
+      if (pq->first != page) {
+        // move to the head of the queue
+        mi_page_queue_remove(pq, page);
+        mi_page_queue_push(heap, pq, page);
+      }
+      page->retire_expire = (uint8_t)mi_heap_retire_cycles(heap, index, bsize);
       if (index < heap->page_retired_min) heap->page_retired_min = index;
       if (index > heap->page_retired_max) heap->page_retired_max = index;
       mi_assert_internal(mi_page_all_free(page));
       return; // don't free after all
     }
+    mi_heap_retire_freed(heap, index, false);
   }
 
   _mi_page_free(page, pq, false);
 }
 
 // free retired pages: we don't need to look at the entire queues
-// since we only retire pages that are at the head position in a queue.
+// since we only retire pages that are pushed at the head position in a queue
+// (and a queue has at most `MI_RETIRE_PAGES_MAX` retired pages).
 void _mi_heap_collect_retired(mi_heap_t* heap, bool force) {
   size_t min = MI_BIN_FULL;
   size_t max = 0;
   for(size_t bin = heap->page_retired_min; bin <= heap->page_retired_max; bin++) {
     mi_page_queue_t* pq   = &heap->pages[bin];
     mi_page_t*       page = pq->first;
-    if (page != NULL && page->retire_expire != 0) {
-      if (mi_page_all_free(page)) {
-        page->retire_expire--;
-        if (force || page->retire_expire == 0) {
-          _mi_page_free(pq->first, pq, force);
+    for (size_t i = 0; page != NULL && i <= MI_RETIRE_PAGES_MAX; i++) {
+      mi_page_t* const next = page->next;
+      if (page->retire_expire != 0) {
+        if (mi_page_all_free(page)) {
+          page->retire_expire--;
+          if (force || page->retire_expire == 0) {
+            if (!force) { mi_heap_retire_freed(heap, bin, true /* expired */); }
+            _mi_page_free(page, pq, force);
+          }
+          else {
+            // keep retired, update min/max
+            if (bin < min) min = bin;
+            if (bin > max) max = bin;
+          }
         }
         else {
-          // keep retired, update min/max
-          if (bin < min) min = bin;
-          if (bin > max) max = bin;
+          page->retire_expire = 0;
         }
       }
-      else {
-        page->retire_expire = 0;
-      }
+      page = next;
     }
   }
   heap->page_retired_min = min;
@@ -603,9 +693,9 @@ static mi_decl_noinline void mi_page_free_list_extend( mi_page_t* const page, co
 
 // Extend the capacity (up to reserved) by initializing a free list
 // We do at most `MI_MAX_EXTEND` to avoid touching too much memory
-// Note: we also experimented with "bump" allocation on the first
-// allocations but this did not speed up any benchmark (due to an
-// extra test in malloc? or cache effects?)
+// Note: this is only used in secure mode (for a randomized free list); otherwise
+// `_mi_page_malloc_zero` allocates fresh blocks by bumping the capacity one block
+// at a time (see `mi_page_can_bump`).
 static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld) {
   mi_assert_expensive(mi_page_is_valid_init(page));
   #if (MI_SECURE<=2)
@@ -699,8 +789,12 @@ static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi
   mi_assert_internal(page->block_size_shift == 0 || (block_size == ((size_t)1 << page->block_size_shift)));
   mi_assert_expensive(mi_page_is_valid_init(page));
 
-  // initialize an initial free list
+  // initialize an initial free list (in secure mode; otherwise we allocate by bumping the capacity)
+  #if (MI_SECURE>0)
   mi_page_extend_free(heap,page,tld);
+  #else
+  MI_UNUSED(tld);
+  #endif
   mi_assert(mi_page_immediate_available(page));
 }
 
@@ -709,10 +803,22 @@ static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi
   Find pages with free blocks
 -------------------------------------------------------------*/
 
+// A page that has no used blocks but was passed over for a fuller one is retired
+// (unless it is already retired and will expire by itself).
+static void mi_page_queue_retire_unused(mi_page_t* page) {
+  if (mi_page_all_free(page) && page->retire_expire == 0) {
+    _mi_page_retire(page);
+  }
+}
+
 // Find a page with free blocks of `page->block_size`.
 static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* pq, bool first_try)
 {
-  // search through the pages in "next fit" order
+  // search through the pages in "next fit" order; of the first `candidate_max` pages with free blocks
+  // we pick the one with the most used blocks so that sparsely used pages can drain and be retired.
+  const size_t candidate_max = (size_t)mi_option_get_clamp(mi_option_page_max_candidates, 1, 1024);
+  size_t candidate_count = 0;
+  mi_page_t* page_candidate = NULL;
   #if MI_STAT
   size_t count = 0;
   #endif
@@ -727,28 +833,34 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
     // 0. collect freed blocks by us and other threads
     _mi_page_free_collect(page, false);
 
-    // 1. if the page contains free blocks, we are done
-    if (mi_page_immediate_available(page)) {
-      break;  // pick this one
+    // 1. if the page contains free blocks (or can be extended in secure mode) it is a candidate
+    if (mi_page_immediate_available(page) || page->capacity < page->reserved) {
+      candidate_count++;
+      if (page_candidate == NULL) {
+        page_candidate = page;
+      }
+      else if (page->used > page_candidate->used) {
+        mi_page_queue_retire_unused(page_candidate);
+        page_candidate = page;
+      }
+      else {
+        mi_page_queue_retire_unused(page);
+      }
+      if (candidate_count >= candidate_max) break;
     }
-
-    // 2. Try to extend
-    if (page->capacity < page->reserved) {
-      mi_page_extend_free(heap, page, heap->tld);
-      mi_assert_internal(mi_page_immediate_available(page));
-      break;
+    else {
+      // 2. If the page is completely full, move it to the `mi_pages_full`
+      // queue so we don't visit long-lived pages too often.
+      mi_assert_internal(!mi_page_is_in_full(page) && !mi_page_immediate_available(page));
+      mi_page_to_full(page, pq);
     }
 
-    // 3. If the page is completely full, move it to the `mi_pages_full`
-    // queue so we don't visit long-lived pages too often.
-    mi_assert_internal(!mi_page_is_in_full(page) && !mi_page_immediate_available(page));
-    mi_page_to_full(page, pq);
-
     page = next;
   } // for each page
 
   mi_heap_stat_counter_increase(heap, searches, count);
 
+  page = page_candidate;
   if (page == NULL) {
     _mi_heap_collect_retired(heap, false); // perhaps make a page available
     page = mi_page_fresh(heap, pq);
@@ -758,6 +870,13 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
     }
   }
   else {
+    // move the candidate to the front so the next allocations find it directly
+    mi_page_queue_move_to_front(heap, pq, page);
+    // 3. Extend the page if needed (only in secure mode as otherwise the page is available if it can bump its capacity)
+    if (!mi_page_immediate_available(page)) {
+      mi_assert_internal(page->capacity < page->reserved);
+      mi_page_extend_free(heap, page, heap->tld);
+    }
     mi_assert(pq->first == page);
     page->retire_expire = 0;
   }
@@ -850,6 +969,67 @@ static mi_page_t* mi_huge_page_alloc(mi_heap_t* heap, size_t size, size_t page_a
   return page;
 }
 
+// Resize a huge page of the heap to hold `size` bytes without copying (see `_mi_segment_huge_page_remap`).
+// If `allow_move` is set the page may move to a new address. Returns the (possibly moved) page, or
+// NULL if this was not possible in which case the page is unchanged.
+mi_page_t* _mi_huge_page_remap(mi_heap_t* heap, mi_page_t* page, size_t size, bool allow_move) {
+  #if MI_HUGE_PAGE_ABANDON
+  MI_UNUSED(heap); MI_UNUSED(page); MI_UNUSED(size); MI_UNUSED(allow_move);
+  return NULL;  // huge pages are abandoned and not owned by the heap
+  #else
+  mi_assert_internal(mi_page_is_huge(page) && mi_page_heap(page) == heap);
+  mi_page_queue_t* const pq = mi_page_queue_of(page);
+  const size_t bsize = mi_page_block_size(page); MI_UNUSED(bsize);  // only used for statistics
+  mi_page_t* const newpage = _mi_segment_huge_page_remap(page, _mi_os_good_alloc_size(size), allow_move, &heap->tld->segments);
+  if (newpage == NULL) return NULL;
+  if (newpage != page) {
+    // the page moved with its segment: update the links in the page queue
+    // (huge pages are never in the direct `pages_free_direct` array)
+    if (newpage->prev != NULL) { newpage->prev->next = newpage; } else { pq->first = newpage; }
+    if (newpage->next != NULL) { newpage->next->prev = newpage; } else { pq->last = newpage; }
+  }
+  mi_assert_expensive(mi_page_queue_contains(pq, newpage));
+  mi_heap_stat_decrease(heap, huge, bsize);
+  mi_heap_stat_increase(heap, huge, mi_page_block_size(newpage));
+  return newpage;
+  #endif
+}
+
+// Grow the first block of a medium or large page in place to hold `size` bytes. This is possible if it is
+// the only block in use: we re-initialize the page for the larger size class, dropping the free blocks,
+// and move it to the page queue of that size. Returns `false` if this is not possible.
+bool _mi_page_grow_first_block(mi_heap_t* heap, mi_page_t* page, size_t size) {
+  mi_assert_internal(mi_page_heap(page) == heap && page->used > 0);
+  if (page->used != 1) return false;  // note: this also implies there are no pending thread frees
+  const mi_segment_t* const segment = _mi_page_segment(page);
+  const size_t max_size = (segment->page_kind == MI_PAGE_MEDIUM ? MI_MEDIUM_OBJ_SIZE_MAX :
+                           (segment->page_kind == MI_PAGE_LARGE ? MI_LARGE_OBJ_SIZE_MAX : 0));
+  if (size > max_size) return false;
+  mi_page_queue_t* const pq = mi_page_queue_of(page);
+  mi_page_queue_t* const newpq = mi_page_queue(heap, size);
+  const size_t bsize = mi_page_block_size(page);
+  const size_t newbsize = newpq->block_size;
+  if (newbsize <= bsize) return false;
+  // the page start must not change (medium pages are aligned to the block size)
+  size_t psize;
+  if (_mi_segment_page_start_ex(segment, page, newbsize, &psize) != page->page_start || newbsize > psize) return false;
+
+  mi_page_queue_remove(pq, page);
+  mi_stat_decrease(heap->tld->stats.page_committed, page->capacity * bsize);
+  mi_stat_increase(heap->tld->stats.page_committed, newbsize);
+  page->free = NULL;
+  page->local_free = NULL;
+  page->free_is_zero = false;   // later blocks overlap previously used memory
+  page->is_zero_init = false;   // (also for blocks allocated by bumping the capacity)
+  page->capacity = 1;
+  page->block_size = newbsize;
+  page->reserved = (uint16_t)(psize / newbsize);
+  page->block_size_shift = (_mi_is_power_of_two(newbsize) ? (uint8_t)mi_ctz((uintptr_t)newbsize) : 0);
+  mi_page_queue_push(heap, newpq, page);
+  mi_assert_expensive(_mi_page_is_valid(page));
+  return true;
+}
+
 
 // Allocate a page
 // Note: in debug mode the size includes MI_PADDING_SIZE and might have overflowed.
@@ -888,6 +1068,9 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size, bool zero, size_t huge_al
     if mi_unlikely(!mi_heap_is_initialized(heap)) { return NULL; }
   }
   mi_assert_internal(mi_heap_is_initialized(heap));
+  #if MI_STAT_COUNTERS
+  mi_atomic_store_relaxed(&heap->tld->counters.malloc_generic_count, mi_atomic_load_relaxed(&heap->tld->counters.malloc_generic_count) + 1);
+  #endif
 
   // call potential deferred free routines
   _mi_deferred_free(heap, false);
@@ -912,14 +1095,20 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size, bool zero, size_t huge_al
   mi_assert_internal(mi_page_block_size(page) >= size);
 
   // and try again, this time succeeding! (i.e. this should never recurse through _mi_page_malloc)
+  void* p;
   if mi_unlikely(zero && page->block_size == 0) {
     // note: we cannot call _mi_page_malloc with zeroing for huge blocks; we zero it afterwards in that case.
-    void* p = _mi_page_malloc(heap, page, size);
+    p = _mi_page_malloc(heap, page, size);
     mi_assert_internal(p != NULL);
     _mi_memzero_aligned(p, mi_page_usable_block_size(page));
-    return p;
   }
   else {
-    return _mi_page_malloc_zero(heap, page, size, zero);
+    p = _mi_page_malloc_zero(heap, page, size, zero);
+  }
+
+  // the heap profiler only samples here so the fast path stays untouched
+  if mi_unlikely(mi_option_get(mi_option_heap_profile_interval) != 0) {
+    _mi_heap_profile_malloc(heap, page, p, size - MI_PADDING_SIZE);
   }
+  return p;
 }
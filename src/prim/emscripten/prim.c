@@ -119,6 +119,20 @@ int _mi_prim_protect(void* addr, size_t size, bool protect) {
   return 0;
 }
 
+int _mi_prim_remap(void* addr, size_t size, void* newaddr, size_t newsize) {
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(newaddr); MI_UNUSED(newsize);
+  return ENOSYS;
+}
+
+int _mi_prim_thp_advise(void* addr, size_t size, bool enable) {
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(enable);
+  return ENOSYS;
+}
+
+size_t _mi_prim_thp_rss(void) {
+  return 0;
+}
+
 
 //---------------------------------------------
 // Huge pages and NUMA nodes
@@ -139,6 +153,15 @@ size_t _mi_prim_numa_node_count(void) {
   return 1;
 }
 
+// per-CPU caches are only supported on Linux (see `cpu-cache.c`)
+int _mi_prim_current_cpu(void) {
+  return -1;
+}
+
+size_t _mi_prim_cpu_count(void) {
+  return 0;
+}
+
 
 //----------------------------------------------------------------
 // Clock
@@ -242,3 +265,27 @@ void _mi_prim_thread_associate_default_heap(mi_heap_t* heap) {
 
 }
 #endif
+
+
+//----------------------------------------------------------------
+// Background threads
+//----------------------------------------------------------------
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fun, void* arg) {
+  MI_UNUSED(fun); MI_UNUSED(arg);
+  return false;
+}
+
+void _mi_prim_thread_sleep(mi_msecs_t msecs) {
+  MI_UNUSED(msecs);
+}
+
+size_t _mi_prim_stack_trace(void** frames, size_t max_frames, size_t skip) {
+  MI_UNUSED(frames); MI_UNUSED(max_frames); MI_UNUSED(skip);
+  return 0;
+}
+
+bool _mi_prim_out_mappings(mi_output_fun* out, void* arg) {
+  MI_UNUSED(out); MI_UNUSED(arg);
+  return false;
+}
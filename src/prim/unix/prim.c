@@ -22,6 +22,7 @@ terms of the MIT license. A copy of the license can be found in the file
 
 #include "mimalloc.h"
 #include "mimalloc/internal.h"
+#include "mimalloc/atomic.h"
 #include "mimalloc/prim.h"
 
 #include <sys/mman.h>  // mmap
@@ -61,6 +62,11 @@ terms of the MIT license. A copy of the license can be found in the file
   #include <sys/syscall.h>
 #endif
 
+#if defined(__linux__) && defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+  #define MI_HAS_RSEQ           // glibc registers an `rseq` area for each thread (and exports its offset)
+  #include <sys/rseq.h>
+#endif
+
 
 //------------------------------------------------------------------------------------
 // Use syscalls for some primitives to allow for libraries that override open/read/close etc.
@@ -144,13 +150,16 @@ void _mi_prim_mem_init( mi_os_mem_config_t* config )
   config->has_overcommit = unix_detect_overcommit();
   config->has_partial_free = true;    // mmap can free in parts
   config->has_virtual_reserve = true; // todo: check if this true for NetBSD?  (for anonymous mmap with PROT_NONE)
+  #if defined(__linux__) && defined(MI_HAS_SYSCALL_H) && defined(SYS_mremap)
+  config->has_remap = true;           // mremap
+  #endif
 
   // disable transparent huge pages for this process?
   #if (defined(__linux__) || defined(__ANDROID__)) && defined(PR_GET_THP_DISABLE)
   #if defined(MI_NO_THP)
   if (true)
   #else
-  if (!mi_option_is_enabled(mi_option_allow_large_os_pages)) // disable THP also if large OS pages are not allowed in the options
+  if (!mi_option_is_enabled(mi_option_allow_large_os_pages) && !mi_option_is_enabled(mi_option_thp_aware)) // disable THP also if large OS pages are not allowed in the options (and we do not place huge pages ourselves)
   #endif
   {
     int val = 0;
@@ -445,6 +454,92 @@ int _mi_prim_protect(void* start, size_t size, bool protect) {
   return err;
 }
 
+#if defined(__linux__) && defined(MI_HAS_SYSCALL_H) && defined(SYS_mremap)
+#if !defined(MREMAP_MAYMOVE)
+#define MREMAP_MAYMOVE  1
+#endif
+#if !defined(MREMAP_FIXED)
+#define MREMAP_FIXED    2
+#endif
+int _mi_prim_remap(void* addr, size_t size, void* newaddr, size_t newsize) {
+  // use the syscall directly as `mremap` is only declared with `_GNU_SOURCE`
+  void* p;
+  if (newaddr == NULL) {
+    p = (void*)syscall(SYS_mremap, addr, size, newsize, 0);   // in place
+  }
+  else {
+    p = (void*)syscall(SYS_mremap, addr, size, newsize, MREMAP_MAYMOVE | MREMAP_FIXED, newaddr);
+  }
+  if (p == MAP_FAILED) return errno;
+  mi_assert_internal(p == (newaddr == NULL ? addr : newaddr));
+  return 0;
+}
+#else
+int _mi_prim_remap(void* addr, size_t size, void* newaddr, size_t newsize) {
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(newaddr); MI_UNUSED(newsize);
+  return ENOSYS;
+}
+#endif
+
+
+//---------------------------------------------
+// Transparent huge pages
+//---------------------------------------------
+
+int _mi_prim_thp_advise(void* addr, size_t size, bool enable) {
+  #if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  int err = unix_madvise(addr, size, (enable ? MADV_HUGEPAGE : MADV_NOHUGEPAGE));
+  return (err != 0 ? errno : 0);
+  #else
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(enable);
+  return ENOSYS;
+  #endif
+}
+
+#if defined(__linux__)
+
+// Sum the `AnonHugePages:` entries in `/proc/self/smaps_rollup` (since Linux 4.14),
+// or in `/proc/self/smaps` (which has an entry for every mapping).
+// We parse character by character to not allocate and to handle lines that span reads.
+size_t _mi_prim_thp_rss(void) {
+  int fd = mi_prim_open("/proc/self/smaps_rollup", O_RDONLY);
+  if (fd < 0) { fd = mi_prim_open("/proc/self/smaps", O_RDONLY); }
+  if (fd < 0) return 0;
+  static const char key[] = "AnonHugePages:";
+  const size_t keylen = sizeof(key) - 1;
+  size_t total = 0;
+  size_t col = 0;        // column in the current line
+  size_t kib = 0;        // number parsed so far in a matching line
+  char buf[256];
+  ssize_t nread;
+  while ((nread = mi_prim_read(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t i = 0; i < nread; i++) {
+      const char c = buf[i];
+      if (c == '\n') {
+        if (col != SIZE_MAX && col > keylen) { total += kib * MI_KiB; }
+        col = 0; kib = 0;
+      }
+      else if (col < keylen) {
+        col = (c == key[col] ? col + 1 : SIZE_MAX);  // SIZE_MAX: skip to the end of the line
+      }
+      else if (col != SIZE_MAX) {
+        if (c >= '0' && c <= '9') { kib = 10*kib + (size_t)(c - '0'); }
+        col++;
+      }
+    }
+  }
+  mi_prim_close(fd);
+  return total;
+}
+
+#else
+
+size_t _mi_prim_thp_rss(void) {
+  return 0;
+}
+
+#endif
+
 
 
 //---------------------------------------------
@@ -573,6 +668,45 @@ size_t _mi_prim_numa_node_count(void) {
 
 #endif
 
+//---------------------------------------------
+// Current CPU
+//---------------------------------------------
+
+#if defined(__linux__)
+
+int _mi_prim_current_cpu(void) {
+  #if defined(MI_HAS_RSEQ) && defined(__has_builtin)
+  #if __has_builtin(__builtin_thread_pointer)
+  // the kernel updates `cpu_id` in the rseq area of the thread whenever the thread migrates
+  if mi_likely(__rseq_size > 0) {
+    const struct rseq* const rs = (const struct rseq*)((uint8_t*)__builtin_thread_pointer() + __rseq_offset);
+    const int cpu = (int)(*(const volatile uint32_t*)&rs->cpu_id);
+    if mi_likely(cpu >= 0) return cpu;
+  }
+  #endif
+  #endif
+  // note: we do not fall back to the `getcpu` system call as that is too expensive on every allocation
+  return -1;
+}
+
+size_t _mi_prim_cpu_count(void) {
+  const long n = sysconf(_SC_NPROCESSORS_CONF);
+  return (n > 0 ? (size_t)n : 0);
+}
+
+#else
+
+// per-CPU caches are only supported on Linux (see `cpu-cache.c`)
+int _mi_prim_current_cpu(void) {
+  return -1;
+}
+
+size_t _mi_prim_cpu_count(void) {
+  return 0;
+}
+
+#endif
+
 // ----------------------------------------------------------------
 // Clock
 // ----------------------------------------------------------------
@@ -879,3 +1013,127 @@ void _mi_prim_thread_associate_default_heap(mi_heap_t* heap) {
 }
 
 #endif
+
+
+//----------------------------------------------------------------
+// Background threads
+//----------------------------------------------------------------
+
+#if defined(MI_USE_PTHREADS)
+
+// we only start a few background threads so a static table avoids allocating the start arguments;
+// a slot is in use from the start until the new thread has read its arguments (or `pthread_create` failed)
+#define MI_PTHREAD_START_MAX  (4)
+
+typedef struct mi_pthread_start_s {
+  _Atomic(uintptr_t)    in_use;
+  mi_prim_thread_fun_t* fun;
+  void*                 arg;
+} mi_pthread_start_t;
+
+static mi_pthread_start_t  mi_pthread_starts[MI_PTHREAD_START_MAX];
+
+static void* mi_pthread_start(void* p) {
+  mi_pthread_start_t* const start = (mi_pthread_start_t*)p;
+  mi_prim_thread_fun_t* const fun = start->fun;
+  void* const arg = start->arg;
+  mi_atomic_store_release(&start->in_use, (uintptr_t)0);  // release the slot
+  fun(arg);
+  return NULL;
+}
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fun, void* arg) {
+  // claim a free slot
+  mi_pthread_start_t* start = NULL;
+  for (size_t i = 0; i < MI_PTHREAD_START_MAX && start == NULL; i++) {
+    uintptr_t expected = 0;
+    if (mi_atomic_cas_strong_acq_rel(&mi_pthread_starts[i].in_use, &expected, (uintptr_t)1)) {
+      start = &mi_pthread_starts[i];
+    }
+  }
+  if (start == NULL) return false;
+  start->fun = fun;
+  start->arg = arg;
+  pthread_attr_t attr;
+  int err = pthread_attr_init(&attr);
+  if (err == 0) {
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    err = pthread_create(&thread, &attr, &mi_pthread_start, start);
+    pthread_attr_destroy(&attr);
+  }
+  if (err != 0) {
+    mi_atomic_store_release(&start->in_use, (uintptr_t)0);  // release the slot as the thread did not start
+    return false;
+  }
+  return true;
+}
+
+#else
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fun, void* arg) {
+  MI_UNUSED(fun); MI_UNUSED(arg);
+  return false;
+}
+
+#endif
+
+void _mi_prim_thread_sleep(mi_msecs_t msecs) {
+  if (msecs <= 0) return;
+  struct timespec t;
+  t.tv_sec  = (time_t)(msecs / 1000);
+  t.tv_nsec = (long)((msecs % 1000) * 1000000);
+  while (nanosleep(&t, &t) != 0 && errno == EINTR) { /* continue */ };
+}
+
+
+//----------------------------------------------------------------
+// Stack traces and memory mappings (for the heap profiler)
+//----------------------------------------------------------------
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+
+size_t _mi_prim_stack_trace(void** frames, size_t max_frames, size_t skip) {
+  void* buf[64];
+  skip++;  // and skip this frame as well
+  const int n = backtrace(buf, 64);
+  if (n <= 0 || (size_t)n <= skip) return 0;
+  size_t count = (size_t)n - skip;
+  if (count > max_frames) { count = max_frames; }
+  _mi_memcpy(frames, &buf[skip], count * sizeof(void*));
+  return count;
+}
+
+#else
+
+size_t _mi_prim_stack_trace(void** frames, size_t max_frames, size_t skip) {
+  MI_UNUSED(frames); MI_UNUSED(max_frames); MI_UNUSED(skip);
+  return 0;
+}
+
+#endif
+
+#if defined(__linux__)
+
+bool _mi_prim_out_mappings(mi_output_fun* out, void* arg) {
+  const int fd = mi_prim_open("/proc/self/maps", O_RDONLY);
+  if (fd < 0) return false;
+  char buf[256];
+  ssize_t nread;
+  while ((nread = mi_prim_read(fd, buf, sizeof(buf) - 1)) > 0) {
+    buf[nread] = 0;
+    out(buf, arg);
+  }
+  mi_prim_close(fd);
+  return true;
+}
+
+#else
+
+bool _mi_prim_out_mappings(mi_output_fun* out, void* arg) {
+  MI_UNUSED(out); MI_UNUSED(arg);
+  return false;
+}
+
+#endif
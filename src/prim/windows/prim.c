@@ -338,6 +338,20 @@ int _mi_prim_protect(void* addr, size_t size, bool protect) {
   return (ok ? 0 : (int)GetLastError());
 }
 
+int _mi_prim_remap(void* addr, size_t size, void* newaddr, size_t newsize) {
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(newaddr); MI_UNUSED(newsize);
+  return ERROR_NOT_SUPPORTED;
+}
+
+int _mi_prim_thp_advise(void* addr, size_t size, bool enable) {
+  MI_UNUSED(addr); MI_UNUSED(size); MI_UNUSED(enable);
+  return ERROR_NOT_SUPPORTED;
+}
+
+size_t _mi_prim_thp_rss(void) {
+  return 0;
+}
+
 
 //---------------------------------------------
 // Huge page allocation
@@ -440,6 +454,15 @@ size_t _mi_prim_numa_node_count(void) {
   return ((size_t)numa_max + 1);
 }
 
+// per-CPU caches are only supported on Linux (see `cpu-cache.c`)
+int _mi_prim_current_cpu(void) {
+  return -1;
+}
+
+size_t _mi_prim_cpu_count(void) {
+  return 0;
+}
+
 
 //----------------------------------------------------------------
 // Clock
@@ -659,3 +682,53 @@ void _mi_prim_thread_associate_default_heap(mi_heap_t* heap) {
 
 #endif
 
+
+//----------------------------------------------------------------
+// Background threads
+//----------------------------------------------------------------
+
+typedef struct mi_win_thread_start_s {
+  mi_prim_thread_fun_t* fun;
+  void*                 arg;
+} mi_win_thread_start_t;
+
+static DWORD WINAPI mi_win_thread_start(LPVOID p) {
+  mi_win_thread_start_t start = *(mi_win_thread_start_t*)p;
+  HeapFree(GetProcessHeap(), 0, p);
+  start.fun(start.arg);
+  return 0;
+}
+
+bool _mi_prim_thread_start(mi_prim_thread_fun_t* fun, void* arg) {
+  // use the process heap (instead of mimalloc) for the start arguments
+  mi_win_thread_start_t* start = (mi_win_thread_start_t*)HeapAlloc(GetProcessHeap(), 0, sizeof(mi_win_thread_start_t));
+  if (start == NULL) return false;
+  start->fun = fun;
+  start->arg = arg;
+  HANDLE thread = CreateThread(NULL, 0, &mi_win_thread_start, start, 0, NULL);
+  if (thread == NULL) {
+    HeapFree(GetProcessHeap(), 0, start);
+    return false;
+  }
+  CloseHandle(thread);
+  return true;
+}
+
+void _mi_prim_thread_sleep(mi_msecs_t msecs) {
+  if (msecs > 0) { Sleep((DWORD)msecs); }
+}
+
+
+//----------------------------------------------------------------
+// Stack traces and memory mappings (for the heap profiler)
+//----------------------------------------------------------------
+
+size_t _mi_prim_stack_trace(void** frames, size_t max_frames, size_t skip) {
+  if (max_frames > 62) { max_frames = 62; }   // limit on Windows XP
+  return (size_t)CaptureStackBackTrace((DWORD)(skip + 1), (DWORD)max_frames, frames, NULL);
+}
+
+bool _mi_prim_out_mappings(mi_output_fun* out, void* arg) {
+  MI_UNUSED(out); MI_UNUSED(arg);
+  return false;
+}
@@ -0,0 +1,289 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2024, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+Sampling heap profiler.
+
+If `mi_option_heap_profile_interval` is set, about one allocation every
+`interval` bytes is sampled and its stack trace is recorded (similar to the
+tcmalloc heap profiler). Sampling happens only in the generic allocation path:
+when a page free list is handed out to the fast path, the free list is cut off
+at the next sample point (and the rest is moved to the `local_free` list) so
+that the allocation that reaches the sample point enters `_mi_malloc_generic`
+again. This way the fast path stays untouched.
+
+Pages with sampled blocks get the `has_sampled` flag which makes `mi_free`
+take the generic path for that page such that sampled blocks can be removed
+from the profile when they are freed. The live samples are kept in a fixed
+size hash table that is allocated directly from the OS; lookups are lock-free
+while insertions and removals take a lock.
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc/internal.h"
+#include "mimalloc/atomic.h"
+#include "mimalloc/prim.h"
+
+#define MI_PROFILE_MAX_FRAMES   (32)
+#define MI_PROFILE_SLOTS        (4096)              // must be a power of 2
+#define MI_PROFILE_MAX_PROBES   (64)                // samples are dropped if no slot is found within this many probes
+#define MI_PROFILE_TOMBSTONE    ((uintptr_t)1)      // slot of a sample that was freed
+
+typedef struct mi_profile_sample_s {
+  _Atomic(uintptr_t) block;                         // sampled block (or 0 if the slot is empty, or `MI_PROFILE_TOMBSTONE`)
+  size_t             size;                          // requested size
+  size_t             frame_count;
+  void*              frames[MI_PROFILE_MAX_FRAMES];
+} mi_profile_sample_t;
+
+static mi_lock_t                       mi_profile_lock;
+static _Atomic(mi_profile_sample_t*)   mi_profile_samples;  // allocated on the first sample
+static mi_memid_t                      mi_profile_samples_memid;
+static _Atomic(size_t)                 mi_profile_dropped;  // samples dropped as the table was full
+
+static mi_stack_unwind_fun* volatile   mi_profile_unwind;   // = NULL (use the platform unwinder)
+static _Atomic(void*)                  mi_profile_unwind_arg;
+
+void _mi_heap_profile_init(void) {
+  mi_lock_init(&mi_profile_lock);
+}
+
+void mi_heap_profile_set_unwinder(mi_stack_unwind_fun* unwind, void* arg) mi_attr_noexcept {
+  mi_profile_unwind = unwind;
+  mi_atomic_store_ptr_release(void, &mi_profile_unwind_arg, arg);
+}
+
+static size_t mi_profile_slot_of(uintptr_t block) {
+  return (size_t)((block >> 4) * 0x9E3779B97F4A7C15ULL) & (MI_PROFILE_SLOTS - 1);
+}
+
+// get the sample table (allocating it if needed); must hold the `mi_profile_lock`
+static mi_profile_sample_t* mi_profile_samples_get(void) {
+  mi_profile_sample_t* samples = mi_atomic_load_ptr_relaxed(mi_profile_sample_t, &mi_profile_samples);
+  if (samples == NULL) {
+    const size_t size = MI_PROFILE_SLOTS * sizeof(mi_profile_sample_t);
+    samples = (mi_profile_sample_t*)_mi_os_alloc(size, &mi_profile_samples_memid, &_mi_stats_main);
+    if (samples == NULL) return NULL;
+    if (!mi_profile_samples_memid.initially_zero) { _mi_memzero_aligned(samples, size); }
+    mi_atomic_store_ptr_release(mi_profile_sample_t, &mi_profile_samples, samples);
+  }
+  return samples;
+}
+
+// record a sample for `block`
+static void mi_profile_sample(uintptr_t block, size_t size) {
+  void* frames[MI_PROFILE_MAX_FRAMES];
+  mi_stack_unwind_fun* const unwind = mi_profile_unwind;
+  const size_t frame_count = (unwind != NULL ? unwind(frames, MI_PROFILE_MAX_FRAMES, mi_atomic_load_ptr_acquire(void, &mi_profile_unwind_arg))
+                                             : _mi_prim_stack_trace(frames, MI_PROFILE_MAX_FRAMES, 2 /* skip the profiler frames */));
+  if (!mi_lock_acquire(&mi_profile_lock)) return;
+  mi_profile_sample_t* const samples = mi_profile_samples_get();
+  mi_profile_sample_t* sample = NULL;
+  if (samples != NULL) {
+    // find a free slot (or a stale sample of the same block)
+    size_t idx = mi_profile_slot_of(block);
+    for (size_t i = 0; i < MI_PROFILE_MAX_PROBES; i++, idx = (idx + 1) & (MI_PROFILE_SLOTS - 1)) {
+      const uintptr_t b = mi_atomic_load_relaxed(&samples[idx].block);
+      if (b == block) { sample = &samples[idx]; break; }
+      if (sample == NULL && (b == 0 || b == MI_PROFILE_TOMBSTONE)) { sample = &samples[idx]; }
+      if (b == 0) break;
+    }
+  }
+  if (sample == NULL) {
+    mi_atomic_increment_relaxed(&mi_profile_dropped);
+  }
+  else {
+    sample->size = size;
+    sample->frame_count = (frame_count > MI_PROFILE_MAX_FRAMES ? MI_PROFILE_MAX_FRAMES : frame_count);
+    _mi_memcpy(sample->frames, frames, sample->frame_count * sizeof(void*));
+    mi_atomic_store_release(&sample->block, block);
+  }
+  mi_lock_release(&mi_profile_lock);
+}
+
+// the next sample point in bytes (uniformly distributed around the interval)
+static long long mi_profile_next_countdown(mi_heap_t* heap, size_t interval) {
+  return (long long)(interval/2 + (_mi_heap_random_next(heap) % interval) + 1);
+}
+
+// Called from `_mi_malloc_generic` for every allocation `p` from `page`.
+void _mi_heap_profile_malloc(mi_heap_t* heap, mi_page_t* page, void* p, size_t size) {
+  const size_t interval = mi_option_get_size(mi_option_heap_profile_interval);
+  mi_tld_t* const tld = heap->tld;
+  if (interval == 0 || p == NULL || tld->profile_busy) return;
+  const size_t bsize = mi_page_block_size(page);
+  if (tld->profile_countdown <= 0) {
+    tld->profile_countdown = mi_profile_next_countdown(heap, interval);
+  }
+
+  // sample this allocation?
+  if (tld->profile_countdown <= (long long)bsize) {
+    tld->profile_busy = true;   // the unwinder may allocate
+    mi_profile_sample((uintptr_t)p, size);
+    mi_page_set_has_sampled(page, true);
+    tld->profile_busy = false;
+    tld->profile_countdown = mi_profile_next_countdown(heap, interval);
+  }
+  else {
+    tld->profile_countdown -= (long long)bsize;
+  }
+
+  // account for the blocks that the fast path will allocate from the free list (and by bumping
+  // the capacity), and cut the free list off before the next sample point so we come back here
+  const size_t avail = (mi_page_can_bump(page) ? page->reserved : page->capacity) - page->used;  // upper bound on the blocks available to the fast path
+  if ((long long)(avail * bsize) < tld->profile_countdown) {
+    // usual case: no need to walk the free list
+    tld->profile_countdown -= (long long)(avail * bsize);
+    return;
+  }
+  mi_block_t* prev = NULL;
+  mi_block_t* block = page->free;
+  size_t count = 0;
+  while (block != NULL && (long long)((count + 1) * bsize) < tld->profile_countdown) {
+    count++;
+    prev = block;
+    block = mi_block_next(page, block);
+  }
+  if (block == NULL && mi_page_can_bump(page)) {
+    // the fast path would continue by bumping the capacity: append the fresh blocks up to the sample
+    // point to the free list and put the next one in the local free list (which stops the bumping)
+    if (prev == NULL) { page->free_is_zero = page->is_zero_init; }
+    while (page->capacity < page->reserved) {
+      mi_block_t* const fresh = (mi_block_t*)(mi_page_start(page) + (page->capacity * bsize));
+      page->capacity++;
+      mi_stat_increase(tld->stats.page_committed, bsize);
+      if ((long long)((count + 1) * bsize) < tld->profile_countdown) {
+        mi_block_set_next(page, fresh, NULL);
+        if (prev == NULL) { page->free = fresh; }
+                     else { mi_block_set_next(page, prev, fresh); }
+        prev = fresh;
+        count++;
+      }
+      else {
+        mi_block_set_next(page, fresh, page->local_free);
+        page->local_free = fresh;
+        break;
+      }
+    }
+  }
+  tld->profile_countdown -= (long long)(count * bsize);
+  mi_assert_internal(tld->profile_countdown > 0);
+  if (block != NULL) {
+    // move the rest of the free list in front of the local free list
+    if (prev == NULL) { page->free = NULL; }
+                 else { mi_block_set_next(page, prev, NULL); }
+    mi_block_t* tail = block;
+    mi_block_t* next;
+    while ((next = mi_block_next(page, tail)) != NULL) {
+      tail = next;
+    }
+    mi_block_set_next(page, tail, page->local_free);
+    page->local_free = block;
+  }
+}
+
+// Called from the generic free path for every free `block` in a page with sampled blocks.
+void _mi_heap_profile_free(mi_page_t* page, mi_block_t* block) {
+  MI_UNUSED(page);
+  mi_profile_sample_t* const samples = mi_atomic_load_ptr_acquire(mi_profile_sample_t, &mi_profile_samples);
+  if (samples == NULL) return;
+  // lock-free lookup (as most blocks in the page are not sampled)
+  size_t idx = mi_profile_slot_of((uintptr_t)block);
+  size_t i;
+  for (i = 0; i < MI_PROFILE_MAX_PROBES; i++, idx = (idx + 1) & (MI_PROFILE_SLOTS - 1)) {
+    const uintptr_t b = mi_atomic_load_relaxed(&samples[idx].block);
+    if (b == 0) return;
+    if (b == (uintptr_t)block) break;
+  }
+  if (i >= MI_PROFILE_MAX_PROBES) return;
+  if (!mi_lock_acquire(&mi_profile_lock)) return;
+  if (mi_atomic_load_relaxed(&samples[idx].block) == (uintptr_t)block) {
+    // if the next slot is empty, the probe sequence ends here and we can clear
+    // this slot and any tombstones before it; otherwise leave a tombstone
+    if (mi_atomic_load_relaxed(&samples[(idx + 1) & (MI_PROFILE_SLOTS - 1)].block) == 0) {
+      do {
+        mi_atomic_store_release(&samples[idx].block, 0);
+        idx = (idx - 1) & (MI_PROFILE_SLOTS - 1);
+      } while (mi_atomic_load_relaxed(&samples[idx].block) == MI_PROFILE_TOMBSTONE);
+    }
+    else {
+      mi_atomic_store_release(&samples[idx].block, MI_PROFILE_TOMBSTONE);
+    }
+  }
+  mi_lock_release(&mi_profile_lock);
+}
+
+
+// ----------------------------------------------------------------
+// Output in the (legacy) heap profile format that `pprof` understands
+// ----------------------------------------------------------------
+
+typedef struct mi_profile_out_s {
+  mi_output_fun* out;
+  void*          arg;
+} mi_profile_out_t;
+
+static void mi_cdecl mi_profile_out(const char* msg, void* arg) {
+  mi_profile_out_t* const pout = (mi_profile_out_t*)arg;
+  _mi_fputs(pout->out, pout->arg, NULL, msg);
+}
+
+// copy the live sample at `idx` while holding the lock (so we can output without holding the lock)
+static bool mi_profile_sample_copy(mi_profile_sample_t* samples, size_t idx, mi_profile_sample_t* sample) {
+  if (mi_atomic_load_relaxed(&samples[idx].block) <= MI_PROFILE_TOMBSTONE) return false;
+  if (!mi_lock_acquire(&mi_profile_lock)) return false;
+  const uintptr_t b = mi_atomic_load_relaxed(&samples[idx].block);
+  const bool live = (b > MI_PROFILE_TOMBSTONE);
+  if (live) {
+    mi_atomic_store_relaxed(&sample->block, b);
+    sample->size = samples[idx].size;
+    sample->frame_count = samples[idx].frame_count;
+    _mi_memcpy(sample->frames, samples[idx].frames, sample->frame_count * sizeof(void*));
+  }
+  mi_lock_release(&mi_profile_lock);
+  return live;
+}
+
+void mi_heap_profile_dump(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  mi_heap_t* const heap = mi_heap_get_default();
+  const bool busy = heap->tld->profile_busy;
+  heap->tld->profile_busy = true;   // don't sample while dumping (`out` may allocate)
+  mi_profile_sample_t* const samples = mi_atomic_load_ptr_acquire(mi_profile_sample_t, &mi_profile_samples);
+  mi_profile_sample_t sample;
+
+  // totals
+  size_t count = 0;
+  size_t total = 0;
+  for (size_t i = 0; samples != NULL && i < MI_PROFILE_SLOTS; i++) {
+    if (mi_profile_sample_copy(samples, i, &sample)) {
+      count++;
+      total += sample.size;
+    }
+  }
+  const size_t interval = mi_option_get_size(mi_option_heap_profile_interval);
+  _mi_fprintf(out, arg, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", count, total, count, total, (interval == 0 ? 1 : interval));
+
+  // live samples
+  for (size_t i = 0; samples != NULL && i < MI_PROFILE_SLOTS; i++) {
+    if (mi_profile_sample_copy(samples, i, &sample)) {
+      _mi_fprintf(out, arg, "1: %zu [1: %zu] @", sample.size, sample.size);
+      for (size_t j = 0; j < sample.frame_count; j++) {
+        _mi_fprintf(out, arg, " %p", sample.frames[j]);
+      }
+      _mi_fprintf(out, arg, "\n");
+    }
+  }
+  const size_t dropped = mi_atomic_load_relaxed(&mi_profile_dropped);
+  if (dropped > 0) {
+    _mi_verbose_message("heap profile: dropped %zu samples as the sample table was full\n", dropped);
+  }
+
+  // memory mappings for symbolization
+  _mi_fprintf(out, arg, "\nMAPPED_LIBRARIES:\n");
+  mi_profile_out_t pout = { out, arg };
+  _mi_prim_out_mappings(&mi_profile_out, &pout);
+  heap->tld->profile_busy = busy;
+}
@@ -85,21 +85,52 @@ static void mi_segment_enqueue(mi_segment_queue_t* queue, mi_segment_t* segment)
   }
 }
 
-static mi_segment_queue_t* mi_segment_free_queue_of_kind(mi_page_kind_t kind, mi_segments_tld_t* tld) {
-  if (kind == MI_PAGE_SMALL) return &tld->small_free;
-  else if (kind == MI_PAGE_MEDIUM) return &tld->medium_free;
+static void mi_segment_queue_append(mi_segment_queue_t* queue, mi_segment_queue_t* append) {
+  if (append->first == NULL) return;
+  if (queue->last == NULL) {
+    mi_assert_internal(queue->first == NULL);
+    queue->first = append->first;
+  }
+  else {
+    mi_assert_internal(queue->last->next == NULL);
+    queue->last->next = append->first;
+    append->first->prev = queue->last;
+  }
+  queue->last = append->last;
+  append->first = append->last = NULL;
+}
+
+// Segments with free pages are kept in queues bucketed by fill level (the fraction of used pages)
+// so new pages are allocated in the fullest segments first and sparsely used segments can drain.
+static size_t mi_segment_fill_bucket(size_t used, size_t capacity) {
+  const size_t bucket = (used * MI_SEGMENT_FILL_BUCKETS) / capacity;
+  return (bucket >= MI_SEGMENT_FILL_BUCKETS ? MI_SEGMENT_FILL_BUCKETS - 1 : bucket);
+}
+
+static mi_segment_queue_t* mi_segment_free_queue_of_kind(mi_page_kind_t kind, size_t bucket, mi_segments_tld_t* tld) {
+  mi_assert_internal(bucket < MI_SEGMENT_FILL_BUCKETS);
+  if (kind == MI_PAGE_SMALL) return &tld->small_free[bucket];
+  else if (kind == MI_PAGE_MEDIUM) return &tld->medium_free[bucket];
   else return NULL;
 }
 
+// the free queue of a segment with `used` pages in use
+static mi_segment_queue_t* mi_segment_free_queue_at(const mi_segment_t* segment, size_t used, mi_segments_tld_t* tld) {
+  return mi_segment_free_queue_of_kind(segment->page_kind, mi_segment_fill_bucket(used, segment->capacity), tld);
+}
+
 static mi_segment_queue_t* mi_segment_free_queue(const mi_segment_t* segment, mi_segments_tld_t* tld) {
-  return mi_segment_free_queue_of_kind(segment->page_kind, tld);
+  return mi_segment_free_queue_at(segment, segment->used, tld);
+}
+
+static bool mi_segment_is_in_queue(const mi_segment_queue_t* queue, const mi_segment_t* segment) {
+  return (queue!=NULL && (segment->next != NULL || segment->prev != NULL || queue->first == segment));
 }
 
 // remove from free queue if it is in one
 static void mi_segment_remove_from_free_queue(mi_segment_t* segment, mi_segments_tld_t* tld) {
   mi_segment_queue_t* queue = mi_segment_free_queue(segment, tld); // may be NULL
-  bool in_queue = (queue!=NULL && (segment->next != NULL || segment->prev != NULL || queue->first == segment));
-  if (in_queue) {
+  if (mi_segment_is_in_queue(queue, segment)) {
     mi_segment_queue_remove(queue, segment);
   }
 }
@@ -108,6 +139,16 @@ static void mi_segment_insert_in_free_queue(mi_segment_t* segment, mi_segments_t
   mi_segment_enqueue(mi_segment_free_queue(segment, tld), segment);
 }
 
+// move a segment in a free queue to the queue of its fill level after its used page count changed from `used_old`
+static void mi_segment_update_free_queue(mi_segment_t* segment, size_t used_old, mi_segments_tld_t* tld) {
+  mi_segment_queue_t* const from = mi_segment_free_queue_at(segment, used_old, tld);
+  mi_segment_queue_t* const to = mi_segment_free_queue(segment, tld);
+  if (from != to && mi_segment_is_in_queue(from, segment)) {
+    mi_segment_queue_remove(from, segment);
+    mi_segment_enqueue(to, segment);
+  }
+}
+
 
 /* -----------------------------------------------------------
  Invariant checking
@@ -234,7 +275,9 @@ static void mi_segment_protect(mi_segment_t* segment, bool protect, mi_os_tld_t*
   Page reset
 ----------------------------------------------------------- */
 
-static void mi_page_purge(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
+static bool mi_page_purge_thp(mi_segment_t* segment, mi_page_t* page, bool force, mi_segments_tld_t* tld);
+
+static void mi_page_purge(mi_segment_t* segment, mi_page_t* page, bool force, mi_segments_tld_t* tld) {
   // todo: should we purge the guard page as well when MI_SECURE>=2 ?
   mi_assert_internal(page->is_committed);
   mi_assert_internal(!page->segment_in_use);
@@ -242,12 +285,62 @@ static void mi_page_purge(mi_segment_t* segment, mi_page_t* page, mi_segments_tl
   mi_assert_internal(page->used == 0);
   mi_assert_internal(page->free == NULL);
   mi_assert_expensive(!mi_pages_purge_contains(page, tld));
+  if (segment->is_thp && mi_page_purge_thp(segment, page, force, tld)) return;
   size_t psize;
   void* start = mi_segment_raw_page_start(segment, page, &psize);
   const bool needs_recommit = _mi_os_purge(start, psize, tld->stats);
   if (needs_recommit) { page->is_committed = false; }
 }
 
+static void mi_page_purge_push(mi_page_t* page, mi_segments_tld_t* tld);
+static void mi_page_purge_remove(mi_page_t* page, mi_segments_tld_t* tld);
+static bool mi_page_purge_is_expired(mi_page_t* page, mi_msecs_t now);
+
+// In a segment that uses transparent huge pages we purge whole huge OS pages only,
+// as purging part of a huge OS page splits it (and khugepaged may collapse it again later on).
+// A free page is only purged once all pages in its huge OS page are free; it stays scheduled
+// until then (or until the other scheduled pages in the huge OS page expire as well) and
+// the first one that can purges them all at once. In the huge OS page that contains the segment
+// info we purge everything after the segment info. On a forced purge (or if pages are purged
+// immediately) we do not wait and fall back to purging the page by itself if needed.
+// Returns `false` if the page should be purged by itself.
+static bool mi_page_purge_thp(mi_segment_t* segment, mi_page_t* page, bool force, mi_segments_tld_t* tld) {
+  const size_t lsize = _mi_os_large_page_size();
+  mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM);
+  const size_t psize = (size_t)1 << segment->page_shift;
+  if (psize >= lsize || lsize > MI_SEGMENT_SIZE) return false;
+  const size_t per_huge = lsize / psize;    // pages per huge OS page
+  const size_t first = (page->segment_idx / per_huge) * per_huge;
+  const mi_msecs_t now = _mi_clock_now();
+  for (size_t i = first; i < first + per_huge && i < segment->capacity; i++) {
+    mi_page_t* other = &segment->pages[i];
+    if (!other->segment_in_use && !other->is_committed) return false;  // already split
+    const bool wait = (other->segment_in_use || (!force && other != page && !mi_page_not_in_queue(other, tld) && !mi_page_purge_is_expired(other, now)));
+    if (wait) {
+      if (force || mi_option_get(mi_option_purge_delay) <= 0) return false;  // cannot wait
+      mi_page_purge_push(page, tld);  // purge later
+      return true;
+    }
+  }
+  for (size_t i = first; i < first + per_huge && i < segment->capacity; i++) {
+    mi_page_purge_remove(&segment->pages[i], tld);
+  }
+  size_t start_offset = 0;
+  if (first == 0) {
+    // keep the segment info (and possible guard page) committed
+    size_t page_size;
+    start_offset = (size_t)(mi_segment_raw_page_start(segment, &segment->pages[0], &page_size) - (uint8_t*)segment);
+  }
+  uint8_t* start = (uint8_t*)segment + (first * psize) + start_offset;
+  const bool needs_recommit = _mi_os_purge(start, lsize - start_offset, tld->stats);
+  if (needs_recommit) {
+    for (size_t i = first; i < first + per_huge && i < segment->capacity; i++) {
+      segment->pages[i].is_committed = false;
+    }
+  }
+  return true;
+}
+
 static bool mi_page_ensure_committed(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
   if (page->is_committed) return true;
   mi_assert_internal(segment->allow_decommit);
@@ -310,23 +403,28 @@ static void mi_segment_schedule_purge(mi_segment_t* segment, mi_page_t* page, mi
 
   if (mi_option_get(mi_option_purge_delay) == 0) {
     // purge immediately?
-    mi_page_purge(segment, page, tld);
+    mi_page_purge(segment, page, false, tld);
   }
   else if (mi_option_get(mi_option_purge_delay) > 0) {   // no purging if the delay is negative
     // otherwise push on the delayed page reset queue
-    mi_page_queue_t* pq = &tld->pages_purge;
-    // push on top
-    mi_page_purge_set_expire(page);
-    page->next = pq->first;
-    page->prev = NULL;
-    if (pq->first == NULL) {
-      mi_assert_internal(pq->last == NULL);
-      pq->first = pq->last = page;
-    }
-    else {
-      pq->first->prev = page;
-      pq->first = page;
-    }
+    mi_page_purge_push(page, tld);
+  }
+}
+
+static void mi_page_purge_push(mi_page_t* page, mi_segments_tld_t* tld) {
+  mi_assert_internal(mi_page_not_in_queue(page,tld));
+  mi_page_queue_t* pq = &tld->pages_purge;
+  // push on top
+  mi_page_purge_set_expire(page);
+  page->next = pq->first;
+  page->prev = NULL;
+  if (pq->first == NULL) {
+    mi_assert_internal(pq->last == NULL);
+    pq->first = pq->last = page;
+  }
+  else {
+    pq->first->prev = page;
+    pq->first = page;
   }
 }
 
@@ -353,7 +451,7 @@ static void mi_segment_remove_all_purges(mi_segment_t* segment, bool force_purge
     if (!page->segment_in_use) {
       mi_page_purge_remove(page, tld);
       if (force_purge && page->is_committed) {
-        mi_page_purge(segment, page, tld);
+        mi_page_purge(segment, page, true, tld);
       }
     }
     else {
@@ -368,20 +466,13 @@ static void mi_pages_try_purge(bool force, mi_segments_tld_t* tld) {
   mi_msecs_t now = _mi_clock_now();
   mi_page_queue_t* pq = &tld->pages_purge;
   // from oldest up to the first that has not expired yet
+  // (we take the last page each time as purging a page in a segment that uses transparent
+  //  huge pages can remove other pages from the queue, or push the page back on top with a new expiration)
   mi_page_t* page = pq->last;
   while (page != NULL && (force || mi_page_purge_is_expired(page,now))) {
-    mi_page_t* const prev = page->prev; // save previous field
     mi_page_purge_remove(page, tld);    // remove from the list to maintain invariant for mi_page_purge
-    mi_page_purge(_mi_page_segment(page), page, tld);
-    page = prev;
-  }
-  // discard the reset pages from the queue
-  pq->last = page;
-  if (page != NULL){
-    page->next = NULL;
-  }
-  else {
-    pq->first = NULL;
+    mi_page_purge(_mi_page_segment(page), page, force, tld);
+    page = pq->last;
   }
 }
 
@@ -420,12 +511,11 @@ static uint8_t* mi_segment_raw_page_start(const mi_segment_t* segment, const mi_
   return p;
 }
 
-// Start of the page available memory; can be used on uninitialized pages (only `segment_idx` must be set)
-uint8_t* _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* page, size_t* page_size)
+// Start of the page available memory for blocks of `block_size`; can be used on uninitialized pages (only `segment_idx` must be set)
+uint8_t* _mi_segment_page_start_ex(const mi_segment_t* segment, const mi_page_t* page, size_t block_size, size_t* page_size)
 {
   size_t   psize;
   uint8_t* p = mi_segment_raw_page_start(segment, page, &psize);
-  const size_t block_size = mi_page_block_size(page);
   if (/*page->segment_idx == 0 &&*/ block_size > 0 && block_size <= MI_MAX_ALIGN_GUARANTEE) {
     // for small and medium objects, ensure the page start is aligned with the block size (PR#66 by kickunderscore)
     mi_assert_internal(segment->page_kind <= MI_PAGE_MEDIUM);
@@ -443,6 +533,11 @@ uint8_t* _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* pa
   return p;
 }
 
+// Start of the page available memory; can be used on uninitialized pages (only `segment_idx` must be set)
+uint8_t* _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* page, size_t* page_size) {
+  return _mi_segment_page_start_ex(segment, page, mi_page_block_size(page), page_size);
+}
+
 
 static size_t mi_segment_calculate_sizes(size_t capacity, size_t required, size_t* pre_size, size_t* info_size)
 {
@@ -463,6 +558,8 @@ static size_t mi_segment_calculate_sizes(size_t capacity, size_t required, size_
     required = _mi_align_up(required, page_size);
   }
 
+  // the segment info (and guard page) must fit in the first page (see `MI_GEOMETRY`)
+  mi_assert_internal(required > 0 || capacity == 1 || isize + guardsize < MI_SEGMENT_SIZE / capacity);
   if (info_size != NULL) *info_size = isize;
   if (pre_size != NULL)  *pre_size  = isize + guardsize;
   return (required==0 ? MI_SEGMENT_SIZE : _mi_align_up( required + isize + 2*guardsize, MI_PAGE_HUGE_ALIGN) );
@@ -528,8 +625,8 @@ void _mi_segments_collect(bool force, mi_segments_tld_t* tld) {
    Segment allocation
 ----------------------------------------------------------- */
 
-static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignment, mi_arena_id_t req_arena_id,
-                                         size_t pre_size, size_t info_size, bool commit, size_t segment_size,
+static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignment, mi_arena_id_t req_arena_id, int req_numa_node,
+                                         size_t pre_size, size_t info_size, bool commit, size_t segment_size, bool os_only,
                                          mi_segments_tld_t* tld, mi_os_tld_t* tld_os)
 {
   mi_memid_t memid;
@@ -542,7 +639,14 @@ static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignme
     segment_size = segment_size + (align_offset - pre_size);  // adjust the segment size
   }
 
-  mi_segment_t* segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, alignment, align_offset, commit, allow_large, req_arena_id, &memid, tld_os);
+  mi_segment_t* segment;
+  if (os_only && align_offset == 0 && req_arena_id == _mi_arena_id_none() && !mi_option_is_enabled(mi_option_disallow_os_alloc)) {
+    // allocate directly from the OS (so it can be remapped)
+    segment = (mi_segment_t*)_mi_os_alloc_aligned(segment_size, alignment, commit, false /* allow large */, &memid, tld_os->stats);
+  }
+  else {
+    segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, alignment, align_offset, commit, allow_large, req_arena_id, req_numa_node, &memid, tld_os);
+  }
   if (segment == NULL) {
     return NULL;  // failed to allocate
   }
@@ -571,7 +675,7 @@ static mi_segment_t* mi_segment_os_alloc(bool eager_delayed, size_t page_alignme
 
 // Allocate a segment from the OS aligned to `MI_SEGMENT_SIZE` .
 static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind, size_t page_shift, size_t page_alignment,
-                                      mi_arena_id_t req_arena_id, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
+                                      mi_arena_id_t req_arena_id, int req_numa_node, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
 {
   // required is only > 0 for huge page allocations
   mi_assert_internal((required > 0 && page_kind > MI_PAGE_LARGE)|| (required==0 && page_kind <= MI_PAGE_LARGE));
@@ -603,7 +707,8 @@ static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind,
   const bool init_commit = eager; // || (page_kind >= MI_PAGE_LARGE);
 
   // Allocate the segment from the OS (segment_size can change due to alignment)
-  mi_segment_t* segment = mi_segment_os_alloc(eager_delayed, page_alignment, req_arena_id, pre_size, info_size, init_commit, init_segment_size, tld, os_tld);
+  const bool os_only = (page_kind == MI_PAGE_HUGE && tld->huge_os_only);
+  mi_segment_t* segment = mi_segment_os_alloc(eager_delayed, page_alignment, req_arena_id, req_numa_node, pre_size, info_size, init_commit, init_segment_size, os_only, tld, os_tld);
   if (segment == NULL) return NULL;
   mi_assert_internal(segment != NULL && (uintptr_t)segment % MI_SEGMENT_SIZE == 0);
   mi_assert_internal(segment->memid.is_pinned ? segment->memid.initially_committed : true);
@@ -629,6 +734,8 @@ static mi_segment_t* mi_segment_alloc(size_t required, mi_page_kind_t page_kind,
   segment->segment_info_size = pre_size;
   segment->thread_id  = _mi_thread_id();
   segment->cookie     = _mi_ptr_cookie(segment);
+  segment->is_thp     = (page_kind <= MI_PAGE_MEDIUM && mi_option_is_enabled(mi_option_thp_aware) &&
+                         _mi_arena_memid_is_thp(segment->memid, segment->segment_size));  // arena memory may have been advised before
 
   // set protection
   mi_segment_protect(segment, true, tld->os);
@@ -649,8 +756,12 @@ static void mi_segment_free(mi_segment_t* segment, bool force, mi_segments_tld_t
   mi_segment_remove_all_purges(segment, false /* don't force as we are about to free */, tld);
   mi_segment_remove_from_free_queue(segment, tld);
 
-  mi_assert_expensive(!mi_segment_queue_contains(&tld->small_free, segment));
-  mi_assert_expensive(!mi_segment_queue_contains(&tld->medium_free, segment));
+  #if (MI_DEBUG>=3)
+  for (size_t bucket = 0; bucket < MI_SEGMENT_FILL_BUCKETS; bucket++) {
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->small_free[bucket], segment));
+    mi_assert_expensive(!mi_segment_queue_contains(&tld->medium_free[bucket], segment));
+  }
+  #endif
   mi_assert(segment->next == NULL);
   mi_assert(segment->prev == NULL);
   _mi_stat_decrease(&tld->stats->page_committed, segment->segment_info_size);
@@ -668,6 +779,14 @@ static bool mi_segment_has_free(const mi_segment_t* segment) {
   return (segment->used < segment->capacity);
 }
 
+// A small or medium segment that has all its pages in use is densely used and
+// we advise it to use transparent huge pages (if `mi_option_thp_aware` is enabled).
+static void mi_segment_thp_try_advise(mi_segment_t* segment, mi_segments_tld_t* tld) {
+  if (segment->is_thp || !segment->allow_purge) return;
+  if (!mi_option_is_enabled(mi_option_thp_aware) || segment->segment_size < _mi_os_large_page_size()) return;
+  segment->is_thp = _mi_arena_thp_advise(segment, segment->segment_size, segment->memid, tld->stats);
+}
+
 static bool mi_segment_page_claim(mi_segment_t* segment, mi_page_t* page, mi_segments_tld_t* tld) {
   mi_assert_internal(_mi_page_segment(page) == segment);
   mi_assert_internal(!page->segment_in_use);
@@ -679,12 +798,14 @@ static bool mi_segment_page_claim(mi_segment_t* segment, mi_page_t* page, mi_seg
   // set in-use before doing unreset to prevent delayed reset
   page->segment_in_use = true;
   segment->used++;
+  mi_segment_update_free_queue(segment, segment->used - 1, tld);
   mi_assert_internal(page->segment_in_use && page->is_committed && page->used==0 && !mi_pages_purge_contains(page,tld));
   mi_assert_internal(segment->used <= segment->capacity);
   if (segment->used == segment->capacity && segment->page_kind <= MI_PAGE_MEDIUM) {
     // if no more free pages, remove from the queue
     mi_assert_internal(!mi_segment_has_free(segment));
     mi_segment_remove_from_free_queue(segment, tld);
+    mi_segment_thp_try_advise(segment, tld);
   }
   return true;
 }
@@ -727,6 +848,7 @@ static void mi_segment_page_clear(mi_segment_t* segment, mi_page_t* page, mi_seg
   page->heap_tag = heap_tag;
   page->page_start = page_start;
   segment->used--;
+  mi_segment_update_free_queue(segment, segment->used + 1, tld);
 
   // schedule purge
   mi_segment_schedule_purge(segment, page, tld);
@@ -810,6 +932,12 @@ static void mi_segment_abandon(mi_segment_t* segment, mi_segments_tld_t* tld) {
     tld->reclaim_count--;
     segment->was_reclaimed = false;
   }
+  // remember the last abandoned arena segments for a warm start of a thread that reuses our metadata
+  const size_t hint = _mi_arena_segment_abandoned_hint(segment);
+  if (hint != 0) {
+    tld->warm_hints[tld->warm_count % MI_WARM_SEGMENTS] = hint;
+    tld->warm_count++;
+  }
   _mi_arena_segment_mark_abandoned(segment);
 }
 
@@ -872,6 +1000,17 @@ static bool mi_segment_check_free(mi_segment_t* segment, size_t block_size, bool
 
 // Reclaim a segment; returns NULL if the segment was freed
 // set `right_page_reclaimed` to `true` if it reclaimed a page of the right `block_size` that was not full.
+// count reclaims of segments that live in an arena on another numa node than the heap prefers
+static void mi_segment_reclaim_count_numa(mi_segment_t* segment, mi_heap_t* heap, mi_segments_tld_t* tld) {
+  if (_mi_os_numa_node_count() <= 1) return;
+  const int segment_node = _mi_arena_memid_numa_node(segment->memid);
+  if (segment_node < 0) return;
+  const int heap_node = (heap->numa_node >= 0 ? heap->numa_node : _mi_os_numa_node(&heap->tld->os));
+  if (segment_node != heap_node) {
+    _mi_stat_counter_increase(&tld->stats->arena_numa_crossover_count, 1);
+  }
+}
+
 static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap, size_t requested_block_size, bool* right_page_reclaimed, mi_segments_tld_t* tld) {
   if (right_page_reclaimed != NULL) { *right_page_reclaimed = false; }
   // can be 0 still with abandoned_next, or already a thread id for segments outside an arena that are reclaimed on a free.
@@ -885,6 +1024,7 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
   mi_assert_internal(segment->next == NULL && segment->prev == NULL);
   mi_assert_expensive(mi_segment_is_valid(segment, tld));
   _mi_stat_decrease(&tld->stats->segments_abandoned, 1);
+  mi_segment_reclaim_count_numa(segment, heap, tld);
 
   for (size_t i = 0; i < segment->capacity; i++) {
     mi_page_t* page = &segment->pages[i];
@@ -962,13 +1102,58 @@ bool _mi_segment_attempt_reclaim(mi_heap_t* heap, mi_segment_t* segment) {
 void _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld) {
   mi_segment_t* segment;
   mi_arena_field_cursor_t current;
-  _mi_arena_field_cursor_init(heap, tld->subproc, true /* visit all, blocking */, &current);
+  _mi_arena_field_cursor_init(heap, tld->subproc, true /* visit all, blocking */, MI_PAGE_HUGE /* any kind */, &current);
   while ((segment = _mi_arena_segment_clear_abandoned_next(&current)) != NULL) {
     mi_segment_reclaim(segment, heap, 0, NULL, tld);
   }
   _mi_arena_field_cursor_done(&current);
 }
 
+// take over the segment queues and counts of a thread that handed off its memory
+// (called from `heap.c:_mi_heap_adopt` after the segments are owned by the current thread)
+void _mi_segments_absorb(mi_segments_tld_t* tld, mi_segments_tld_t* from) {
+  mi_assert_internal(tld->subproc == from->subproc);
+  for (size_t bucket = 0; bucket < MI_SEGMENT_FILL_BUCKETS; bucket++) {
+    mi_segment_queue_append(&tld->small_free[bucket], &from->small_free[bucket]);
+    mi_segment_queue_append(&tld->medium_free[bucket], &from->medium_free[bucket]);
+  }
+  // append the pending purges (these are older than ours)
+  mi_page_queue_t* const pq = &tld->pages_purge;
+  mi_page_queue_t* const append = &from->pages_purge;
+  if (append->first != NULL) {
+    if (pq->last == NULL) { pq->first = append->first; }
+                     else { pq->last->next = append->first; append->first->prev = pq->last; }
+    pq->last = append->last;
+    append->first = append->last = NULL;
+  }
+  // and move the segment counts (and statistics)
+  _mi_stat_decrease(&from->stats->segments, from->count);
+  _mi_stat_increase(&tld->stats->segments, from->count);
+  tld->count += from->count;
+  if (tld->count > tld->peak_count) tld->peak_count = tld->count;
+  tld->current_size += from->current_size;
+  if (tld->current_size > tld->peak_size) tld->peak_size = tld->current_size;
+  tld->reclaim_count += from->reclaim_count;
+  from->count = 0;
+  from->current_size = 0;
+  from->reclaim_count = 0;
+}
+
+// reclaim the segments abandoned by the previous owner of the thread metadata of a new thread
+// (called from `init.c:_mi_thread_heap_init`); these are likely still warm in the cache.
+void _mi_segments_warm_start(mi_heap_t* heap, const size_t* hints, size_t count) {
+  mi_segments_tld_t* const tld = &heap->tld->segments;
+  for (size_t i = 0; i < count; i++) {
+    mi_segment_t* const segment = _mi_arena_segment_clear_abandoned_hint(tld->subproc, hints[i]);
+    if (segment == NULL) continue;  // already reclaimed (or freed) by another thread
+    if (!_mi_heap_memid_is_suitable(heap, segment->memid)) {
+      _mi_arena_segment_mark_abandoned(segment);  // don't reclaim from an exclusive arena; abandon it again
+      continue;
+    }
+    mi_segment_reclaim(segment, heap, 0, NULL, tld);
+  }
+}
+
 static long mi_segment_get_reclaim_tries(mi_segments_tld_t* tld) {
   // limit the tries to 10% (default) of the abandoned segments with at least 8 and at most 1024 tries.
   const size_t perc = (size_t)mi_option_get_clamp(mi_option_max_segment_reclaim, 0, 100);
@@ -990,12 +1175,12 @@ static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t block_size,
   mi_segment_t* result = NULL;
   mi_segment_t* segment = NULL;
   mi_arena_field_cursor_t current;
-  _mi_arena_field_cursor_init(heap, tld->subproc, false /* non-blocking */, &current);
+  _mi_arena_field_cursor_init(heap, tld->subproc, false /* non-blocking */, page_kind, &current);
   while ((max_tries-- > 0) && ((segment = _mi_arena_segment_clear_abandoned_next(&current)) != NULL))
   {
     mi_assert(segment->subproc == heap->tld->segments.subproc); // cursor only visits segments in our sub-process
     segment->abandoned_visits++;
-    // todo: should we respect numa affinity for abondoned reclaim? perhaps only for the first visit?
+    // note: the cursor visits the arenas on the numa node of the heap first
     // todo: an arena exclusive heap will potentially visit many abandoned unsuitable segments and use many tries
     // Perhaps we can skip non-suitable ones in a better way?
     bool is_suitable = _mi_heap_memid_is_suitable(heap, segment->memid);
@@ -1054,7 +1239,7 @@ static mi_segment_t* mi_segment_reclaim_or_alloc(mi_heap_t* heap, size_t block_s
     return segment;
   }
   // 2. otherwise allocate a fresh segment
-  return mi_segment_alloc(0, page_kind, page_shift, 0, heap->arena_id, tld, os_tld);
+  return mi_segment_alloc(0, page_kind, page_shift, 0, heap->arena_id, heap->numa_node, tld, os_tld);
 }
 
 
@@ -1083,11 +1268,13 @@ static mi_page_t* mi_segment_page_alloc_in(mi_segment_t* segment, mi_segments_tl
 }
 
 static mi_page_t* mi_segment_page_try_alloc_in_queue(mi_heap_t* heap, mi_page_kind_t kind, mi_segments_tld_t* tld) {
-  // find an available segment the segment free queue
-  mi_segment_queue_t* const free_queue = mi_segment_free_queue_of_kind(kind, tld);
-  for (mi_segment_t* segment = free_queue->first; segment != NULL; segment = segment->next) {
-    if (_mi_arena_memid_is_suitable(segment->memid, heap->arena_id) && mi_segment_has_free(segment)) {
-      return mi_segment_page_alloc_in(segment, tld);
+  // find an available segment in the segment free queues, starting with the fullest segments
+  for (size_t bucket = MI_SEGMENT_FILL_BUCKETS; bucket > 0; bucket--) {
+    mi_segment_queue_t* const free_queue = mi_segment_free_queue_of_kind(kind, bucket - 1, tld);
+    for (mi_segment_t* segment = free_queue->first; segment != NULL; segment = segment->next) {
+      if (_mi_arena_memid_is_suitable(segment->memid, heap->arena_id) && mi_segment_has_free(segment)) {
+        return mi_segment_page_alloc_in(segment, tld);
+      }
     }
   }
   return NULL;
@@ -1135,9 +1322,9 @@ static mi_page_t* mi_segment_large_page_alloc(mi_heap_t* heap, size_t block_size
   return page;
 }
 
-static mi_page_t* mi_segment_huge_page_alloc(size_t size, size_t page_alignment, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
+static mi_page_t* mi_segment_huge_page_alloc(size_t size, size_t page_alignment, mi_arena_id_t req_arena_id, int req_numa_node, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
 {
-  mi_segment_t* segment = mi_segment_alloc(size, MI_PAGE_HUGE, MI_SEGMENT_SHIFT + 1, page_alignment, req_arena_id, tld, os_tld);
+  mi_segment_t* segment = mi_segment_alloc(size, MI_PAGE_HUGE, MI_SEGMENT_SHIFT + 1, page_alignment, req_arena_id, req_numa_node, tld, os_tld);
   if (segment == NULL) return NULL;
   mi_assert_internal(mi_segment_page_size(segment) - segment->segment_info_size - (2*(MI_SECURE == 0 ? 0 : _mi_os_page_size())) >= size);
   #if MI_HUGE_PAGE_ABANDON
@@ -1214,6 +1401,50 @@ void _mi_segment_huge_page_reset(mi_segment_t* segment, mi_page_t* page, mi_bloc
 }
 #endif
 
+// Resize a huge page (owned by the current thread) in place to hold `block_size` bytes, or, if `allow_move`
+// is set, possibly move the whole segment to a new address (without copying, see `_mi_os_remap`).
+// Returns the (possibly moved) page, or NULL if the segment cannot be remapped in which case it is unchanged.
+// Only segments directly allocated from the OS can be remapped; arena memory falls back to copying.
+mi_page_t* _mi_segment_huge_page_remap(mi_page_t* page, size_t block_size, bool allow_move, mi_segments_tld_t* tld) {
+  mi_segment_t* const segment = _mi_page_segment(page);
+  mi_assert_internal(segment->page_kind == MI_PAGE_HUGE && segment->used == 1);
+  mi_assert_internal(segment->thread_id == _mi_thread_id());
+  if (MI_SECURE != 0 || segment->memid.memkind != MI_MEM_OS || !page->is_committed) return NULL;
+
+  size_t pre_size;
+  const size_t segment_size = mi_segment_calculate_sizes(1, block_size, &pre_size, NULL);
+  const size_t old_segment_size = segment->segment_size;
+  const size_t old_block_size = page->block_size;
+  mi_assert_internal(pre_size == segment->segment_info_size);
+  if (segment_size == old_segment_size) return page;
+
+  // remove from the segment map first as we cannot access the segment anymore if it moved
+  _mi_segment_map_freed_at(segment);
+  mi_memid_t memid = segment->memid;
+  mi_segment_t* const newsegment = (mi_segment_t*)_mi_os_remap(segment, old_segment_size, segment_size, MI_SEGMENT_SIZE, allow_move, &memid, tld->stats);
+  if (newsegment == NULL) {
+    _mi_segment_map_allocated_at(segment);
+    return NULL;
+  }
+  mi_assert_internal(allow_move || newsegment == segment);
+  newsegment->memid = memid;
+  newsegment->segment_size = segment_size;
+  newsegment->cookie = _mi_ptr_cookie(newsegment);
+  _mi_segment_map_allocated_at(newsegment);
+
+  // update the page
+  mi_page_t* const newpage = &newsegment->pages[0];
+  size_t psize;
+  newpage->page_start = mi_segment_raw_page_start(newsegment, newpage, &psize);
+  newpage->block_size = psize;
+  if (psize > old_block_size) { _mi_stat_increase(&tld->stats->page_committed, psize - old_block_size); }
+                         else { _mi_stat_decrease(&tld->stats->page_committed, old_block_size - psize); }
+  tld->current_size = tld->current_size - old_segment_size + segment_size;
+  if (tld->current_size > tld->peak_size) tld->peak_size = tld->current_size;
+  mi_assert_expensive(mi_segment_is_valid(newsegment, tld));
+  return newpage;
+}
+
 /* -----------------------------------------------------------
    Page allocation
 ----------------------------------------------------------- */
@@ -1225,7 +1456,7 @@ mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t pag
     mi_assert_internal(page_alignment >= MI_SEGMENT_SIZE);
     //mi_assert_internal((MI_SEGMENT_SIZE % page_alignment) == 0);
     if (page_alignment < MI_SEGMENT_SIZE) { page_alignment = MI_SEGMENT_SIZE; }
-    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, tld, os_tld);
+    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, heap->numa_node, tld, os_tld);
   }
   else if (block_size <= MI_SMALL_OBJ_SIZE_MAX) {
     page = mi_segment_small_page_alloc(heap, block_size, tld, os_tld);
@@ -1237,7 +1468,7 @@ mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t pag
     page = mi_segment_large_page_alloc(heap, block_size, tld, os_tld);
   }
   else {
-    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, tld, os_tld);
+    page = mi_segment_huge_page_alloc(block_size, page_alignment, heap->arena_id, heap->numa_node, tld, os_tld);
   }
   mi_assert_expensive(page == NULL || mi_segment_is_valid(_mi_page_segment(page),tld));
   mi_assert_internal(page == NULL || (mi_segment_page_size(_mi_page_segment(page)) - (MI_SECURE == 0 ? 0 : _mi_os_page_size())) >= block_size);
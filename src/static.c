@@ -20,17 +20,20 @@ terms of the MIT license. A copy of the license can be found in the file
 // containing the whole library. If it is linked first
 // it will override all the standard library allocation
 // functions (on Unix's).
+#include "bitmap.h"         // first, as it may include <immintrin.h> which declares `posix_memalign` (before our override in C++)
 #include "alloc.c"          // includes alloc-override.c
 #include "alloc-aligned.c"
 #include "alloc-posix.c"
 #include "arena.c"
 #include "bitmap.c"
+#include "cpu-cache.c"
 #include "heap.c"
 #include "init.c"
 #include "libc.c"
 #include "options.c"
 #include "os.c"
 #include "page.c"           // includes page-queue.c
+#include "profile.c"
 #include "random.c"
 #include "segment.c"
 #include "segment-map.c"
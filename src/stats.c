@@ -113,16 +113,26 @@ static void mi_stats_add(mi_stats_t* stats, const mi_stats_t* src) {
   mi_stat_counter_add(&stats->commit_calls, &src->commit_calls, 1);
   mi_stat_counter_add(&stats->reset_calls, &src->reset_calls, 1);
   mi_stat_counter_add(&stats->purge_calls, &src->purge_calls, 1);
+  mi_stat_counter_add(&stats->purge_background, &src->purge_background, 1);
+  mi_stat_counter_add(&stats->arena_numa_crossover_count, &src->arena_numa_crossover_count, 1);
 
   mi_stat_counter_add(&stats->page_no_retire, &src->page_no_retire, 1);
   mi_stat_counter_add(&stats->searches, &src->searches, 1);
   mi_stat_counter_add(&stats->normal_count, &src->normal_count, 1);
   mi_stat_counter_add(&stats->huge_count, &src->huge_count, 1);  
+  mi_stat_counter_add(&stats->remap_calls, &src->remap_calls, 1);
+  mi_stat_counter_add(&stats->realloc_no_copy, &src->realloc_no_copy, 1);
+  mi_stat_counter_add(&stats->page_churn, &src->page_churn, 1);
+  mi_stat_counter_add(&stats->thp_advised, &src->thp_advised, 1);
+  mi_stat_counter_add(&stats->abandoned_hint_reclaim, &src->abandoned_hint_reclaim, 1);
 #if MI_STAT>1
   for (size_t i = 0; i <= MI_BIN_HUGE; i++) {
     if (src->normal_bins[i].allocated > 0 || src->normal_bins[i].freed > 0) {
       mi_stat_add(&stats->normal_bins[i], &src->normal_bins[i], 1);
     }
+    if (src->page_churn_bins[i].total > 0) {
+      mi_stat_counter_add(&stats->page_churn_bins[i], &src->page_churn_bins[i], 1);
+    }
   }
 #endif
 }
@@ -330,18 +340,32 @@ static void _mi_stats_print(mi_stats_t* stats, mi_output_fun* out0, void* arg0)
   mi_stat_print(&stats->page_committed, "touched", 1, out, arg);
   mi_stat_print(&stats->segments, "segments", -1, out, arg);
   mi_stat_print(&stats->segments_abandoned, "-abandoned", -1, out, arg);
+  mi_stat_counter_print(&stats->abandoned_hint_reclaim, "-hinted", out, arg);
   mi_stat_print(&stats->segments_cache, "-cached", -1, out, arg);
   mi_stat_print(&stats->pages, "pages", -1, out, arg);
   mi_stat_print(&stats->pages_abandoned, "-abandoned", -1, out, arg);
   mi_stat_counter_print(&stats->pages_extended, "-extended", out, arg);
   mi_stat_counter_print(&stats->page_no_retire, "-noretire", out, arg);
+  mi_stat_counter_print(&stats->page_churn, "-churn", out, arg);
   mi_stat_counter_print(&stats->arena_count, "arenas", out, arg);
   mi_stat_counter_print(&stats->arena_crossover_count, "-crossover", out, arg);
   mi_stat_counter_print(&stats->arena_rollback_count, "-rollback", out, arg);
+  mi_stat_counter_print(&stats->arena_numa_crossover_count, "-numa-xover", out, arg);
   mi_stat_counter_print(&stats->mmap_calls, "mmaps", out, arg);
+  mi_stat_counter_print(&stats->remap_calls, "remaps", out, arg);
+  mi_stat_counter_print(&stats->realloc_no_copy, "nocopy", out, arg);
   mi_stat_counter_print(&stats->commit_calls, "commits", out, arg);
   mi_stat_counter_print(&stats->reset_calls, "resets", out, arg);
   mi_stat_counter_print(&stats->purge_calls, "purges", out, arg);
+  mi_stat_counter_print(&stats->purge_background, "-background", out, arg);
+  if (mi_option_is_enabled(mi_option_thp_aware)) {  // reading the huge page backed memory (from `/proc/self/smaps`) is expensive
+    const size_t thp_rss = _mi_prim_thp_rss();
+    _mi_fprintf(out, arg, "%10s: rss: ", "thp");
+    mi_printf_amount((int64_t)thp_rss, 1, out, arg, "%s");
+    _mi_fprintf(out, arg, ", advised: ");
+    mi_printf_amount(stats->thp_advised.total, 1, out, arg, "%s");
+    _mi_fprintf(out, arg, "\n");
+  }
   mi_stat_print(&stats->threads, "threads", -1, out, arg);
   mi_stat_counter_print_avg(&stats->searches, "searches", out, arg);
   _mi_fprintf(out, arg, "%10s: %5zu\n", "numa nodes", _mi_os_numa_node_count());
@@ -410,6 +434,312 @@ void mi_thread_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept {
 }
 
 
+// ----------------------------------------------------------------
+// Programmatic access to the statistics (see `mimalloc-stats.h`)
+// These never allocate so they can be polled from a metrics exporter.
+// ----------------------------------------------------------------
+
+void mi_stats_get(size_t stats_size, mi_stats_t* stats) mi_attr_noexcept {
+  if (stats == NULL || stats_size < sizeof(int)) return;
+  mi_stats_merge_from(mi_stats_get_default());
+  _mi_memcpy(stats, &_mi_stats_main, (stats_size > sizeof(mi_stats_t) ? sizeof(mi_stats_t) : stats_size));
+  stats->version = MI_STAT_VERSION;
+}
+
+// ----------------------------------------------------------------
+// Cheap per-thread counters (`MI_STAT_COUNTERS=1`)
+// Each thread only writes its own counters (using relaxed loads and stores);
+// all live threads are kept in a list such that the counters can be
+// aggregated on demand, and the counters of terminated threads are merged.
+// ----------------------------------------------------------------
+
+#if MI_STAT_COUNTERS
+static mi_lock_t             mi_stat_counters_lock;
+static mi_thread_counters_t* mi_stat_counters_live;     // counters of all live threads
+static mi_stats_counters_t   mi_stat_counters_done;     // merged counters of terminated threads
+
+static void mi_stat_counters_merge(mi_stats_counters_t* dst, mi_thread_counters_t* src) {
+  dst->malloc_count         += (int64_t)mi_atomic_load_relaxed(&src->malloc_count);
+  dst->malloc_generic_count += (int64_t)mi_atomic_load_relaxed(&src->malloc_generic_count);
+  dst->free_count           += (int64_t)mi_atomic_load_relaxed(&src->free_count);
+  dst->free_mt_count        += (int64_t)mi_atomic_load_relaxed(&src->free_mt_count);
+  for (size_t i = 0; i <= MI_BIN_HUGE; i++) {
+    dst->malloc_samples[i] += (int64_t)mi_atomic_load_relaxed(&src->malloc_samples[i]);
+    dst->free_samples[i]   += (int64_t)mi_atomic_load_relaxed(&src->free_samples[i]);
+  }
+}
+
+void _mi_stat_counters_init(mi_tld_t* tld_main) {
+  mi_lock_init(&mi_stat_counters_lock);
+  _mi_stat_counters_thread_init(tld_main);
+}
+
+void _mi_stat_counters_thread_init(mi_tld_t* tld) {
+  mi_thread_counters_t* const counters = &tld->counters;
+  if (!mi_lock_acquire(&mi_stat_counters_lock)) return;
+  counters->prev = NULL;
+  counters->next = mi_stat_counters_live;
+  if (counters->next != NULL) { counters->next->prev = counters; }
+  mi_stat_counters_live = counters;
+  mi_lock_release(&mi_stat_counters_lock);
+}
+
+void _mi_stat_counters_thread_done(mi_tld_t* tld) {
+  mi_thread_counters_t* const counters = &tld->counters;
+  if (!mi_lock_acquire(&mi_stat_counters_lock)) return;
+  mi_stat_counters_merge(&mi_stat_counters_done, counters);
+  if (counters->prev != NULL) { counters->prev->next = counters->next; }
+  if (counters->next != NULL) { counters->next->prev = counters->prev; }
+  if (mi_stat_counters_live == counters) { mi_stat_counters_live = counters->next; }
+  counters->next = counters->prev = NULL;
+  mi_lock_release(&mi_stat_counters_lock);
+}
+
+void _mi_stat_counters_sample(_Atomic(size_t)* samples, const mi_page_t* page) {
+  const size_t bin = _mi_bin(mi_page_block_size(page));
+  mi_atomic_store_relaxed(&samples[bin], mi_atomic_load_relaxed(&samples[bin]) + 1);
+}
+
+static bool mi_stat_counters_get(mi_stats_counters_t* counters) {
+  if (!mi_lock_acquire(&mi_stat_counters_lock)) return false;
+  *counters = mi_stat_counters_done;
+  counters->threads = 0;
+  for (mi_thread_counters_t* tc = mi_stat_counters_live; tc != NULL; tc = tc->next) {
+    mi_stat_counters_merge(counters, tc);
+    counters->threads++;
+  }
+  mi_lock_release(&mi_stat_counters_lock);
+  counters->sample_rate = MI_STAT_COUNTERS_SAMPLE;
+  return true;
+}
+
+#else
+void _mi_stat_counters_init(mi_tld_t* tld_main)        { MI_UNUSED(tld_main); }
+void _mi_stat_counters_thread_init(mi_tld_t* tld)      { MI_UNUSED(tld); }
+void _mi_stat_counters_thread_done(mi_tld_t* tld)      { MI_UNUSED(tld); }
+void _mi_stat_counters_sample(_Atomic(size_t)* samples, const mi_page_t* page) { MI_UNUSED(samples); MI_UNUSED(page); }
+
+static bool mi_stat_counters_get(mi_stats_counters_t* counters) {
+  _mi_memzero(counters, sizeof(*counters));
+  return false;
+}
+#endif
+
+bool mi_stats_get_counters(size_t size, mi_stats_counters_t* counters) mi_attr_noexcept {
+  if (counters == NULL || size == 0) return false;
+  mi_stats_counters_t all;
+  const bool ok = mi_stat_counters_get(&all);
+  _mi_memcpy(counters, &all, (size > sizeof(all) ? sizeof(all) : size));
+  return ok;
+}
+
+// write into a fixed buffer but keep counting the full length
+typedef struct mi_json_out_s {
+  char*  buf;
+  size_t size;
+  size_t len;
+  size_t depth;   // nesting depth (members at depth 1 are put on separate lines)
+  bool   first;   // no comma needed before the next member
+} mi_json_out_t;
+
+static void mi_json_puts(mi_json_out_t* json, const char* s) {
+  for (; *s != 0; s++, json->len++) {
+    if (json->len + 1 < json->size) { json->buf[json->len] = *s; }
+  }
+}
+
+static void mi_json_printf(mi_json_out_t* json, const char* fmt, ...) {
+  char buf[128];
+  va_list args;
+  va_start(args, fmt);
+  _mi_vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  mi_json_puts(json, buf);
+}
+
+// start a new member (or an array element if `key==NULL`)
+static void mi_json_key(mi_json_out_t* json, const char* key) {
+  if (key == NULL)          { mi_json_puts(json, (json->first ? "\n    " : ",\n    ")); }
+  else if (json->depth > 1) { mi_json_puts(json, (json->first ? "" : ", ")); }
+  else                      { mi_json_puts(json, (json->first ? "\n  " : ",\n  ")); }
+  json->first = false;
+  if (key != NULL) { mi_json_printf(json, "\"%s\": ", key); }
+}
+
+static void mi_json_open(mi_json_out_t* json, const char* key, const char* brace) {
+  if (json->depth > 0) { mi_json_key(json, key); }
+  mi_json_puts(json, brace);
+  json->depth++;
+  json->first = true;
+}
+
+static void mi_json_close(mi_json_out_t* json, const char* brace) {
+  mi_assert_internal(json->depth > 0);
+  json->depth--;
+  mi_json_puts(json, brace);
+  json->first = false;
+}
+
+static void mi_json_int(mi_json_out_t* json, const char* key, int64_t value) {
+  mi_json_key(json, key);
+  mi_json_printf(json, "%lld", (long long)value);
+}
+
+static void mi_json_bool(mi_json_out_t* json, const char* key, bool value) {
+  mi_json_key(json, key);
+  mi_json_puts(json, (value ? "true" : "false"));
+}
+
+static void mi_json_stat_count(mi_json_out_t* json, const char* key, const mi_stat_count_t* stat) {
+  mi_json_key(json, key);
+  mi_json_printf(json, "{ \"allocated\": %lld, \"freed\": %lld, \"peak\": %lld, \"current\": %lld }",
+                 (long long)stat->allocated, (long long)stat->freed, (long long)stat->peak, (long long)stat->current);
+}
+
+static void mi_json_stat_counter(mi_json_out_t* json, const char* key, const mi_stat_counter_t* stat) {
+  mi_json_key(json, key);
+  mi_json_printf(json, "{ \"total\": %lld, \"count\": %lld }", (long long)stat->total, (long long)stat->count);
+}
+
+size_t mi_stats_get_json(size_t buf_size, char* buf) mi_attr_noexcept {
+  mi_json_out_t json = { buf, (buf == NULL ? 0 : buf_size), 0, 0, true };
+  mi_stats_merge_from(mi_stats_get_default());
+  const mi_stats_t* const stats = &_mi_stats_main;
+
+  mi_json_open(&json, NULL, "{");
+  mi_json_int(&json, "version", MI_STAT_VERSION);
+  mi_json_int(&json, "mimalloc_version", mi_version());
+
+  // process
+  size_t elapsed, user_time, sys_time, current_rss, peak_rss, current_commit, peak_commit, page_faults;
+  mi_process_info(&elapsed, &user_time, &sys_time, &current_rss, &peak_rss, &current_commit, &peak_commit, &page_faults);
+  mi_json_open(&json, "process", "{ ");
+  mi_json_int(&json, "elapsed_msecs", (int64_t)elapsed);
+  mi_json_int(&json, "user_msecs", (int64_t)user_time);
+  mi_json_int(&json, "system_msecs", (int64_t)sys_time);
+  mi_json_int(&json, "current_rss", (int64_t)current_rss);
+  mi_json_int(&json, "peak_rss", (int64_t)peak_rss);
+  mi_json_int(&json, "current_commit", (int64_t)current_commit);
+  mi_json_int(&json, "peak_commit", (int64_t)peak_commit);
+  mi_json_int(&json, "page_faults", (int64_t)page_faults);
+  mi_json_int(&json, "thp_rss", (mi_option_is_enabled(mi_option_thp_aware) ? (int64_t)_mi_prim_thp_rss() : 0));
+  mi_json_close(&json, " }");
+
+  // statistics
+  #define MI_JSON_STAT_COUNT(name)    mi_json_stat_count(&json, #name, &stats->name)
+  #define MI_JSON_STAT_COUNTER(name)  mi_json_stat_counter(&json, #name, &stats->name)
+  MI_JSON_STAT_COUNT(segments);
+  MI_JSON_STAT_COUNT(pages);
+  MI_JSON_STAT_COUNT(reserved);
+  MI_JSON_STAT_COUNT(committed);
+  MI_JSON_STAT_COUNT(reset);
+  MI_JSON_STAT_COUNT(purged);
+  MI_JSON_STAT_COUNT(page_committed);
+  MI_JSON_STAT_COUNT(segments_abandoned);
+  MI_JSON_STAT_COUNT(pages_abandoned);
+  MI_JSON_STAT_COUNT(threads);
+  MI_JSON_STAT_COUNT(normal);
+  MI_JSON_STAT_COUNT(huge);
+  MI_JSON_STAT_COUNT(giant);
+  MI_JSON_STAT_COUNT(malloc);
+  MI_JSON_STAT_COUNT(segments_cache);
+  MI_JSON_STAT_COUNTER(pages_extended);
+  MI_JSON_STAT_COUNTER(mmap_calls);
+  MI_JSON_STAT_COUNTER(commit_calls);
+  MI_JSON_STAT_COUNTER(reset_calls);
+  MI_JSON_STAT_COUNTER(purge_calls);
+  MI_JSON_STAT_COUNTER(page_no_retire);
+  MI_JSON_STAT_COUNTER(searches);
+  MI_JSON_STAT_COUNTER(normal_count);
+  MI_JSON_STAT_COUNTER(huge_count);
+  MI_JSON_STAT_COUNTER(arena_count);
+  MI_JSON_STAT_COUNTER(arena_crossover_count);
+  MI_JSON_STAT_COUNTER(arena_rollback_count);
+  MI_JSON_STAT_COUNTER(arena_numa_crossover_count);
+  MI_JSON_STAT_COUNTER(purge_background);
+  MI_JSON_STAT_COUNTER(remap_calls);
+  MI_JSON_STAT_COUNTER(realloc_no_copy);
+  MI_JSON_STAT_COUNTER(page_churn);
+  MI_JSON_STAT_COUNTER(thp_advised);
+  MI_JSON_STAT_COUNTER(abandoned_hint_reclaim);
+  #undef MI_JSON_STAT_COUNT
+  #undef MI_JSON_STAT_COUNTER
+
+  // size bins (only the ones that were used)
+  mi_json_open(&json, "normal_bins", "[");
+  for (size_t i = 0; i <= MI_BIN_HUGE; i++) {
+    const mi_stat_count_t* bin = &stats->normal_bins[i];
+    if (bin->allocated == 0 && bin->freed == 0) continue;
+    mi_json_open(&json, NULL, "{ ");
+    mi_json_int(&json, "bin", (int64_t)i);
+    mi_json_int(&json, "block_size", (int64_t)_mi_bin_size((uint8_t)i));
+    mi_json_stat_count(&json, "stat", bin);
+    mi_json_int(&json, "churn", stats->page_churn_bins[i].total);
+    mi_json_close(&json, " }");
+  }
+  mi_json_close(&json, "]");
+
+  // arenas
+  mi_json_open(&json, "arenas", "[");
+  mi_arena_info_t info;
+  for (size_t i = 0; _mi_arena_get_info(i, &info); i++) {
+    mi_json_open(&json, NULL, "{ ");
+    mi_json_int(&json, "index", (int64_t)i);
+    mi_json_int(&json, "block_size", (int64_t)info.block_size);
+    mi_json_int(&json, "blocks", (int64_t)info.block_count);
+    mi_json_int(&json, "inuse", (int64_t)info.inuse_count);
+    mi_json_int(&json, "committed", (int64_t)info.committed_count);
+    mi_json_int(&json, "abandoned", (int64_t)info.abandoned_count);
+    mi_json_int(&json, "purge", (int64_t)info.purge_count);
+    mi_json_int(&json, "thp", (int64_t)info.thp_count);
+    mi_json_int(&json, "numa_node", info.numa_node);
+    mi_json_bool(&json, "exclusive", info.exclusive);
+    mi_json_bool(&json, "large", info.is_large);
+    mi_json_bool(&json, "pinned", info.is_pinned);
+    mi_json_close(&json, " }");
+  }
+  mi_json_close(&json, "]");
+
+  // sub-process of the current thread
+  mi_subproc_t* const subproc = mi_heap_get_default()->tld->segments.subproc;
+  mi_json_open(&json, "subproc", "{ ");
+  mi_json_bool(&json, "is_main", subproc == _mi_subproc_from_id(mi_subproc_main()));
+  mi_json_int(&json, "abandoned_count", (int64_t)mi_atomic_load_relaxed(&subproc->abandoned_count));
+  mi_json_int(&json, "abandoned_os_list_count", (int64_t)mi_atomic_load_relaxed(&subproc->abandoned_os_list_count));
+  mi_json_close(&json, " }");
+  mi_json_int(&json, "numa_nodes", (int64_t)_mi_os_numa_node_count());
+
+  // per-thread counters (if enabled)
+  mi_stats_counters_t counters;
+  if (mi_stat_counters_get(&counters)) {
+    mi_json_open(&json, "counters", "{ ");
+    mi_json_int(&json, "malloc_count", counters.malloc_count);
+    mi_json_int(&json, "malloc_generic_count", counters.malloc_generic_count);
+    mi_json_int(&json, "free_count", counters.free_count);
+    mi_json_int(&json, "free_mt_count", counters.free_mt_count);
+    mi_json_int(&json, "threads", counters.threads);
+    mi_json_int(&json, "sample_rate", counters.sample_rate);
+    mi_json_close(&json, " }");
+    mi_json_open(&json, "counter_bins", "[");
+    for (size_t i = 0; i <= MI_BIN_HUGE; i++) {
+      if (counters.malloc_samples[i] == 0 && counters.free_samples[i] == 0) continue;
+      mi_json_open(&json, NULL, "{ ");
+      mi_json_int(&json, "bin", (int64_t)i);
+      mi_json_int(&json, "block_size", (int64_t)_mi_bin_size((uint8_t)i));
+      mi_json_int(&json, "malloc_samples", counters.malloc_samples[i]);
+      mi_json_int(&json, "free_samples", counters.free_samples[i]);
+      mi_json_close(&json, " }");
+    }
+    mi_json_close(&json, "]");
+  }
+  mi_json_close(&json, "\n}\n");
+
+  // zero terminate (possibly truncated)
+  if (json.size > 0) { json.buf[json.len < json.size ? json.len : json.size - 1] = 0; }
+  return json.len;
+}
+
+
 // ----------------------------------------------------------------
 // Basic timer for convenience; use milli-seconds to avoid doubles
 // ----------------------------------------------------------------
@@ -27,12 +27,15 @@ we therefore test the API over various inputs. Please add more tests :-)
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
+#include <string.h>
+#include <stdlib.h>
 
 #ifdef __cplusplus
 #include <vector>
 #endif
 
 #include "mimalloc.h"
+#include "mimalloc-stats.h"
 // #include "mimalloc/internal.h"
 #include "mimalloc/types.h" // for MI_DEBUG and MI_BLOCK_ALIGNMENT_MAX
 
@@ -50,6 +53,12 @@ bool test_stl_heap_allocator1(void);
 bool test_stl_heap_allocator2(void);
 bool test_stl_heap_allocator3(void);
 bool test_stl_heap_allocator4(void);
+bool test_heap_profile(void);
+bool test_thread_handoff(void);
+bool test_thread_reuse(void);
+bool test_remote_free_batch(void);
+bool test_purge_background(void);
+bool test_abandoned_hint(void);
 
 bool mem_is_zero(uint8_t* p, size_t size) {
   if (p==NULL) return false;
@@ -59,6 +68,43 @@ bool mem_is_zero(uint8_t* p, size_t size) {
   return true;
 }
 
+// Blocks in a fresh heap for the page and segment placement tests
+typedef struct test_blocks_s {
+  mi_heap_t* heap;
+  void**     blocks;
+  size_t     count;
+} test_blocks_t;
+
+// Allocate `count` blocks of `size` bytes in a fresh heap, or stop at the first block in the
+// `stop_segment`-th segment (if not 0). Returns `false` if an allocation failed.
+static bool test_blocks_alloc(test_blocks_t* tb, size_t size, size_t count, size_t stop_segment) {
+  tb->heap = mi_heap_new();
+  tb->blocks = (void**)mi_calloc(count, sizeof(void*));
+  tb->count = 0;
+  if (tb->heap == NULL || tb->blocks == NULL) return false;
+  size_t segment_count = 0;
+  uintptr_t segment = 0;
+  while (tb->count < count && (stop_segment == 0 || segment_count < stop_segment)) {
+    void* const p = mi_heap_malloc(tb->heap, size);
+    if (p == NULL) return false;
+    tb->blocks[tb->count++] = p;
+    if (segment_count == 0 || (uintptr_t)p / MI_SEGMENT_SIZE != segment) {
+      segment = (uintptr_t)p / MI_SEGMENT_SIZE;
+      segment_count++;
+    }
+  }
+  return true;
+}
+
+static void test_blocks_free(test_blocks_t* tb) {
+  if (tb->heap != NULL) { mi_heap_destroy(tb->heap); }
+  mi_free(tb->blocks);
+}
+
+static uintptr_t test_page_of(const void* p) {
+  return (uintptr_t)p / MI_SMALL_PAGE_SIZE;
+}
+
 // ---------------------------------------------------------------------------
 // Main testing
 // ---------------------------------------------------------------------------
@@ -93,6 +139,31 @@ int main(void) {
     void* p = mi_malloc(67108872);
     mi_free(p);
   };
+  CHECK_BODY("malloc-geometry") {  // allocate at the boundaries of each page kind (see `MI_GEOMETRY`)
+    const size_t sizes[] = { MI_SMALL_OBJ_SIZE_MAX, MI_SMALL_OBJ_SIZE_MAX + 1, MI_MEDIUM_OBJ_SIZE_MAX, MI_MEDIUM_OBJ_SIZE_MAX + 1,
+                             MI_LARGE_OBJ_SIZE_MAX, MI_LARGE_OBJ_SIZE_MAX + 1, MI_SEGMENT_SIZE };
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]) && result; i++) {
+      void* p = mi_malloc(sizes[i]);
+      result = (p != NULL && mi_usable_size(p) >= sizes[i] && mi_is_in_heap_region(p));
+      mi_free(p);
+    }
+  };
+  CHECK_BODY("malloc-size-classes") {  // good sizes are consistent with the actual size classes (see `MI_EXTRA_SIZE_CLASSES`)
+    size_t prev = 0;
+    for (size_t size = 1; size <= 64*MI_KiB && result; size += (size < 1024 ? 1 : 61)) {
+      const size_t good = mi_good_size(size);
+      void* p = mi_malloc(size);
+      result = (p != NULL && good >= prev && mi_usable_size(p) >= size && mi_usable_size(p) + MI_PADDING_SIZE <= good);
+      mi_free(p);
+      prev = good;
+    }
+    #if (MI_BIN_EXTRA_COUNT > 0)
+    const size_t extra[] = { MI_BIN_EXTRA_SIZES };
+    for (size_t i = 0; i < MI_BIN_EXTRA_COUNT && result; i++) {
+      result = (mi_good_size(extra[i] - MI_PADDING_SIZE) == extra[i]);
+    }
+    #endif
+  };
 
   // ---------------------------------------------------
   // Extended
@@ -258,6 +329,16 @@ int main(void) {
   CHECK_BODY("malloc-aligned-at2") {
     void* p = mi_malloc_aligned_at(50,32,8); result = (p != NULL && ((uintptr_t)(p) + 8) % 32 == 0); mi_free(p);
   };
+  CHECK_BODY("malloc-aligned-at-bump") {  // an aligned allocation can take the next fresh block of a page
+    mi_heap_t* heap = mi_heap_new();
+    uint8_t* q = (uint8_t*)mi_heap_malloc(heap, 64);
+    uint8_t* p = (uint8_t*)mi_heap_malloc_aligned_at(heap, 64, 16, 16);
+    result = (q != NULL && p != NULL && ((uintptr_t)(p) + 16) % 16 == 0);
+    #if (MI_SECURE==0)
+    result = result && (p == q + mi_good_size(64));
+    #endif
+    mi_heap_delete(heap);
+  };
   CHECK_BODY("memalign1") {
     void* p;
     bool ok = true;
@@ -311,11 +392,298 @@ int main(void) {
     mi_free(p);
   };
 
+  CHECK_BODY("realloc-huge") {  // huge blocks may be remapped instead of copied
+    const long threshold = mi_option_get(mi_option_remap_threshold);
+    mi_option_set(mi_option_remap_threshold, 1024);
+    size_t size = 4*MI_MiB;
+    uint8_t* p = (uint8_t*)mi_malloc(size);
+    for (; size <= 256*MI_MiB && result; size *= 2) {
+      p[0] = 1; p[size/2] = 2; p[size-1] = 3;
+      p = (uint8_t*)mi_realloc(p, 2*size);
+      result = (p != NULL && p[0] == 1 && p[size/2] == 2 && p[size-1] == 3 && mi_usable_size(p) >= 2*size);
+    }
+    p = (uint8_t*)mi_realloc(p, 8*MI_MiB);  // shrink
+    result = result && (p != NULL && p[0] == 1 && mi_usable_size(p) >= 8*MI_MiB);
+    mi_free(p);
+    mi_option_set(mi_option_remap_threshold, threshold);
+  };
+
+  CHECK_BODY("realloc-huge-os") {  // huge blocks allocated from the OS are remapped also if the remap threshold is not set
+    const long disallow = mi_option_get(mi_option_disallow_arena_alloc);
+    mi_option_set(mi_option_disallow_arena_alloc, 1);  // allocate huge blocks directly from the OS
+    mi_stats_t before, after;
+    mi_stats_get(sizeof(before), &before);
+    uint8_t* p = (uint8_t*)mi_malloc(16*MI_MiB);
+    p[0] = 1; p[16*MI_MiB - 1] = 2;
+    p = (uint8_t*)mi_realloc(p, 64*MI_MiB);
+    result = (p != NULL && p[0] == 1 && p[16*MI_MiB - 1] == 2 && mi_usable_size(p) >= 64*MI_MiB);
+    mi_stats_get(sizeof(after), &after);
+    #if (MI_STAT>0) && defined(__linux__)
+    result = result && (after.realloc_no_copy.count > before.realloc_no_copy.count);
+    #endif
+    mi_free(p);
+    mi_option_set(mi_option_disallow_arena_alloc, disallow);
+  };
+  CHECK_BODY("rezalloc-huge") {
+    uint8_t* p = (uint8_t*)mi_rezalloc(NULL, 8*MI_MiB);
+    memset(p, 1, 8*MI_MiB);
+    p = (uint8_t*)mi_rezalloc(p, 32*MI_MiB);
+    result = (p != NULL && p[8*MI_MiB - 1] == 1 && mem_is_zero(p + 8*MI_MiB, 24*MI_MiB));
+    mi_free(p);
+  };
+
+  CHECK_BODY("expand-huge") {
+    void* p = mi_realloc(NULL, 16*MI_MiB);
+    void* q = mi_expand(p, 8*MI_MiB);     // shrink in place
+    result = (q == NULL || (q == p && mi_usable_size(p) >= 8*MI_MiB));
+    q = mi_expand(p, 64*MI_MiB);          // grow in place (if the address space is available)
+    result = result && (q == NULL || (q == p && mi_usable_size(p) >= 64*MI_MiB));
+    mi_free(p);
+  };
+  CHECK_BODY("realloc-grow-inplace") {
+    mi_heap_t* heap = mi_heap_new();
+    size_t size = 40*MI_KiB;
+    uint8_t* p = (uint8_t*)mi_heap_malloc(heap, size);
+    memset(p, 0x5A, size);
+    result = true;
+    while (result && size < MI_LARGE_OBJ_SIZE_MAX/2) {
+      const size_t newsize = 2*size;
+      p = (uint8_t*)mi_heap_rezalloc(heap, p, newsize);
+      result = (p != NULL && p[0] == 0x5A && p[size-1] == 0x5A && p[size] == 0 && p[newsize-1] == 0);
+      memset(p + size, 0x5A, newsize - size);
+      size = newsize;
+    }
+    mi_free(p);
+    mi_heap_delete(heap);
+  };
+
+  // ---------------------------------------------------
+  // Batch allocation
+  // ---------------------------------------------------
+  CHECK_BODY("malloc-batch") {
+    void* p[1000];
+    const size_t n = mi_heap_malloc_batch(mi_heap_get_default(), 48, p, 1000);
+    result = (n == 1000);
+    for (size_t i = 0; i < n && result; i++) {
+      result = (p[i] != NULL && mi_usable_size(p[i]) >= 48);
+      memset(p[i], 0, 48);
+    }
+    mi_free_batch(p, n);
+  };
+  CHECK_BODY("malloc-batch-large") {
+    void* p[10];
+    const size_t n = mi_heap_malloc_batch(mi_heap_get_default(), 1024*1024, p, 10);
+    result = (n == 10);
+    for (size_t i = 0; i < n && result; i++) {
+      result = (p[i] != NULL && mi_usable_size(p[i]) >= 1024*1024);
+    }
+    mi_free_batch(p, n);
+  };
+  CHECK_BODY("free-batch-mixed") {
+    void* p[100];
+    mi_heap_t* heap = mi_heap_new();
+    for (size_t i = 0; i < 100; i++) {
+      p[i] = (i%3==0 ? NULL : (i%3==1 ? mi_malloc(16*i) : mi_heap_malloc(heap, 32)));
+    }
+    mi_free_batch(p, 100);
+    mi_heap_delete(heap);
+  };
+
+  // ---------------------------------------------------
+  // Statistics
+  // ---------------------------------------------------
+  CHECK_BODY("stats-get") {
+    mi_stats_t stats;
+    mi_stats_get(sizeof(stats), &stats);
+    result = (stats.version == MI_STAT_VERSION && stats.arena_count.count >= 0);
+  };
+  CHECK_BODY("stats-get-json") {
+    char buf[64*1024];
+    const size_t len = mi_stats_get_json(sizeof(buf), buf);
+    result = (len > 0 && len < sizeof(buf) && strlen(buf) == len && buf[0] == '{' && strstr(buf, "\"normal_bins\"") != NULL && strstr(buf, "\"page_churn\"") != NULL && strstr(buf, "\"thp_rss\"") != NULL);
+  };
+  CHECK_BODY("stats-get-json-truncated") {
+    char buf[16];
+    const size_t len = mi_stats_get_json(sizeof(buf), buf);
+    result = (len >= sizeof(buf) && strlen(buf) == sizeof(buf) - 1 && mi_stats_get_json(0, NULL) >= len);
+  };
+  CHECK_BODY("stats-get-counters") {
+    mi_stats_counters_t before, after;
+    const bool enabled = mi_stats_get_counters(sizeof(before), &before);
+    for (int i = 0; i < 1000; i++) { mi_free(mi_malloc(32)); }
+    mi_stats_get_counters(sizeof(after), &after);
+    result = (enabled ? (after.malloc_count >= before.malloc_count + 1000 && after.free_count >= before.free_count + 1000 && after.threads >= 1)
+                      : (after.malloc_count == 0 && after.sample_rate == 0));
+  };
+
   // ---------------------------------------------------
   // Heaps
   // ---------------------------------------------------
   CHECK("heap_destroy", test_heap1());
   CHECK("heap_delete", test_heap2());
+  CHECK("heap_profile", test_heap_profile());
+  CHECK_BODY("heap_new_numa") {
+    mi_heap_t* heap = mi_heap_new_numa(0, false, 0 /* no arena */, 1 /* may not exist */);
+    void* p = mi_heap_malloc(heap, 100);
+    void* q = mi_heap_malloc(heap, 8*1024*1024);  // huge
+    result = (p != NULL && q != NULL);
+    mi_free(p);
+    mi_free(q);
+    mi_heap_delete(heap);
+  };
+  CHECK_BODY("heap_in_arena_best_fit") {  // a freed single block range is reused before a larger prefix or suffix range
+    // fill one whole bitmap field of arena blocks (of `MI_SEGMENT_SIZE`) with a 2 block and 62 single block huge allocations
+    const size_t block_size = MI_SEGMENT_SIZE;
+    mi_arena_id_t arena_id;
+    result = (mi_reserve_os_memory_ex(64*block_size, false, false, true /* exclusive */, &arena_id) == 0);
+    mi_heap_t* heap = (result ? mi_heap_new_in_arena(arena_id) : NULL);
+    if (heap != NULL) {
+      void* p[63];
+      for (int i = 0; i < 63; i++) {
+        p[i] = mi_heap_malloc(heap, (i == 0 ? block_size + block_size/2 : 3*block_size/4));
+        if (p[i] == NULL) { result = false; }
+      }
+      // free a 2 block prefix, a single block hole, and a 3 block suffix
+      void* const hole = p[2];
+      const int frees[5] = { 0, 2, 60, 61, 62 };
+      for (int i = 0; i < 5; i++) { mi_free(p[frees[i]]); p[frees[i]] = NULL; }
+      void* q = mi_heap_malloc(heap, 3*block_size/4);
+      result = (result && q == hole);
+      mi_free(q);
+      for (int i = 0; i < 63; i++) { mi_free(p[i]); }
+      mi_heap_delete(heap);
+    }
+  };
+  CHECK_BODY("heap_in_arena_purge") {  // a forced collect purges all scheduled arena blocks
+    mi_arena_id_t arena_id;
+    result = (mi_reserve_os_memory_ex(256*1024*1024, true /* commit */, false, true /* exclusive */, &arena_id) == 0);
+    mi_heap_t* heap = (result ? mi_heap_new_in_arena(arena_id) : NULL);
+    if (heap != NULL) {
+      mi_free(mi_heap_malloc(heap, 40*1024*1024));
+      mi_heap_delete(heap);
+      mi_collect(true);
+      static char buf[64*1024];
+      mi_stats_get_json(sizeof(buf), buf);
+      for (const char* s = strstr(buf, "\"purge\": "); s != NULL && result; s = strstr(s + 1, "\"purge\": ")) {
+        result = (s[9] == '0');
+      }
+    }
+  };
+  CHECK("purge_background", test_purge_background());
+  CHECK_BODY("thp_purge_collect") {  // free pages are purged on a forced collect, also if they share a huge OS page with a page in use
+    mi_option_set(mi_option_thp_aware, 1);
+    const size_t count = (16*MI_MiB) / 1024;  // fill whole segments so they are advised to use huge OS pages
+    mi_heap_t* heap = mi_heap_new();
+    void** blocks = (void**)mi_malloc(count * sizeof(void*));
+    for (size_t i = 0; i < count; i++) { blocks[i] = mi_heap_malloc(heap, 1024); }
+    size_t commit_full = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_full, NULL, NULL);
+    for (size_t i = 0; i < count; i++) {  // keep a block in every 1MiB (so each huge OS page has a page in use)
+      if (i % 1024 != 0) { mi_free(blocks[i]); blocks[i] = NULL; }
+    }
+    mi_heap_collect(heap, true);
+    mi_collect(true);
+    size_t commit_freed = 0;
+    mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_freed, NULL, NULL);
+    result = (commit_freed + 8*MI_MiB <= commit_full);
+    for (size_t i = 0; i < count; i++) { mi_free(blocks[i]); }
+    mi_free(blocks);
+    mi_heap_delete(heap);
+    mi_option_set(mi_option_thp_aware, 0);
+  };
+  CHECK_BODY("heap_cpu_cache") {  // a freed small block is reused through the per-CPU cache
+    mi_option_set(mi_option_cpu_cache, 16);
+    mi_thread_init();  // enables the per-CPU caches
+    void* p = mi_malloc(48);
+    memset(p, 1, 48);
+    mi_free(p);
+    void* q = mi_zalloc(48);
+    #if defined(__linux__) && !defined(MI_TRACK_VALGRIND) && !defined(MI_TRACK_ASAN)
+    result = (q == p);
+    #endif
+    result = result && ((uint8_t*)q)[0] == 0 && ((uint8_t*)q)[47] == 0;
+    mi_free(q);
+    mi_option_set(mi_option_cpu_cache, 0);
+    mi_collect(true);  // flushes and disables the caches again
+  };
+  CHECK_BODY("heap_page_candidates") {  // allocate from the fullest page instead of the first sparse page
+    test_blocks_t tb;
+    result = test_blocks_alloc(&tb, 64, 4*(MI_SMALL_PAGE_SIZE/64), 0);
+    if (result) {
+      void** blocks = tb.blocks;
+      const size_t count = tb.count;
+      const uintptr_t last = test_page_of(blocks[count-1]);
+      const uintptr_t sparse = test_page_of(blocks[0]);
+      const uintptr_t dense = test_page_of(blocks[count/2]);
+      result = (sparse != dense && sparse != last && dense != last);
+      for (size_t i = 1; i < count && result; i++) {  // keep one block in the sparse page and free a few in the dense one
+        const uintptr_t page = test_page_of(blocks[i]);
+        if (page == sparse || (page == dense && i % 64 == 0)) { mi_free(blocks[i]); blocks[i] = NULL; }
+      }
+      void* p = NULL;
+      for (size_t i = 0; i <= count && result; i++) {  // fill up the last page
+        p = mi_heap_malloc(tb.heap, 64);
+        if (test_page_of(p) != last) break;
+      }
+      result = result && (test_page_of(p) == dense);
+    }
+    test_blocks_free(&tb);
+  };
+  CHECK_BODY("heap_segment_fill") {  // a fresh page is not allocated in a sparsely used segment
+    const size_t size = MI_SMALL_OBJ_SIZE_MAX/2;  // in small pages (also with padding)
+    test_blocks_t tb;
+    result = test_blocks_alloc(&tb, size, 3*(MI_SEGMENT_SIZE/size), 3);
+    if (result) {
+      void** blocks = tb.blocks;
+      const size_t n = tb.count;
+      const uintptr_t sparse = (uintptr_t)blocks[0] / MI_SEGMENT_SIZE;
+      const uintptr_t dense = (uintptr_t)blocks[n/2] / MI_SEGMENT_SIZE;
+      const uintptr_t last = (uintptr_t)blocks[n-1] / MI_SEGMENT_SIZE;
+      result = (sparse != dense && sparse != last && dense != last);
+      const uintptr_t kept = test_page_of(blocks[0]);
+      const uintptr_t freed = test_page_of(blocks[n/2]);
+      for (size_t i = 0; i < n && result; i++) {  // keep one page in the sparse segment and free one page in the dense one
+        const uintptr_t page = test_page_of(blocks[i]);
+        const uintptr_t segment = (uintptr_t)blocks[i] / MI_SEGMENT_SIZE;
+        if ((segment == sparse && page != kept) || page == freed) { mi_free(blocks[i]); blocks[i] = NULL; }
+      }
+      mi_heap_collect(tb.heap, true);
+      void* p = mi_heap_malloc(tb.heap, size/2);
+      const uintptr_t segment = (uintptr_t)p / MI_SEGMENT_SIZE;
+      result = result && (segment != sparse && segment != last);
+    }
+    test_blocks_free(&tb);
+  };
+  CHECK_BODY("heap_defrag") {  // move a block out of a sparse page
+    test_blocks_t tb;
+    result = test_blocks_alloc(&tb, 64, 3*(MI_SMALL_PAGE_SIZE/64), 0);
+    if (result) {
+      void** blocks = tb.blocks;
+      const size_t count = tb.count;
+      const uintptr_t sparse = test_page_of(blocks[0]);
+      const uintptr_t full = test_page_of(blocks[count/2]);
+      for (size_t i = 1; i < count; i++) {  // keep one block in the first page, keep a full page, and free a few blocks in the others
+        const uintptr_t page = test_page_of(blocks[i]);
+        if (page == sparse || (page != full && i % 64 == 0)) { mi_free(blocks[i]); blocks[i] = NULL; }
+      }
+      size_t used = 0;
+      size_t total = 0;
+      result = (mi_page_utilization(blocks[0], &used, &total) && used == 1 && total >= 64);
+      result = result && !mi_page_utilization(NULL, &used, &total) && !mi_page_utilization(&used, &used, &total) && !mi_defrag_hint(&used);
+      result = result && mi_heap_defrag_hint(tb.heap, blocks[0]) && mi_defrag_hint(blocks[0]) && !mi_heap_defrag_hint(tb.heap, blocks[count/2]);
+      memset(blocks[0], 42, 64);
+      uint8_t* p = (uint8_t*)mi_heap_defrag_realloc(tb.heap, blocks[0], 64);
+      result = result && (p != NULL && test_page_of(p) != sparse && p[0] == 42 && p[63] == 42);
+      // even the only block in a heap moves to another page
+      mi_heap_t* heap2 = mi_heap_new();
+      void* q = mi_heap_malloc(heap2, 32);
+      const uintptr_t page = test_page_of(q);
+      q = mi_heap_defrag_realloc(heap2, q, 32);
+      result = result && (q != NULL && test_page_of(q) != page);
+      mi_heap_destroy(heap2);
+    }
+    test_blocks_free(&tb);
+  };
 
   //mi_stats_print(NULL);
 
@@ -330,6 +698,11 @@ int main(void) {
   };
   #endif
 
+  CHECK("thread_handoff", test_thread_handoff());
+  CHECK("thread_reuse", test_thread_reuse());
+  CHECK("remote_free_batch", test_remote_free_batch());
+  CHECK("abandoned_hint", test_abandoned_hint());
+
   CHECK("stl_allocator1", test_stl_allocator1());
   CHECK("stl_allocator2", test_stl_allocator2());
 
@@ -368,6 +741,260 @@ bool test_heap2(void) {
   return true;
 }
 
+static char   profile_buf[64*1024];
+static size_t profile_len;
+
+static void profile_out(const char* msg, void* arg) {
+  (void)(arg);
+  const size_t n = strlen(msg);
+  if (profile_len + n < sizeof(profile_buf)) { memcpy(profile_buf + profile_len, msg, n + 1); profile_len += n; }
+}
+
+static size_t profile_unwind(void** frames, size_t max_frames, void* arg) {
+  (void)(arg);
+  if (max_frames < 2) return 0;
+  frames[0] = (void*)0x1234;
+  frames[1] = (void*)0x5678;
+  return 2;
+}
+
+static long profile_dump_count(void) {
+  profile_len = 0;
+  profile_buf[0] = 0;
+  mi_heap_profile_dump(&profile_out, NULL);
+  const char* s = strstr(profile_buf, "heap profile: ");
+  return (s == NULL ? -1 : strtol(s + 14, NULL, 10));
+}
+
+bool test_heap_profile(void) {
+  mi_heap_profile_set_unwinder(&profile_unwind, NULL);
+  mi_option_set(mi_option_heap_profile_interval, 1);  // sample about once every KiB
+  void* p[1000];
+  for (int i = 0; i < 1000; i++) { p[i] = mi_malloc(64); }
+  const long sampled = profile_dump_count();
+  const bool ok = (sampled > 0 && strstr(profile_buf, "@ heap_v2/1024") != NULL && strstr(profile_buf, "@ 0x00001234 0x00005678") != NULL);
+  for (int i = 0; i < 1000; i++) { mi_free(p[i]); }
+  const long remaining = profile_dump_count();
+  mi_option_set(mi_option_heap_profile_interval, 0);
+  mi_heap_profile_set_unwinder(NULL, NULL);
+  return (ok && remaining >= 0 && remaining < sampled);
+}
+
+// run `fn(arg)` in a new thread and wait for it to finish
+#ifdef _WIN32
+#include <windows.h>
+typedef struct thread_fun_s { void (*fn)(void*); void* arg; } thread_fun_t;
+static DWORD WINAPI thread_entry(LPVOID param) {
+  thread_fun_t* tf = (thread_fun_t*)param;
+  tf->fn(tf->arg);
+  return 0;
+}
+static void run_thread(void (*fn)(void*), void* arg) {
+  thread_fun_t tf = { fn, arg };
+  HANDLE thandle = CreateThread(0, 0, &thread_entry, &tf, 0, NULL);
+  WaitForSingleObject(thandle, INFINITE);
+  CloseHandle(thandle);
+}
+static void sleep_msecs(long msecs) {
+  Sleep((DWORD)msecs);
+}
+#else
+#include <pthread.h>
+typedef struct thread_fun_s { void (*fn)(void*); void* arg; } thread_fun_t;
+static void* thread_entry(void* param) {
+  thread_fun_t* tf = (thread_fun_t*)param;
+  tf->fn(tf->arg);
+  return NULL;
+}
+static void run_thread(void (*fn)(void*), void* arg) {
+  thread_fun_t tf = { fn, arg };
+  pthread_t thread;
+  pthread_create(&thread, NULL, &thread_entry, &tf);
+  pthread_join(thread, NULL);
+}
+#include <time.h>
+static void sleep_msecs(long msecs) {
+  struct timespec t = { msecs / 1000, (msecs % 1000) * 1000000 };
+  nanosleep(&t, NULL);
+}
+#endif
+
+// are there no arena blocks scheduled to be purged?
+static bool arenas_purged(void) {
+  static char buf[64*1024];
+  mi_stats_get_json(sizeof(buf), buf);
+  for (const char* s = strstr(buf, "\"purge\": "); s != NULL; s = strstr(s + 1, "\"purge\": ")) {
+    if (s[9] != '0') return false;
+  }
+  return true;
+}
+
+bool test_purge_background(void) {
+  // with the option enabled (after process initialization) freed arena blocks are purged without an explicit collect
+  const long background = mi_option_get(mi_option_purge_background);
+  mi_option_set(mi_option_purge_background, 1);
+  mi_arena_id_t arena_id;
+  bool ok = (mi_reserve_os_memory_ex(256*MI_MiB, true /* commit */, false, true /* exclusive */, &arena_id) == 0);
+  mi_heap_t* heap = (ok ? mi_heap_new_in_arena(arena_id) : NULL);
+  if (heap != NULL) {
+    mi_free(mi_heap_malloc(heap, 40*MI_MiB));  // starts the background thread
+    mi_heap_delete(heap);
+    ok = !arenas_purged();  // the purge is delayed
+    for (int i = 0; i < 500 && ok && !arenas_purged(); i++) { sleep_msecs(10); }
+    ok = ok && arenas_purged();
+  }
+  mi_option_set(mi_option_purge_background, background);  // and the background thread exits
+  return ok;
+}
+
+#define HANDOFF_BLOCKS  (100)
+
+typedef struct handoff_data_s {
+  uint8_t*             blocks[HANDOFF_BLOCKS];
+  mi_thread_handoff_t* handoff;
+  bool                 adopted;
+} handoff_data_t;
+
+static bool handoff_blocks_intact(handoff_data_t* d) {
+  for (size_t i = 0; i < HANDOFF_BLOCKS; i++) {
+    if (d->blocks[i] == NULL || d->blocks[i][0] != (uint8_t)i || d->blocks[i][99] != (uint8_t)i) return false;
+  }
+  return true;
+}
+
+static void handoff_worker(void* arg) {
+  handoff_data_t* d = (handoff_data_t*)arg;
+  for (size_t i = 0; i < HANDOFF_BLOCKS; i++) {
+    d->blocks[i] = (uint8_t*)mi_malloc(100);
+    memset(d->blocks[i], (int)i, 100);
+  }
+  d->handoff = mi_thread_done_handoff();
+}
+
+static void adopt_worker(void* arg) {
+  handoff_data_t* d = (handoff_data_t*)arg;
+  d->adopted = mi_thread_adopt(d->handoff);
+  d->handoff = NULL;
+  for (size_t i = 0; i < HANDOFF_BLOCKS && d->adopted; i++) {  // the blocks now belong to this thread
+    d->adopted = mi_heap_check_owned(mi_heap_get_backing(), d->blocks[i]);
+  }
+  d->adopted = d->adopted && handoff_blocks_intact(d);
+  for (size_t i = 0; i < HANDOFF_BLOCKS; i++) {
+    mi_free(d->blocks[i]);
+  }
+}
+
+bool test_thread_handoff(void) {
+  // adopt the memory of a thread in another thread
+  handoff_data_t d;
+  memset(&d, 0, sizeof(d));
+  run_thread(&handoff_worker, &d);
+  if (d.handoff == NULL || !handoff_blocks_intact(&d)) return false;
+  run_thread(&adopt_worker, &d);
+  if (!d.adopted) return false;
+
+  // or release it without adopting
+  memset(&d, 0, sizeof(d));
+  run_thread(&handoff_worker, &d);
+  if (d.handoff == NULL) return false;
+  mi_thread_handoff_release(d.handoff);
+  const bool intact = handoff_blocks_intact(&d);
+  for (size_t i = 0; i < HANDOFF_BLOCKS; i++) {
+    mi_free(d.blocks[i]);
+  }
+  return intact;
+}
+
+static void reuse_worker(void* arg) {
+  *((mi_heap_t**)arg) = mi_heap_get_backing();
+  void* blocks[100];
+  for (size_t i = 0; i < 100; i++) { blocks[i] = mi_malloc(8 + i*16); }
+  for (size_t i = 0; i < 100; i++) { mi_free(blocks[i]); }
+}
+
+bool test_thread_reuse(void) {
+  // the metadata of terminated threads is reused, so creating many threads does not increase the committed memory
+  mi_heap_t* heap = NULL;
+  for (size_t i = 0; i < 10; i++) { run_thread(&reuse_worker, &heap); }
+  size_t commit_before = 0;
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_before, NULL, NULL);
+  size_t reused = 0;
+  for (size_t i = 0; i < 500; i++) {
+    mi_heap_t* const prev = heap;
+    run_thread(&reuse_worker, &heap);
+    if (heap == prev) { reused++; }
+  }
+  size_t commit_after = 0;
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &commit_after, NULL, NULL);
+  return (reused >= 250 && commit_after <= commit_before + 256*MI_KiB);
+}
+
+#define REMOTE_BLOCKS  (100)
+
+static void remote_free_worker(void* arg) {
+  void** blocks = (void**)arg;
+  mi_thread_init();  // the magazine is in the thread local data (which is otherwise only initialized on the first allocation)
+  for (size_t i = 1; i < REMOTE_BLOCKS/2; i++) { mi_free(blocks[i]); }
+  mi_collect(false);  // publishes the pending blocks
+  for (size_t i = REMOTE_BLOCKS/2; i < REMOTE_BLOCKS; i++) { mi_free(blocks[i]); }  // and the rest are published when the thread terminates
+}
+
+bool test_remote_free_batch(void) {
+  // blocks freed by another thread are collected in its remote free magazine and all reach their page
+  const long batch = mi_option_get(mi_option_remote_free_batch);
+  mi_option_set(mi_option_remote_free_batch, 16);
+  bool ok = true;
+  for (int destroy = 0; destroy <= 1 && ok; destroy++) {  // pages of heaps that can be destroyed are not batched
+    mi_heap_t* heap = mi_heap_new_ex(0, destroy != 0, 0 /* no arena */);
+    void* blocks[REMOTE_BLOCKS];
+    for (size_t i = 0; i < REMOTE_BLOCKS; i++) { blocks[i] = mi_heap_malloc(heap, 64); }
+    run_thread(&remote_free_worker, blocks);
+    mi_heap_collect(heap, false);
+    size_t used = 0;
+    ok = (mi_page_utilization(blocks[0], &used, NULL) && used == 1);
+    mi_free(blocks[0]);
+    if (destroy) { mi_heap_destroy(heap); } else { mi_heap_delete(heap); }
+  }
+  mi_option_set(mi_option_remote_free_batch, batch);
+  return ok;
+}
+
+#define HINT_BLOCKS  (3*(MI_SMALL_PAGE_SIZE/64))
+
+static void hint_abandon_worker(void* arg) {
+  // keep one block so the segment is abandoned (with free small pages) when the thread terminates
+  void** kept = (void**)arg;
+  void** blocks = (void**)mi_malloc(HINT_BLOCKS * sizeof(void*));
+  for (size_t i = 0; i < HINT_BLOCKS; i++) { blocks[i] = mi_malloc(64); }
+  *kept = blocks[0];
+  for (size_t i = 1; i < HINT_BLOCKS; i++) { mi_free(blocks[i]); }
+  mi_free(blocks);
+}
+
+static void hint_reclaim_worker(void* arg) {
+  // a fresh small page is taken from the abandoned segment (found through its hint)
+  void** kept = (void**)arg;
+  void* p = mi_malloc(64);
+  if (!mi_heap_check_owned(mi_heap_get_backing(), *kept)) { *kept = NULL; }
+  mi_free(p);
+}
+
+bool test_abandoned_hint(void) {
+  const long warm_start = mi_option_get(mi_option_thread_warm_start);
+  mi_option_set(mi_option_thread_warm_start, 0);  // do not reclaim the segment of the previous thread on a warm start
+  mi_stats_t before, after;
+  mi_stats_get(sizeof(before), &before);
+  void* kept = NULL;
+  run_thread(&hint_abandon_worker, &kept);
+  void* const block = kept;
+  run_thread(&hint_reclaim_worker, &kept);
+  mi_stats_get(sizeof(after), &after);
+  mi_option_set(mi_option_thread_warm_start, warm_start);
+  const bool ok = (block != NULL && kept == block && after.abandoned_hint_reclaim.count > before.abandoned_hint_reclaim.count);
+  mi_free(block);
+  return ok;
+}
+
 bool test_stl_allocator1(void) {
 #ifdef __cplusplus
   std::vector<int, mi_stl_allocator<int> > vec;
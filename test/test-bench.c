@@ -0,0 +1,623 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2024, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license.
+-----------------------------------------------------------------------------*/
+
+/* Micro benchmarks for the allocator fast paths (in the style of google-benchmark):
+   - single thread malloc/free latency per size class
+   - aligned allocation
+   - realloc growth patterns
+   - cross-thread free throughput
+   - heap destruction and heap walking
+   - arena block claims at various fill ratios, and huge allocation churn, in large (64GiB) reserved arenas
+   - memory usage (RSS) for a number of blocks of common sizes (to compare size class layouts)
+   - memory usage and time with many (1024) threads, with and without the per-CPU caches
+
+   Each benchmark runs a fixed number of iterations for a number of repetitions
+   and reports the median (and minimum) time per iteration. The output is JSON
+   with a fixed order of benchmarks and fields so that the results of different
+   mimalloc versions can be compared directly.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mimalloc.h>
+#include <mimalloc-stats.h>
+
+// > mimalloc-test-bench [--quick] [--repetitions=N] [--filter=SUBSTRING]
+static bool        quick       = false;   // run with few iterations (as a smoke test)
+static int         repetitions = 5;
+static const char* filter      = NULL;
+
+static void* volatile sink;               // prevent optimizing allocations away
+
+
+// ---------------------------------------------------------------------------
+// Timing and threads
+// ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include <windows.h>
+static double clock_now(void) {
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER t;
+  if (freq.QuadPart == 0) { QueryPerformanceFrequency(&freq); }
+  QueryPerformanceCounter(&t);
+  return ((double)t.QuadPart * 1.0e9) / (double)freq.QuadPart;
+}
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+  void (**fun)(void) = (void (**)(void))param;
+  (*fun)();
+  return 0;
+}
+
+static void run_thread(void (*fun)(void)) {
+  HANDLE h = CreateThread(0, 0, &thread_entry, (void*)&fun, 0, NULL);
+  WaitForSingleObject(h, INFINITE);
+  CloseHandle(h);
+}
+
+typedef HANDLE thread_t;
+static void (*thread_fun)(void);
+
+static thread_t thread_start(void (*fun)(void)) {
+  thread_fun = fun;
+  return CreateThread(0, 0, &thread_entry, (void*)&thread_fun, 0, NULL);
+}
+
+static void thread_join(thread_t t) {
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+}
+
+static void thread_yield(void) {
+  Sleep(0);
+}
+
+static void atomic_increment(volatile long* p) {
+  InterlockedIncrement(p);
+}
+#else
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+static double clock_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double)t.tv_sec * 1.0e9) + (double)t.tv_nsec;
+}
+
+static void* thread_entry(void* param) {
+  void (**fun)(void) = (void (**)(void))param;
+  (*fun)();
+  return NULL;
+}
+
+static void run_thread(void (*fun)(void)) {
+  pthread_t thread;
+  pthread_create(&thread, NULL, &thread_entry, (void*)&fun);
+  pthread_join(thread, NULL);
+}
+
+typedef pthread_t thread_t;
+static void (*thread_fun)(void);
+
+static thread_t thread_start(void (*fun)(void)) {
+  pthread_t thread;
+  thread_fun = fun;
+  pthread_create(&thread, NULL, &thread_entry, (void*)&thread_fun);
+  return thread;
+}
+
+static void thread_join(thread_t t) {
+  pthread_join(t, NULL);
+}
+
+static void thread_yield(void) {
+  sched_yield();
+}
+
+static void atomic_increment(volatile long* p) {
+  __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL);
+}
+#endif
+
+
+// ---------------------------------------------------------------------------
+// Benchmark driver
+// ---------------------------------------------------------------------------
+
+// A benchmark runs `iters` iterations and returns the time it took in nano-seconds
+// (this allows benchmarks to exclude their setup time).
+typedef double (bench_fun_t)(size_t iters, size_t arg);
+
+static bool first_result = true;
+
+static int compare_double(const void* a, const void* b) {
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static void bench(const char* name, size_t arg, bench_fun_t* fun, size_t iters) {
+  char fullname[128];
+  if (arg > 0) { snprintf(fullname, sizeof(fullname), "%s/%zu", name, arg); }
+          else { snprintf(fullname, sizeof(fullname), "%s", name); }
+  if (filter != NULL && strstr(fullname, filter) == NULL) return;
+  if (quick) { iters = (iters >= 100 ? iters / 100 : 1); }
+
+  double times[16];
+  const int reps = (repetitions > 16 ? 16 : repetitions);
+  fun(iters / 10 + 1, arg);   // warm up
+  for (int i = 0; i < reps; i++) {
+    times[i] = fun(iters, arg) / (double)iters;
+  }
+  qsort(times, (size_t)reps, sizeof(double), &compare_double);
+  const double median = times[reps / 2];
+
+  printf("%s\n    { \"name\": \"%s\", \"iterations\": %zu, \"repetitions\": %d, \"real_time\": %.3f, \"min_time\": %.3f, \"time_unit\": \"ns\", \"items_per_second\": %.0f }",
+         (first_result ? "" : ","), fullname, iters, reps, median, times[0], (median > 0 ? 1.0e9 / median : 0.0));
+  first_result = false;
+  fflush(stdout);
+}
+
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+// latency of a single malloc followed by a free
+static double bench_malloc_free(size_t iters, size_t size) {
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    void* p = mi_malloc(size);
+    sink = p;
+    mi_free(p);
+  }
+  return clock_now() - start;
+}
+
+// allocate a burst of blocks and free them again (in allocation order)
+#define BURST  (1000)
+static double bench_malloc_burst(size_t iters, size_t size) {
+  static void* blocks[BURST];
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i += BURST) {
+    const size_t n = (iters - i < BURST ? iters - i : BURST);
+    for (size_t j = 0; j < n; j++) { blocks[j] = mi_malloc(size); }
+    sink = blocks[n-1];
+    for (size_t j = 0; j < n; j++) { mi_free(blocks[j]); }
+  }
+  return clock_now() - start;
+}
+
+static double bench_malloc_aligned(size_t iters, size_t alignment) {
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    void* p = mi_malloc_aligned(64, alignment);
+    sink = p;
+    mi_free(p);
+  }
+  return clock_now() - start;
+}
+
+// grow a block by doubling its size from 16 bytes up to `max_size`
+static double bench_realloc_double(size_t iters, size_t max_size) {
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    void* p = NULL;
+    for (size_t size = 16; size <= max_size; size *= 2) { p = mi_realloc(p, size); }
+    sink = p;
+    mi_free(p);
+  }
+  return clock_now() - start;
+}
+
+// grow a block in steps of `step` bytes up to 64 KiB (like appending to a buffer)
+static double bench_realloc_linear(size_t iters, size_t step) {
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    void* p = NULL;
+    for (size_t size = step; size <= 64*1024; size += step) { p = mi_realloc(p, size); }
+    sink = p;
+    mi_free(p);
+  }
+  return clock_now() - start;
+}
+
+// free blocks that were allocated by another thread
+static void**  cross_blocks;
+static size_t  cross_count;
+static double  cross_time;
+
+static void cross_free(void) {
+  const double start = clock_now();
+  for (size_t i = 0; i < cross_count; i++) { mi_free(cross_blocks[i]); }
+  cross_time = clock_now() - start;
+}
+
+static double bench_free_cross_thread(size_t iters, size_t size) {
+  cross_blocks = (void**)mi_malloc(iters * sizeof(void*));
+  cross_count = iters;
+  for (size_t i = 0; i < iters; i++) { cross_blocks[i] = mi_malloc(size); }
+  run_thread(&cross_free);
+  mi_free(cross_blocks);
+  mi_collect(false);  // collect the delayed frees
+  return cross_time;
+}
+
+// allocate `count` blocks of mixed sizes in a fresh heap
+static mi_heap_t* heap_fill(size_t count) {
+  mi_heap_t* heap = mi_heap_new();
+  for (size_t i = 0; i < count; i++) {
+    sink = mi_heap_malloc(heap, 16 + (i % 32) * 16);
+  }
+  return heap;
+}
+
+// destroy a heap with `count` blocks (cost per destroyed heap)
+static double bench_heap_destroy(size_t iters, size_t count) {
+  double total = 0;
+  for (size_t i = 0; i < iters; i++) {
+    mi_heap_t* heap = heap_fill(count);
+    const double start = clock_now();
+    mi_heap_destroy(heap);
+    total += clock_now() - start;
+  }
+  return total;
+}
+
+// churn a large reserved arena with huge allocations of random sizes between 4MiB and 256MiB
+// while keeping `live` blocks alive (cost per free and allocation)
+static mi_heap_t* arena_heap;
+
+static double bench_arena_huge_churn(size_t iters, size_t live) {
+  if (arena_heap == NULL) {
+    mi_arena_id_t arena_id;
+    if (sizeof(void*) < 8 || mi_reserve_os_memory_ex((size_t)64*1024*1024*1024, false /* commit */, false, true /* exclusive */, &arena_id) != 0) return 0;
+    arena_heap = mi_heap_new_in_arena(arena_id);
+    if (arena_heap == NULL) return 0;
+  }
+  const size_t max_blocks = (quick ? 4 : 64);  // in quick mode avoid filling GiB's of memory in a debug build
+  void** blocks = (void**)calloc(live, sizeof(void*));
+  uint32_t r = 42;
+  for (size_t i = 0; i < live; i++) {
+    r = r*1103515245u + 12345u;
+    blocks[i] = mi_heap_malloc(arena_heap, ((r >> 8) % max_blocks + 1) * 4*1024*1024);
+  }
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    r = r*1103515245u + 12345u;
+    const size_t j = (r >> 8) % live;
+    mi_free(blocks[j]);
+    r = r*1103515245u + 12345u;
+    blocks[j] = mi_heap_malloc(arena_heap, ((r >> 8) % max_blocks + 1) * 4*1024*1024);
+  }
+  const double end = clock_now();
+  for (size_t i = 0; i < live; i++) { mi_free(blocks[i]); }
+  free(blocks);
+  return (end - start);
+}
+
+// latency of claiming (and releasing) a single block in a large reserved arena that is filled
+// up to `fill` percent from the start (so a claim first has to skip over the used part)
+static mi_heap_t* claim_heap;
+static void**     claim_blocks;
+static size_t     claim_count;
+
+static double bench_arena_claim(size_t iters, size_t fill) {
+  const size_t block_size = 4*1024*1024;
+  const size_t arena_blocks = (quick ? 256 : 16384);  // 1GiB or 64GiB
+  if (claim_heap == NULL) {
+    mi_arena_id_t arena_id;
+    if (sizeof(void*) < 8 || mi_reserve_os_memory_ex(arena_blocks * block_size, false /* commit */, false, true /* exclusive */, &arena_id) != 0) return 0;
+    claim_heap = mi_heap_new_in_arena(arena_id);
+    claim_blocks = (void**)calloc(arena_blocks, sizeof(void*));
+    if (claim_heap == NULL || claim_blocks == NULL) return 0;
+  }
+  const size_t target = arena_blocks * fill / 100;
+  while (claim_count < target && (claim_blocks[claim_count] = mi_heap_malloc(claim_heap, 3*block_size/4)) != NULL) { claim_count++; }
+  while (claim_count > target) { mi_free(claim_blocks[--claim_count]); }
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i++) {
+    void* p = mi_heap_malloc(claim_heap, 3*block_size/4);   // a huge block that takes a single arena block
+    mi_free(p);
+  }
+  return (clock_now() - start);
+}
+
+static bool visit_count(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(area); (void)(block_size);
+  if (block != NULL) { (*(size_t*)arg)++; }
+  return true;
+}
+
+// visit all blocks in a heap (cost per visited block)
+static double bench_heap_visit_blocks(size_t iters, size_t count) {
+  mi_heap_t* heap = heap_fill(count);
+  size_t visited = 0;
+  const double start = clock_now();
+  for (size_t i = 0; i < iters; i += count) {
+    mi_heap_visit_blocks(heap, true, &visit_count, &visited);
+  }
+  const double time = clock_now() - start;
+  mi_heap_destroy(heap);
+  return (visited >= iters ? time * (double)iters / (double)visited : time);
+}
+
+
+// ---------------------------------------------------------------------------
+// Memory usage
+// ---------------------------------------------------------------------------
+
+static bool first_memory = true;
+
+// current resident memory of the process (or 0 if unknown)
+static size_t process_rss(void) {
+  size_t rss = 0;
+  #if defined(__linux__)
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    size_t pages;
+    if (fscanf(f, "%*s %zu", &pages) == 1) { rss = pages * page_size; }
+    fclose(f);
+  }
+  #endif
+  return rss;
+}
+
+static bool visit_committed(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(block_size);
+  if (block == NULL) { *(size_t*)arg += area->committed; }
+  return true;
+}
+
+// allocate `count` blocks of `size` bytes in a fresh heap and report the increase in resident
+// memory and the memory committed for the heap pages (which depends on the size class layout,
+// see `MI_EXTRA_SIZE_CLASSES`)
+static void bench_memory(size_t size, size_t count) {
+  char fullname[128];
+  snprintf(fullname, sizeof(fullname), "rss/%zu", size);
+  if (filter != NULL && strstr(fullname, filter) == NULL) return;
+  if (quick) { count = count / 100; }
+
+  mi_collect(true);
+  const size_t rss0 = process_rss();
+  mi_heap_t* heap = mi_heap_new();
+  for (size_t i = 0; i < count; i++) {
+    sink = mi_heap_malloc(heap, size);
+  }
+  const size_t rss1 = process_rss();
+  size_t committed = 0;
+  mi_heap_visit_blocks(heap, false, &visit_committed, &committed);
+  mi_heap_destroy(heap);
+
+  printf("%s\n    { \"name\": \"%s\", \"blocks\": %zu, \"size\": %zu, \"good_size\": %zu, \"rss\": %zu, \"committed\": %zu, \"waste_percent\": %.1f }",
+         (first_memory ? "" : ","), fullname, count, size, mi_good_size(size),
+         (rss1 > rss0 ? rss1 - rss0 : 0), committed,
+         100.0 * (double)(mi_good_size(size) - size) / (double)mi_good_size(size));
+  first_memory = false;
+  fflush(stdout);
+}
+
+
+static bool visit_pages(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(area); (void)(block_size);
+  if (block == NULL) { *(size_t*)arg += 1; }
+  return true;
+}
+
+static size_t process_segments(void) {
+  mi_stats_t stats;
+  mi_stats_get(sizeof(stats), &stats);
+  return (size_t)stats.segments.current;
+}
+
+// replay the life of a long running cache: fill it with `count` entries of random sizes up to `size_max`,
+// evict down to an eighth, and then keep replacing random entries at that size (or with sizes that
+// drift over the day, or followed by an active defragmentation pass over all entries); we report the
+// pages, segments, and memory in use at the end versus the live bytes, which depends on how well
+// sparse pages and segments drain (see `mi_option_page_max_candidates`, `segment.c:mi_segment_fill_bucket`,
+// and `mi_heap_defrag_hint`)
+typedef enum cache_mode_e { CACHE_REPLAY, CACHE_DRIFT, CACHE_DEFRAG } cache_mode_t;
+
+static void bench_cache_memory(size_t count, size_t size_max, long candidates, cache_mode_t mode) {
+  static const char* mode_names[] = { "replay", "drift", "defrag" };
+  char fullname[128];
+  snprintf(fullname, sizeof(fullname), "cache_%s/%zu/%ld", mode_names[mode], size_max, candidates);
+  if (filter != NULL && strstr(fullname, filter) == NULL) return;
+  if (quick) { count = count / 100; }
+
+  const long candidates0 = mi_option_get(mi_option_page_max_candidates);
+  mi_option_set(mi_option_page_max_candidates, candidates);
+  mi_collect(true);
+  const size_t rss0 = process_rss();
+  const size_t segments0 = process_segments();
+  mi_heap_t* heap = mi_heap_new();
+  void** entries = (void**)calloc(count, sizeof(void*));
+  if (entries == NULL) return;
+  uint32_t r = 42;
+  for (size_t i = 0; i < count; i++) {
+    r = r*1103515245u + 12345u;
+    entries[i] = mi_heap_malloc(heap, 16 + ((r >> 8) % (size_max/16)) * 16);
+  }
+  size_t live = count;
+  while (live > count/8) {
+    r = r*1103515245u + 12345u;
+    const size_t j = (r >> 8) % count;
+    if (entries[j] != NULL) { mi_free(entries[j]); entries[j] = NULL; live--; }
+  }
+  const double start = clock_now();
+  for (size_t i = 0; i < 8*count; i++) {
+    r = r*1103515245u + 12345u;
+    size_t j = (r >> 8) % count;
+    while (entries[j] == NULL) { j = (j + 1) % count; }
+    mi_free(entries[j]);
+    entries[j] = NULL;
+    r = r*1103515245u + 12345u;
+    j = (r >> 8) % count;
+    while (entries[j] != NULL) { j = (j + 1) % count; }
+    const size_t hour = (i * 24) / (8*count);
+    entries[j] = mi_heap_malloc(heap, (mode == CACHE_DRIFT ? 16 + (hour % 8) * (size_max/8) + ((r >> 12) % (size_max/128)) * 16
+                                                           : 16 + ((r >> 12) % (size_max/16)) * 16));
+  }
+  if (mode == CACHE_DEFRAG) {
+    for (size_t i = 0; i < count; i++) {
+      if (entries[i] != NULL && mi_defrag_hint(entries[i])) {
+        void* const p = mi_heap_defrag_realloc(heap, entries[i], mi_usable_size(entries[i]));
+        if (p != NULL) { entries[i] = p; }
+      }
+    }
+  }
+  const double time = clock_now() - start;
+  mi_heap_collect(heap, true);
+  const size_t rss1 = process_rss();
+  const size_t segments1 = process_segments();
+  size_t pages = 0;
+  size_t committed = 0;
+  size_t live_bytes = 0;
+  mi_heap_visit_blocks(heap, false, &visit_pages, &pages);
+  mi_heap_visit_blocks(heap, false, &visit_committed, &committed);
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i] != NULL) { live_bytes += mi_usable_size(entries[i]); }
+  }
+  mi_heap_destroy(heap);
+  free(entries);
+  mi_option_set(mi_option_page_max_candidates, candidates0);
+
+  printf("%s\n    { \"name\": \"%s\", \"entries\": %zu, \"candidates\": %ld, \"real_time\": %.0f, \"time_unit\": \"ns\", \"pages\": %zu, \"segments\": %zu, \"live\": %zu, \"rss\": %zu, \"committed\": %zu }",
+         (first_memory ? "" : ","), fullname, count/8, candidates, time, pages, (segments1 > segments0 ? segments1 - segments0 : 0), live_bytes,
+         (rss1 > rss0 ? rss1 - rss0 : 0), committed);
+  first_memory = false;
+  fflush(stdout);
+}
+
+
+// many threads that each allocate and free small blocks and then keep a few blocks alive until
+// all threads are done; we report the increase in committed memory at that point (which grows
+// with the number of threads as each thread has its own pages, unless the per-CPU caches are used)
+static volatile long threads_done;
+static volatile long threads_exit;
+
+static void threads_work(void) {
+  void* live[16];
+  void* blocks[64];
+  for (size_t round = 0; round < 100; round++) {
+    for (size_t i = 0; i < 64; i++) { blocks[i] = mi_malloc(16 + (i % 16) * 48); }
+    for (size_t i = 0; i < 64; i++) { mi_free(blocks[i]); }
+  }
+  for (size_t i = 0; i < 16; i++) { live[i] = mi_malloc(16 + i * 48); }
+  atomic_increment(&threads_done);
+  while (threads_exit == 0) { thread_yield(); }
+  for (size_t i = 0; i < 16; i++) { mi_free(live[i]); }
+}
+
+static size_t process_commit(void) {
+  size_t current_commit = 0;
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, &current_commit, NULL, NULL);
+  return current_commit;
+}
+
+static void bench_threads_memory(size_t count, long cpu_cache) {
+  char fullname[128];
+  snprintf(fullname, sizeof(fullname), "threads%s/%zu", (cpu_cache > 0 ? "_cpu_cache" : ""), count);
+  if (filter != NULL && strstr(fullname, filter) == NULL) return;
+  if (quick) { count = count / 16; }
+
+  mi_option_set(mi_option_cpu_cache, cpu_cache);  // note: the per-CPU caches are enabled on the next thread start and stay enabled
+  mi_collect(true);
+  thread_t* threads = (thread_t*)malloc(count * sizeof(thread_t));
+  if (threads == NULL) return;
+  threads_done = 0;
+  threads_exit = 0;
+  const size_t commit0 = process_commit();
+  const double start = clock_now();
+  for (size_t i = 0; i < count; i++) {
+    threads[i] = thread_start(&threads_work);
+  }
+  while (threads_done < (long)count) { thread_yield(); }
+  const double time = clock_now() - start;
+  const size_t commit1 = process_commit();
+  threads_exit = 1;
+  for (size_t i = 0; i < count; i++) {
+    thread_join(threads[i]);
+  }
+  free(threads);
+
+  printf("%s\n    { \"name\": \"%s\", \"threads\": %zu, \"cpu_cache\": %ld, \"real_time\": %.0f, \"time_unit\": \"ns\", \"committed\": %zu }",
+         (first_memory ? "" : ","), fullname, count, cpu_cache, time, (commit1 > commit0 ? commit1 - commit0 : 0));
+  first_memory = false;
+  fflush(stdout);
+}
+
+
+// ---------------------------------------------------------------------------
+// Main
+// ---------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) { quick = true; }
+    else if (strncmp(argv[i], "--repetitions=", 14) == 0) { repetitions = atoi(argv[i] + 14); }
+    else if (strncmp(argv[i], "--filter=", 9) == 0) { filter = argv[i] + 9; }
+    else {
+      fprintf(stderr, "usage: %s [--quick] [--repetitions=N] [--filter=SUBSTRING]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (repetitions <= 0) { repetitions = 1; }
+  if (quick) { repetitions = 1; }
+
+  printf("{\n  \"context\": { \"mimalloc_version\": %d, \"pointer_size\": %zu, \"quick\": %s },\n  \"benchmarks\": [",
+         mi_version(), sizeof(void*), (quick ? "true" : "false"));
+
+  static const size_t sizes[] = { 8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16*1024, 64*1024, 256*1024, 1024*1024 };
+  for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    bench("malloc_free", sizes[i], &bench_malloc_free, (sizes[i] <= 64*1024 ? 10000000 : 100000));
+  }
+  for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    if (sizes[i] > 64*1024) break;
+    bench("malloc_burst", sizes[i], &bench_malloc_burst, (sizes[i] <= 1024 ? 10000000 : 1000000));
+  }
+  static const size_t alignments[] = { 16, 64, 256, 4096, 64*1024 };
+  for (size_t i = 0; i < sizeof(alignments)/sizeof(alignments[0]); i++) {
+    bench("malloc_aligned", alignments[i], &bench_malloc_aligned, 1000000);
+  }
+  bench("realloc_double", 64*1024, &bench_realloc_double, 100000);
+  bench("realloc_double", 4*1024*1024, &bench_realloc_double, 1000);
+  bench("realloc_linear", 64, &bench_realloc_linear, 1000);
+  bench("realloc_linear", 1024, &bench_realloc_linear, 10000);
+  bench("free_cross_thread", 16, &bench_free_cross_thread, 1000000);
+  bench("free_cross_thread", 256, &bench_free_cross_thread, 1000000);
+  bench("heap_destroy", 1000, &bench_heap_destroy, 1000);
+  bench("heap_destroy", 100000, &bench_heap_destroy, 10);
+  bench("heap_visit_blocks", 100000, &bench_heap_visit_blocks, 10000000);
+  static const size_t fills[] = { 10, 50, 90, 99 };
+  for (size_t i = 0; i < sizeof(fills)/sizeof(fills[0]); i++) {
+    bench("arena_claim", fills[i], &bench_arena_claim, 100000);
+  }
+  bench("arena_huge_churn", 256, &bench_arena_huge_churn, 100000);
+
+  printf("\n  ],\n  \"memory\": [");
+  static const size_t common_sizes[] = { 48, 72, 200 };
+  for (size_t i = 0; i < sizeof(common_sizes)/sizeof(common_sizes[0]); i++) {
+    bench_memory(common_sizes[i], 1000000);
+  }
+  bench_cache_memory(1000000, 512, 1, CACHE_REPLAY);
+  bench_cache_memory(1000000, 512, 8, CACHE_REPLAY);
+  bench_cache_memory(1000000, 512, 32, CACHE_REPLAY);
+  bench_cache_memory(1000000, 512, 8, CACHE_DRIFT);
+  bench_cache_memory(100000, 16*1024, 8, CACHE_DRIFT);
+  bench_cache_memory(1000000, 512, 8, CACHE_DEFRAG);
+  bench_threads_memory(1024, 0);
+  bench_threads_memory(1024, 64);   // last, as the per-CPU caches stay enabled
+  printf("\n  ]\n}\n");
+  return 0;
+}
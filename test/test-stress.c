@@ -68,6 +68,11 @@ static bool   main_participates = false;       // main thread participates as a
 #define TRANSFERS     (1000)
 static volatile void* transfer[TRANSFERS];
 
+#ifndef USE_STD_MALLOC
+// hand off the memory of some terminating threads to a new thread
+static volatile void* handoff;
+#endif
+
 
 #if (UINTPTR_MAX != UINT32_MAX)
 const uintptr_t cookie = 0xbf58476d1ce4e5b9UL;
@@ -158,6 +163,9 @@ static void stress(intptr_t tid) {
   void** data = NULL;
   size_t data_size = 0;
   size_t data_top = 0;
+  #ifndef USE_STD_MALLOC
+  mi_thread_adopt((mi_thread_handoff_t*)atomic_exchange_ptr(&handoff, NULL));
+  #endif
   void** retained = (void**)custom_calloc(retain,sizeof(void*));
   size_t retain_top = 0;
 
@@ -207,6 +215,13 @@ static void stress(intptr_t tid) {
   }
   custom_free(retained);
   custom_free(data);
+  #ifndef USE_STD_MALLOC
+  if (tid % 2 == 1) {
+    // blocks of this thread can still be in the transfer buffer
+    void* h = mi_thread_done_handoff();
+    mi_thread_adopt((mi_thread_handoff_t*)atomic_exchange_ptr(&handoff, h));
+  }
+  #endif
   //bench_end_thread();
 }
 
@@ -230,6 +245,11 @@ static void test_stress(void) {
         free_items(p);
       }
     }
+    #ifndef USE_STD_MALLOC
+    if (n + 1 == ITER) {
+      mi_thread_adopt((mi_thread_handoff_t*)atomic_exchange_ptr(&handoff, NULL));
+    }
+    #endif
     #ifndef NDEBUG
     //mi_collect(false);
     //mi_debug_show_arenas();